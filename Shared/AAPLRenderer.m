@@ -373,6 +373,8 @@ const static unsigned int blockDim = HUFF_BLOCK_DIM;
 
 - (void) setupHuffmanEncoding
 {
+  const int debugOut = 0;
+  
   unsigned int width = self->renderWidth;
   unsigned int height = self->renderHeight;
   
@@ -381,8 +383,6 @@ const static unsigned int blockDim = HUFF_BLOCK_DIM;
   
   NSMutableData *outFileHeader = [NSMutableData data];
   NSMutableData *outCanonHeader = [NSMutableData data];
-  NSMutableData *outHuffCodes = [NSMutableData data];
-  NSMutableData *outBlockBitOffsets = [NSMutableData data];
   
   // To encode symbols with huffman block encoding, the order of the symbols
   // needs to be broken up so that the input ordering is in terms of blocks and
@@ -397,129 +397,40 @@ const static unsigned int blockDim = HUFF_BLOCK_DIM;
   NSMutableData *outBlockOrderSymbolsData = [NSMutableData dataWithLength:outBlockOrderSymbolsNumBytes];
   uint8_t *outBlockOrderSymbolsPtr = (uint8_t *) outBlockOrderSymbolsData.bytes;
   
-  [Util splitIntoBlocksOfSize:blockDim
-                      inBytes:(uint8_t*)_huffInputBytes.bytes
-                     outBytes:outBlockOrderSymbolsPtr
-                        width:width
-                       height:height
-             numBlocksInWidth:blockWidth
-            numBlocksInHeight:blockHeight
-                    zeroValue:0];
+#if defined(IMPL_DELTAS_BEFORE_HUFF_ENCODING)
+  // Split into blocks and convert each block to byte deltas in one pass
   
-  // Deal with the case where there are not enough total blocks to zero pad
+# if defined(IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING)
+  // The first delta of each block is saved as the block init value and
+  // the delta byte is set to zero. This increases the count of the zero
+  // delta value and reduces the size of the generated tree while storing
+  // the block init value wo a huffman code.
+  
+  NSMutableData *mBlockInitData = [NSMutableData dataWithLength:(blockWidth * blockHeight)];
+  uint8_t *blockInitPtr = (uint8_t *) mBlockInitData.mutableBytes;
+# else
+  uint8_t *blockInitPtr = NULL;
+# endif // IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING
   
-  if ((0)) {
-    //        for (int i = 0; i < outBlockOrderSymbolsNumBytes; i++) {
-    //          printf("outBlockOrderSymbolsPtr[%5i] = %d\n", i, outBlockOrderSymbolsPtr[i]);
-    //        }
-    
-    printf("block order\n");
-    
-    for ( int blocki = 0; blocki < (blockWidth * blockHeight); blocki++ ) {
-      printf("block %5d : ", blocki);
-      
-      uint8_t *blockStartPtr = outBlockOrderSymbolsPtr + (blocki * (blockDim * blockDim));
-      
-      for (int i = 0; i < (blockDim * blockDim); i++) {
-        printf("%5d ", blockStartPtr[i]);
-      }
-      printf("\n");
-    }
-    
-    printf("block order done\n");
-  }
+  [Huffman splitIntoBlockDeltas:(const uint8_t*)_huffInputBytes.bytes
+                  outBlockBytes:outBlockOrderSymbolsPtr
+                   outBlockInit:blockInitPtr
+                          width:width
+                         height:height
+                       blockDim:blockDim];
   
-#if defined(IMPL_DELTAS_BEFORE_HUFF_ENCODING)
-  if ((1)) {
-    // byte deltas
-    
-    NSMutableArray *mBlocks = [NSMutableArray array];
-    
-    for ( int blocki = 0; blocki < (blockWidth * blockHeight); blocki++ ) {
-      NSMutableData *mRowData = [NSMutableData data];
-      uint8_t *blockStartPtr = outBlockOrderSymbolsPtr + (blocki * (blockDim * blockDim));
-      [mRowData appendBytes:blockStartPtr length:(blockDim * blockDim)];
-      [mBlocks addObject:mRowData];
-    }
-    
-    // Convert blocks to deltas
-    
-    NSMutableArray *mRowsOfDeltas = [NSMutableArray array];
-    
-#if defined(IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING)
-    NSMutableData *mBlockInitData = [NSMutableData dataWithCapacity:(blockWidth * blockHeight)];
-#endif
-    
-    for ( NSMutableData *blockData in mBlocks ) {
-      NSData *deltasData = [Huffman encodeSignedByteDeltas:blockData];
-      
-#if defined(IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING)
-      // When saving the first element of a block, do the deltas
-      // first and then pull out the first delta and set the delta
-      // byte to zero. This increases the count of the zero delta
-      // value and reduces the size of the generated tree while
-      // storing the block init value wo a huffman code.
-      {
-        NSMutableData *mDeltasData = [NSMutableData dataWithData:deltasData];
-        
-        uint8_t *bytePtr = mDeltasData.mutableBytes;
-        uint8_t firstByte = bytePtr[0];
-        bytePtr[0] = 0;
-        
-        [mBlockInitData appendBytes:&firstByte length:1];
-        
-        deltasData = [NSData dataWithData:mDeltasData];
-      }
-#endif // IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING
-      
-      [mRowsOfDeltas addObject:deltasData];
-      
-#if defined(DEBUG)
-      // Check that decoding generates the original input
-      
 # if defined(IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING)
-      // Undo setting of the first element to zero.
-      {
-        uint8_t *initBytePtr = mBlockInitData.mutableBytes;
-        uint8_t firstByte = initBytePtr[mBlockInitData.length-1];
-        
-        NSMutableData *mDeltasData = [NSMutableData dataWithData:deltasData];
-        uint8_t *deltasBytePtr = mDeltasData.mutableBytes;
-        
-        deltasBytePtr[0] = firstByte;
-        
-        deltasData = [NSData dataWithData:mDeltasData];
-      }
+  _blockInitData = [NSData dataWithData:mBlockInitData];
 # endif // IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING
-      
-      NSData *decodedDeltas = [Huffman decodeSignedByteDeltas:deltasData];
-      NSAssert([decodedDeltas isEqualToData:blockData], @"decoded deltas");
-#endif // DEBUG
-    }
-    
-    // Write delta values back over outBlockOrderSymbolsPtr
-    
-    int outWritei = 0;
-    
-    for ( NSData *deltaRow in mRowsOfDeltas ) {
-      uint8_t *ptr = (uint8_t *) deltaRow.bytes;
-      const int len = (int) deltaRow.length;
-      for ( int i = 0; i < len; i++) {
-        outBlockOrderSymbolsPtr[outWritei++] = ptr[i];
-      }
-    }
-    
-#if defined(IMPL_DELTAS_AND_INIT_ZERO_DELTA_BEFORE_HUFF_ENCODING)
-    _blockInitData = [NSData dataWithData:mBlockInitData];
-#endif
-  }
 #else
+  [Huffman splitIntoBlocks:(const uint8_t*)_huffInputBytes.bytes
+             outBlockBytes:outBlockOrderSymbolsPtr
+                     width:width
+                    height:height
+                  blockDim:blockDim];
+  
   // Store init data as all zeros
-  NSMutableData *mBlockInitData = [NSMutableData dataWithCapacity:(blockWidth * blockHeight)];
-  for ( int blocki = 0; blocki < (blockWidth * blockHeight); blocki++ ) {
-    uint8_t zeroByte = 0;
-    [mBlockInitData appendBytes:&zeroByte length:1];
-  }
+  NSMutableData *mBlockInitData = [NSMutableData dataWithLength:(blockWidth * blockHeight)];
   _blockInitData = [NSData dataWithData:mBlockInitData];
 #endif // IMPL_DELTAS_BEFORE_HUFF_ENCODING
   
@@ -544,45 +455,58 @@ const static unsigned int blockDim = HUFF_BLOCK_DIM;
     printf("block order done\n");
   }
   
+  if ((0)) {
+    // Compare huffman codes and tANS for the block symbols of this image
+    
+    [Huffman printEntropyCoderBenchmark:@"render image"
+                             blockBytes:outBlockOrderSymbolsPtr
+                               numBytes:outBlockOrderSymbolsNumBytes
+                               blockDim:blockDim
+                          numIterations:10];
+  }
+  
   // number of blocks must be an exact multiple of the block dimension
   
   assert((outBlockOrderSymbolsNumBytes % (blockDim * blockDim)) == 0);
   
-  [Huffman encodeHuffman:outBlockOrderSymbolsPtr
-              inNumBytes:outBlockOrderSymbolsNumBytes
-           outFileHeader:outFileHeader
-          outCanonHeader:outCanonHeader
-            outHuffCodes:outHuffCodes
-      outBlockBitOffsets:outBlockBitOffsets
-                   width:width
-                  height:height
-                blockDim:blockDim];
+  // Query the size of the encoded huffman codes so that the codes can be
+  // written directly into the Metal buffer. The size includes the +2
+  // bytes of read ahead padding.
   
-  if ((1)) {
-    printf("inNumBytes   %8d\n", outBlockOrderSymbolsNumBytes);
-    printf("outNumBytes  %8d\n", (int)outHuffCodes.length);
-  }
+  int numBlocks = 0;
   
-  // Reparse the canonical header to load symbol table info
+  int encodedSymbolsNumBytes = [Huffman queryEncodeBufferSizes:outBlockOrderSymbolsPtr
+                                                    inNumBytes:outBlockOrderSymbolsNumBytes
+                                                      blockDim:blockDim
+                                                outCanonHeader:outCanonHeader
+                                                  outNumBlocks:&numBlocks];
   
-  [Huffman parseCanonicalHeader:outCanonHeader];
+  assert(numBlocks == (blockWidth * blockHeight));
   
-  // FIXME: allocate huffman encoded bytes with no copy option to share existing mem?
-  // Otherise allocate and provide way to read bytes directly into allocated buffer.
+  _huffBuff = [_device newBufferWithLength:encodedSymbolsNumBytes
+                                   options:MTLResourceStorageModeShared];
   
-  uint8_t *encodedSymbolsPtr = outHuffCodes.mutableBytes;
-  int encodedSymbolsNumBytes = (int) outHuffCodes.length;
+  uint8_t *encodedSymbolsPtr = (uint8_t *) _huffBuff.contents;
   
-  // Add 2 more empty bytes to account for read ahead
-  encodedSymbolsNumBytes += 2;
+  BOOL worked = [Huffman encodeHuffman:outBlockOrderSymbolsPtr
+                            inNumBytes:outBlockOrderSymbolsNumBytes
+                              blockDim:blockDim
+                           canonHeader:outCanonHeader
+                          outHuffCodes:encodedSymbolsPtr
+                         outHuffCodesN:encodedSymbolsNumBytes
+                    outBlockBitOffsets:(uint32_t *) _blockStartBitOffsets.contents
+                   outBlockBitOffsetsN:numBlocks
+                         outFileHeader:outFileHeader];
+  assert(worked);
   
-  // Allocate a new buffer that accounts for read ahead space
-  // and copy huffman encoded symbols into the allocated buffer.
+  if (debugOut) {
+    printf("inNumBytes   %8d\n", outBlockOrderSymbolsNumBytes);
+    printf("outNumBytes  %8d\n", encodedSymbolsNumBytes);
+  }
   
-  _huffBuff = [_device newBufferWithLength:encodedSymbolsNumBytes
-                                   options:MTLResourceStorageModeShared];
+  // Reparse the canonical header to load symbol table info
   
-  memcpy(_huffBuff.contents, encodedSymbolsPtr, encodedSymbolsNumBytes-2);
+  [Huffman parseCanonicalHeader:outCanonHeader];
   
   if ((0)) {
     // Encoded huffman symbols as hex?
@@ -667,23 +591,6 @@ const static unsigned int blockDim = HUFF_BLOCK_DIM;
     memcpy(_huffSymbolTable2.contents, table2.bytes, table2.length);
   }
   
-  // Init memory buffer that holds bit offsets for each block
-  
-  uint32_t *blockInPtr = (uint32_t *) outBlockBitOffsets.bytes;
-  uint32_t *blockOutPtr = (uint32_t *) _blockStartBitOffsets.contents;
-  int numBlocks = (int)outBlockBitOffsets.length / sizeof(uint32_t);
-  
-  for (int blocki = 0; blocki < numBlocks; blocki++) {
-    int blockiOffset = blockInPtr[blocki];
-    blockOutPtr[blocki] = blockiOffset;
-    
-    if ((0)) {
-#if defined(DEBUG)
-      fprintf(stdout, "block[%5d] = %5d (bitOffsetsPtr[%5d])\n", blocki, blockOutPtr[blocki], blockiOffset);
-#endif // DEBUG
-    }
-  }
-  
   return;
 }
 
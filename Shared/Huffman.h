@@ -66,6 +66,67 @@
                 height:(int)height
               blockDim:(int)blockDim;
 
+// Generate the canonical header for inBytes and return the number of
+// bytes needed for the huffman codes, including +2 bytes of read ahead
+// padding. outNumBlocks is set to the number of block bit offsets.
+
++ (int) queryEncodeBufferSizes:(const uint8_t*)inBytes
+                    inNumBytes:(int)inNumBytes
+                      blockDim:(int)blockDim
+                outCanonHeader:(NSMutableData*)outCanonHeader
+                  outNumBlocks:(int*)outNumBlocks;
+
+// Encode directly into caller owned buffers, for example the contents
+// of Metal buffers, so that the huffman codes are never copied.
+// Returns NO when a buffer is too small.
+
++ (BOOL) encodeHuffman:(const uint8_t*)inBytes
+            inNumBytes:(int)inNumBytes
+              blockDim:(int)blockDim
+           canonHeader:(NSData*)canonHeader
+          outHuffCodes:(uint8_t*)outHuffCodes
+         outHuffCodesN:(int)outHuffCodesN
+    outBlockBitOffsets:(uint32_t*)outBlockBitOffsets
+   outBlockBitOffsetsN:(int)outBlockBitOffsetsN
+         outFileHeader:(NSMutableData*)outFileHeader;
+
+// Split a width x height image into zero padded blocks of blockDim x blockDim
+
++ (void) splitIntoBlocks:(const uint8_t*)inBytes
+           outBlockBytes:(uint8_t*)outBlockBytes
+                   width:(int)width
+                  height:(int)height
+                blockDim:(int)blockDim;
+
+// Split into blocks and write the signed byte deltas of each block. When
+// outBlockInit is not NULL the first value of each block is moved to
+// outBlockInit and the first delta is set to zero.
+
++ (void) splitIntoBlockDeltas:(const uint8_t*)inBytes
+                outBlockBytes:(uint8_t*)outBlockBytes
+                 outBlockInit:(uint8_t*)outBlockInit
+                        width:(int)width
+                       height:(int)height
+                     blockDim:(int)blockDim;
+
+// Print the compression ratio and decode speed of huffman codes and of
+// tANS for block ordered symbols
+
++ (void) printEntropyCoderBenchmark:(NSString*)name
+                         blockBytes:(const uint8_t*)blockBytes
+                           numBytes:(int)numBytes
+                           blockDim:(int)blockDim
+                      numIterations:(int)numIterations;
+
+// Enable or disable the per stage timing trace
+
++ (void) setTraceEnabled:(BOOL)enabled;
+
+// Write the recorded trace spans as Chrome trace event JSON, returns NO
+// when the file could not be written.
+
++ (BOOL) writeChromeTrace:(NSString*)path;
+
 // Encode signed byte deltas
 
 + (NSData*) encodeSignedByteDeltas:(NSData*)data;
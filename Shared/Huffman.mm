@@ -14,6 +14,9 @@
 
 #include "HuffmanEncoder.hpp"
 #include "huff_util.hpp"
+#include "HuffmanBlockKernels.hpp"
+#include "HuffmanTrace.hpp"
+#include "HuffmanTANS.hpp"
 
 using namespace std;
 
@@ -189,6 +192,106 @@ using namespace std;
   return;
 }
 
+// Generate the canonical header and query the encoded buffer sizes
+
++ (int) queryEncodeBufferSizes:(const uint8_t*)inBytes
+                    inNumBytes:(int)inNumBytes
+                      blockDim:(int)blockDim
+                outCanonHeader:(NSMutableData*)outCanonHeader
+                  outNumBlocks:(int*)outNumBlocks
+{
+  HuffEncodeBufferSizes sizes;
+  
+  [outCanonHeader setLength:256];
+  
+  HuffmanUtil::queryEncodeBufferSizes(inBytes,
+                                      inNumBytes,
+                                      blockDim,
+                                      (uint8_t *) outCanonHeader.mutableBytes,
+                                      sizes);
+  
+  *outNumBlocks = (int) sizes.numBlocks;
+  return (int) sizes.numCodeBytes;
+}
+
+// Encode directly into caller owned buffers
+
++ (BOOL) encodeHuffman:(const uint8_t*)inBytes
+            inNumBytes:(int)inNumBytes
+              blockDim:(int)blockDim
+           canonHeader:(NSData*)canonHeader
+          outHuffCodes:(uint8_t*)outHuffCodes
+         outHuffCodesN:(int)outHuffCodesN
+    outBlockBitOffsets:(uint32_t*)outBlockBitOffsets
+   outBlockBitOffsetsN:(int)outBlockBitOffsetsN
+         outFileHeader:(NSMutableData*)outFileHeader
+{
+  vector<uint8_t> outFileHeaderVec;
+  
+  bool worked = HuffmanUtil::encodeHuffmanToBuffers(inBytes,
+                                                    inNumBytes,
+                                                    blockDim,
+                                                    (const uint8_t *) canonHeader.bytes,
+                                                    outHuffCodes,
+                                                    outHuffCodesN,
+                                                    outBlockBitOffsets,
+                                                    outBlockBitOffsetsN,
+                                                    outFileHeaderVec);
+  
+  [outFileHeader setLength:outFileHeaderVec.size()];
+  memcpy(outFileHeader.mutableBytes, outFileHeaderVec.data(), outFileHeaderVec.size());
+  
+  return worked ? YES : NO;
+}
+
+// Split a width x height image into zero padded blocks
+
++ (void) splitIntoBlocks:(const uint8_t*)inBytes
+           outBlockBytes:(uint8_t*)outBlockBytes
+                   width:(int)width
+                  height:(int)height
+                blockDim:(int)blockDim
+{
+  HuffmanBlockKernels::splitImageToBlocks(inBytes, outBlockBytes, width, height, blockDim, 0);
+}
+
+// Split into blocks and write the signed byte deltas of each block
+
++ (void) splitIntoBlockDeltas:(const uint8_t*)inBytes
+                outBlockBytes:(uint8_t*)outBlockBytes
+                 outBlockInit:(uint8_t*)outBlockInit
+                        width:(int)width
+                       height:(int)height
+                     blockDim:(int)blockDim
+{
+  HuffmanBlockKernels::splitImageToBlockDeltas(inBytes, outBlockBytes, outBlockInit, width, height, blockDim, 0);
+}
+
+// Print the compression ratio and decode speed of huffman codes and of tANS
+
++ (void) printEntropyCoderBenchmark:(NSString*)name
+                         blockBytes:(const uint8_t*)blockBytes
+                           numBytes:(int)numBytes
+                           blockDim:(int)blockDim
+                      numIterations:(int)numIterations
+{
+  HuffmanTANS::printBenchmark([name UTF8String], blockBytes, numBytes, blockDim, numIterations);
+}
+
+// Enable or disable the per stage timing trace
+
++ (void) setTraceEnabled:(BOOL)enabled
+{
+  HuffmanTrace::setEnabled(enabled);
+}
+
+// Write the recorded trace spans as Chrome trace event JSON
+
++ (BOOL) writeChromeTrace:(NSString*)path
+{
+  return HuffmanTrace::writeChromeTraceFile([path fileSystemRepresentation]);
+}
+
 // Encode signed byte deltas
 
 + (NSData*) encodeSignedByteDeltas:(NSData*)data
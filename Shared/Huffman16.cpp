@@ -0,0 +1,527 @@
+// C++ impl of the huffman codec for 16 bit samples
+//  MIT Licensed
+
+#include "Huffman16.hpp"
+
+#include "huff_util.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <assert.h>
+
+using namespace std;
+
+// A code is at most 16 bits and a residual of 16 bits has at most
+// 13 raw bits, so one sample is never wider than 29 bits.
+
+#define HUFF16_MAX_SAMPLE_NUM_BITS (16 + 13)
+
+// Base residual and number of raw bits for a bucket symbol
+
+static inline
+void
+residualBaseForSymbol(int symbol, uint16_t & outBase, int & outNumRawBits)
+{
+  if (symbol < HUFF16_NUM_DIRECT_SYMBOLS) {
+    outBase = symbol;
+    outNumRawBits = 0;
+    return;
+  }
+
+  const int bucket = symbol - HUFF16_NUM_DIRECT_SYMBOLS;
+  const int highBit = 4 + (bucket >> HUFF16_NUM_MANTISSA_BITS);
+  const int mantissa = bucket & ((1 << HUFF16_NUM_MANTISSA_BITS) - 1);
+
+  outNumRawBits = highBit - HUFF16_NUM_MANTISSA_BITS;
+  outBase = (uint16_t) ((1 << highBit) | (mantissa << outNumRawBits));
+}
+
+// Signed residuals are wrapped to the sample range and then zigzag
+// encoded so that small magnitudes map to small values.
+
+static inline
+uint16_t
+zigzagResidual(int sample, int pred, int bitsPerSample)
+{
+  const int range = 1 << bitsPerSample;
+  int delta = (sample - pred) & (range - 1);
+  if (delta >= (range >> 1)) {
+    delta -= range;
+  }
+  return (uint16_t) ((delta >= 0) ? (delta << 1) : ((-delta << 1) - 1));
+}
+
+static inline
+int
+unzigzagResidual(uint32_t residual)
+{
+  return (residual & 0x1) ? -((int) ((residual + 1) >> 1)) : (int) (residual >> 1);
+}
+
+// Predict the sample at offset in a block with the same rules as the
+// 8 bit block predictors in HuffmanUtil.
+
+static inline
+int
+predictSample(const uint16_t *blockPtr,
+              const int blockDim,
+              const int col,
+              const int row,
+              const HuffPredictor predictor)
+{
+  const int offset = (row * blockDim) + col;
+
+  if (offset == 0) {
+    return 0;
+  }
+
+  if (predictor == HUFF_PREDICTOR_DELTA || row == 0) {
+    return blockPtr[offset - 1];
+  } else if (col == 0) {
+    return blockPtr[offset - blockDim];
+  }
+
+  const int a = blockPtr[offset - 1];
+  const int b = blockPtr[offset - blockDim];
+  const int c = blockPtr[offset - blockDim - 1];
+
+  if (predictor == HUFF_PREDICTOR_MED) {
+    return HuffmanUtil::predictMED(a, b, c);
+  } else {
+    return HuffmanUtil::predictPaeth(a, b, c);
+  }
+}
+
+// Write zigzag residuals for one block and return the sum of the
+// residuals as an estimate of how well the predictor works.
+
+static inline
+uint32_t
+encodeResidualBlock(const uint16_t *blockPtr,
+                    uint16_t *residualsPtr,
+                    const int blockDim,
+                    const int bitsPerSample,
+                    const HuffPredictor predictor)
+{
+  uint32_t sum = 0;
+
+  for ( int row = 0; row < blockDim; row++ ) {
+    for ( int col = 0; col < blockDim; col++ ) {
+      const int offset = (row * blockDim) + col;
+      const int pred = predictSample(blockPtr, blockDim, col, row, predictor);
+      const uint16_t residual = zigzagResidual(blockPtr[offset], pred, bitsPerSample);
+      residualsPtr[offset] = residual;
+      sum += residual;
+    }
+  }
+
+  return sum;
+}
+
+// Map a zigzag residual to its bucket symbol and raw bits
+
+void
+Huffman16::symbolForResidual(
+                             uint16_t residual,
+                             uint8_t & outSymbol,
+                             int & outNumRawBits,
+                             uint16_t & outRawBits)
+{
+  if (residual < HUFF16_NUM_DIRECT_SYMBOLS) {
+    outSymbol = (uint8_t) residual;
+    outNumRawBits = 0;
+    outRawBits = 0;
+    return;
+  }
+
+  int highBit = 4;
+  while ((residual >> (highBit + 1)) != 0) {
+    highBit += 1;
+  }
+
+  outNumRawBits = highBit - HUFF16_NUM_MANTISSA_BITS;
+
+  const int mantissa = (residual >> outNumRawBits) & ((1 << HUFF16_NUM_MANTISSA_BITS) - 1);
+
+  outSymbol = (uint8_t) (HUFF16_NUM_DIRECT_SYMBOLS + ((highBit - 4) << HUFF16_NUM_MANTISSA_BITS) + mantissa);
+  outRawBits = residual & ((1 << outNumRawBits) - 1);
+
+#if defined(DEBUG)
+  assert(outSymbol < HUFF16_NUM_SYMBOLS);
+#endif // DEBUG
+}
+
+// Generate lookup tables with the checked 8 bit table generator and
+// then resolve each symbol to its base residual and raw bit count.
+
+HuffDecodeStatus
+Huffman16::generateLookupTables(
+                                const uint8_t *canonTable,
+                                vector<Huff16LookupSymbol> & outTable1,
+                                vector<Huff16LookupSymbol> & outTable2)
+{
+  for ( int symbol = HUFF16_NUM_SYMBOLS; symbol < 256; symbol++ ) {
+    if (canonTable[symbol] != 0) {
+      return HUFF_DECODE_ERROR_TABLE;
+    }
+  }
+
+  vector<HuffLookupSymbol> table1;
+  vector<HuffLookupSymbol> table2;
+
+  HuffDecodeStatus status = HuffmanUtil::generateCheckedLookupTables(canonTable, table1, table2);
+
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  auto convert = [](const vector<HuffLookupSymbol> & inTable, vector<Huff16LookupSymbol> & outTable) {
+    outTable.resize(inTable.size());
+
+    for ( int i = 0; i < (int) inTable.size(); i++ ) {
+      const HuffLookupSymbol & hls = inTable[i];
+      Huff16LookupSymbol & hls16 = outTable[i];
+
+      hls16.bitWidth = hls.bitWidth;
+
+      if (hls.bitWidth == 0) {
+        hls16.base = hls.symbol;
+        hls16.numRawBits = 0;
+      } else {
+        int numRawBits;
+        residualBaseForSymbol(hls.symbol, hls16.base, numRawBits);
+        hls16.numRawBits = (uint8_t) numRawBits;
+      }
+    }
+  };
+
+  convert(table1, outTable1);
+  convert(table2, outTable2);
+
+  return HUFF_DECODE_OK;
+}
+
+// Encode samples as blocks of bucket symbols and raw bits
+
+bool
+Huffman16::encodeSamples(
+                         const uint16_t *samples,
+                         int width,
+                         int height,
+                         int bitsPerSample,
+                         int blockDim,
+                         HuffPredictor predictor,
+                         vector<uint8_t> & outFileHeader,
+                         Huff16Encoded & outEncoded)
+{
+  HUFF_TRACE_SPAN("encode 16 bit");
+  
+  if (samples == nullptr || width <= 0 || height <= 0 ||
+      bitsPerSample < 8 || bitsPerSample > 16 ||
+      !HuffmanUtil::isSupportedBlockDim(blockDim) ||
+      (predictor >= HUFF_PREDICTOR_NUM && predictor != HUFF_PREDICTOR_ADAPTIVE)) {
+    return false;
+  }
+
+  const uint32_t maxSample = (1 << bitsPerSample) - 1;
+
+  for ( int i = 0; i < (width * height); i++ ) {
+    if (samples[i] > maxSample) {
+      return false;
+    }
+  }
+
+  const int blockWidth = HuffmanUtil::numBlocksForDim(width, blockDim);
+  const int blockHeight = HuffmanUtil::numBlocksForDim(height, blockDim);
+  const int numBlocks = blockWidth * blockHeight;
+  const int blockNumSymbols = blockDim * blockDim;
+
+  // Split into zero padded blocks of samples in raster order
+
+  vector<uint16_t> blockSamples(numBlocks * blockNumSymbols, 0);
+
+  for ( int y = 0; y < height; y++ ) {
+    for ( int x = 0; x < width; x++ ) {
+      const int blocki = ((y / blockDim) * blockWidth) + (x / blockDim);
+      const int offset = ((y % blockDim) * blockDim) + (x % blockDim);
+      blockSamples[(blocki * blockNumSymbols) + offset] = samples[(y * width) + x];
+    }
+  }
+
+  // Predict each block, an adaptive predictor keeps the residuals
+  // with the smallest sum.
+
+  vector<uint16_t> residuals(blockSamples.size());
+  vector<uint16_t> tmpResiduals(blockNumSymbols);
+
+  outEncoded.blockPredictors.resize(numBlocks);
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint16_t *blockPtr = blockSamples.data() + (blocki * blockNumSymbols);
+    uint16_t *residualsPtr = residuals.data() + (blocki * blockNumSymbols);
+
+    if (predictor != HUFF_PREDICTOR_ADAPTIVE) {
+      encodeResidualBlock(blockPtr, residualsPtr, blockDim, bitsPerSample, predictor);
+      outEncoded.blockPredictors[blocki] = predictor;
+      continue;
+    }
+
+    uint32_t bestSum = encodeResidualBlock(blockPtr, residualsPtr, blockDim, bitsPerSample, HUFF_PREDICTOR_DELTA);
+    HuffPredictor bestPredictor = HUFF_PREDICTOR_DELTA;
+
+    for ( int pi = HUFF_PREDICTOR_DELTA + 1; pi < HUFF_PREDICTOR_NUM; pi++ ) {
+      uint32_t sum = encodeResidualBlock(blockPtr, tmpResiduals.data(), blockDim, bitsPerSample, (HuffPredictor) pi);
+      if (sum < bestSum) {
+        bestSum = sum;
+        bestPredictor = (HuffPredictor) pi;
+        memcpy(residualsPtr, tmpResiduals.data(), blockNumSymbols * sizeof(uint16_t));
+      }
+    }
+
+    outEncoded.blockPredictors[blocki] = bestPredictor;
+  }
+
+  // Build a table from the bucket symbol histogram
+
+  uint32_t frequencies[256];
+  memset(frequencies, 0, sizeof(frequencies));
+
+  for ( uint16_t residual : residuals ) {
+    uint8_t symbol;
+    int numRawBits;
+    uint16_t rawBits;
+    symbolForResidual(residual, symbol, numRawBits, rawBits);
+    frequencies[symbol] += 1;
+  }
+
+  outEncoded.canonHeader.resize(256);
+  huff_build_limited_code_widths(frequencies, outEncoded.canonHeader.data());
+
+  uint16_t codes[256];
+  huff_generate_canonical_codes_in_place(outEncoded.canonHeader.data(), codes);
+
+  const uint8_t *widths = outEncoded.canonHeader.data();
+
+  // Count the bits for each block so that the block offsets are known
+  // and the output buffer can be allocated once.
+
+  outEncoded.blockBitOffsets.resize(numBlocks);
+
+  uint64_t numCodeBits = 0;
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    outEncoded.blockBitOffsets[blocki] = (uint32_t) numCodeBits;
+
+    const uint16_t *residualsPtr = residuals.data() + (blocki * blockNumSymbols);
+
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      uint8_t symbol;
+      int numRawBits;
+      uint16_t rawBits;
+      symbolForResidual(residualsPtr[i], symbol, numRawBits, rawBits);
+      numCodeBits += widths[symbol] + numRawBits;
+    }
+
+    if (numCodeBits > UINT32_MAX) {
+      return false;
+    }
+  }
+
+  outEncoded.huffCodes.assign(((numCodeBits + 7) / 8) + 2, 0);
+
+  uint8_t *outPtr = outEncoded.huffCodes.data();
+  uint32_t bitOffset = 0;
+
+  for ( uint16_t residual : residuals ) {
+    uint8_t symbol;
+    int numRawBits;
+    uint16_t rawBits;
+    symbolForResidual(residual, symbol, numRawBits, rawBits);
+
+    huff_write_code_bits(outPtr, bitOffset, codes[symbol], widths[symbol]);
+    bitOffset += widths[symbol];
+
+    if (numRawBits > 0) {
+      huff_write_code_bits(outPtr, bitOffset, (uint16_t) (rawBits << (16 - numRawBits)), numRawBits);
+      bitOffset += numRawBits;
+    }
+  }
+
+#if defined(DEBUG)
+  assert(bitOffset == numCodeBits);
+#endif // DEBUG
+
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, width * height * sizeof(uint16_t));
+  header.blockDim = blockDim;
+  header.predictor = (predictor == HUFF_PREDICTOR_ADAPTIVE) ? HUFF_PREDICTOR_DELTA : predictor;
+  header.bitsPerSample = bitsPerSample;
+  HuffmanUtil::generateFileHeader(header, outFileHeader);
+
+  return true;
+}
+
+// Decode one block of samples starting at numBitsRead, each residual
+// is reconstructed to a sample as soon as it is read. When isChecked
+// is true every read is checked against numCodeBits, returns false
+// when a read would go past the end of the code bits.
+
+template <bool isChecked>
+static inline
+bool
+decodeSampleBlock(
+                  const Huff16LookupSymbol *table1,
+                  const Huff16LookupSymbol *table2,
+                  const uint8_t *huffBuff,
+                  const uint64_t numCodeBits,
+                  unsigned int & numBitsRead,
+                  uint16_t *blockPtr,
+                  const int blockDim,
+                  const uint32_t sampleMask,
+                  const HuffPredictor predictor)
+{
+  for ( int row = 0; row < blockDim; row++ ) {
+    for ( int col = 0; col < blockDim; col++ ) {
+      if (isChecked && numBitsRead >= numCodeBits) {
+        return false;
+      }
+
+      const uint16_t inputBitPattern = huff_read_code_bits(huffBuff, numBitsRead);
+
+      Huff16LookupSymbol hls = table1[inputBitPattern >> (16 - HUFF_TABLE1_NUM_BITS)];
+
+      if (hls.bitWidth == 0) {
+        const uint16_t table2Pattern = inputBitPattern & (0xFFFF >> (16 - HUFF_TABLE2_NUM_BITS));
+        hls = table2[(hls.base * HUFF_TABLE2_SIZE) + table2Pattern];
+      }
+
+      numBitsRead += hls.bitWidth;
+
+      uint32_t residual = hls.base;
+
+      if (hls.numRawBits > 0) {
+        if (isChecked && numBitsRead >= numCodeBits) {
+          return false;
+        }
+        residual += huff_read_code_bits(huffBuff, numBitsRead) >> (16 - hls.numRawBits);
+        numBitsRead += hls.numRawBits;
+      }
+
+      const int pred = predictSample(blockPtr, blockDim, col, row, predictor);
+      blockPtr[(row * blockDim) + col] = (uint16_t) ((pred + unzigzagResidual(residual)) & sampleMask);
+    }
+  }
+
+  return !isChecked || (numBitsRead <= numCodeBits);
+}
+
+// Decode and reconstruct samples one block at a time
+
+HuffDecodeStatus
+Huffman16::decodeSamples(
+                         const uint8_t *fileHeader,
+                         int fileHeaderN,
+                         const Huff16Encoded & encoded,
+                         int width,
+                         int height,
+                         uint16_t *outSamples)
+{
+  HUFF_TRACE_SPAN("decode");
+  
+  HuffFileHeader header;
+
+  if (fileHeader == nullptr || outSamples == nullptr || width <= 0 || height <= 0 ||
+      !HuffmanUtil::parseFileHeader(fileHeader, fileHeaderN, header) ||
+      header.numBytes != (uint64_t) width * height * sizeof(uint16_t)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockDim = header.blockDim;
+  const int bitsPerSample = header.bitsPerSample;
+  const int blockWidth = HuffmanUtil::numBlocksForDim(width, blockDim);
+  const int blockHeight = HuffmanUtil::numBlocksForDim(height, blockDim);
+  const int numBlocks = blockWidth * blockHeight;
+  const int blockNumSymbols = blockDim * blockDim;
+  const uint32_t sampleMask = (1 << bitsPerSample) - 1;
+
+  if ((int) encoded.blockBitOffsets.size() != numBlocks || (int) encoded.blockPredictors.size() != numBlocks) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  for ( uint8_t predictor : encoded.blockPredictors ) {
+    if (predictor >= HUFF_PREDICTOR_NUM) {
+      return HUFF_DECODE_ERROR_ARGUMENTS;
+    }
+  }
+
+  if (encoded.canonHeader.size() != 256) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  vector<Huff16LookupSymbol> table1;
+  vector<Huff16LookupSymbol> table2;
+
+  HuffDecodeStatus status = generateLookupTables(encoded.canonHeader.data(), table1, table2);
+
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  // The buffer must end with +2 bytes of read ahead padding
+
+  if (encoded.huffCodes.size() < 2) {
+    return HUFF_DECODE_ERROR_PADDING;
+  }
+
+  const uint8_t *huffBuff = encoded.huffCodes.data();
+  const uint64_t numCodeBits = (uint64_t) (encoded.huffCodes.size() - 2) * 8;
+  const uint64_t maxBlockNumBits = blockNumSymbols * HUFF16_MAX_SAMPLE_NUM_BITS;
+
+  vector<uint16_t> blockSamples(blockNumSymbols);
+
+  // Blocks are contiguous, so each block must begin where the previous
+  // block ended. A block that begins at least maxBlockNumBits before the
+  // end of the code bits is decoded without checks.
+
+  uint64_t expectedBitOffset = 0;
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint32_t bitOffset = encoded.blockBitOffsets[blocki];
+    const HuffPredictor predictor = (HuffPredictor) encoded.blockPredictors[blocki];
+
+    if (bitOffset != expectedBitOffset) {
+      return (blocki == 0) ? HUFF_DECODE_ERROR_BLOCK_OFFSET : HUFF_DECODE_ERROR_CORRUPT_BLOCK;
+    }
+
+    unsigned int numBitsRead = bitOffset;
+    uint16_t *blockPtr = blockSamples.data();
+
+    if ((bitOffset + maxBlockNumBits) <= numCodeBits) {
+      decodeSampleBlock<false>(table1.data(), table2.data(), huffBuff, numCodeBits, numBitsRead, blockPtr, blockDim, sampleMask, predictor);
+    } else if (!decodeSampleBlock<true>(table1.data(), table2.data(), huffBuff, numCodeBits, numBitsRead, blockPtr, blockDim, sampleMask, predictor)) {
+      return HUFF_DECODE_ERROR_CORRUPT_BLOCK;
+    }
+
+    expectedBitOffset = numBitsRead;
+
+    // Crop the zero padding along the right and bottom edges
+
+    const int blockX = (blocki % blockWidth) * blockDim;
+    const int blockY = (blocki / blockWidth) * blockDim;
+    const int numCols = min(blockDim, width - blockX);
+    const int numRows = min(blockDim, height - blockY);
+
+    for ( int row = 0; row < numRows; row++ ) {
+      memcpy(outSamples + ((blockY + row) * width) + blockX,
+             blockPtr + (row * blockDim),
+             numCols * sizeof(uint16_t));
+    }
+  }
+
+  return HUFF_DECODE_OK;
+}
@@ -0,0 +1,105 @@
+//
+//  Huffman16.hpp
+//
+//  MIT Licensed
+//
+// Huffman codec for samples of up to 16 bits, like 10 and 12 bit
+// sensor data or 16 bit depth maps. Samples are predicted inside
+// NxN blocks with 16 bit residuals, so an image does not need to be
+// split into byte planes.
+//
+// Each zigzag encoded residual is coded as a bucket symbol followed
+// by raw bits. Residuals less than 16 are a symbol with no raw bits.
+// Larger residuals are bucketed by the position of the highest set bit
+// and the 2 bits below it, the remaining low bits are written as is.
+// This limits the alphabet to 64 symbols, so the canonical table and
+// the split lookup tables of the 8 bit codec are reused, and one table
+// lookup decodes one sample.
+
+#ifndef Huffman16_hpp
+#define Huffman16_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+#define HUFF16_NUM_SYMBOLS 64
+#define HUFF16_NUM_DIRECT_SYMBOLS 16
+#define HUFF16_NUM_MANTISSA_BITS 2
+
+// Lookup table entry, a symbol is resolved to the base residual and
+// the number of raw bits that follow the code. A table1 entry with a
+// bitWidth of 0 refers to the table2 block at index base.
+
+typedef struct {
+  uint16_t base;
+  uint8_t bitWidth;
+  uint8_t numRawBits;
+} Huff16LookupSymbol;
+
+// The encoded output for one image
+
+typedef struct {
+  vector<uint8_t> canonHeader;
+  vector<uint8_t> huffCodes;
+  vector<uint32_t> blockBitOffsets;
+  vector<uint8_t> blockPredictors;
+} Huff16Encoded;
+
+class Huffman16 {
+
+public:
+
+  // Map a zigzag residual to its bucket symbol and raw bits
+
+  static void
+  symbolForResidual(
+                    uint16_t residual,
+                    uint8_t & outSymbol,
+                    int & outNumRawBits,
+                    uint16_t & outRawBits);
+
+  // Generate split lookup tables from a canonical table, the table is
+  // validated first and only the first HUFF16_NUM_SYMBOLS symbols can
+  // have a code.
+
+  static HuffDecodeStatus
+  generateLookupTables(
+                       const uint8_t *canonTable,
+                       vector<Huff16LookupSymbol> & outTable1,
+                       vector<Huff16LookupSymbol> & outTable2);
+
+  // Encode width x height samples that use the low bitsPerSample bits.
+  // Returns false when a setting is not supported or when a sample
+  // does not fit in bitsPerSample bits.
+
+  static bool
+  encodeSamples(
+                const uint16_t *samples,
+                int width,
+                int height,
+                int bitsPerSample,
+                int blockDim,
+                HuffPredictor predictor,
+                vector<uint8_t> & outFileHeader,
+                Huff16Encoded & outEncoded);
+
+  // Decode samples generated by encodeSamples, the block dimension and
+  // sample size are read from the file header. Input is validated in
+  // the same way as decodeHuffmanBlocksChecked.
+
+  static HuffDecodeStatus
+  decodeSamples(
+                const uint8_t *fileHeader,
+                int fileHeaderN,
+                const Huff16Encoded & encoded,
+                int width,
+                int height,
+                uint16_t *outSamples);
+
+};
+
+#endif // Huffman16_hpp
@@ -0,0 +1,390 @@
+// C++ impl of batch decoding on a work stealing thread pool
+//  MIT Licensed
+
+#include "HuffmanBatchDecoder.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
+#include <algorithm>
+
+#include <assert.h>
+
+using namespace std;
+
+// Images validated by one task in the first phase
+
+#define HUFF_BATCH_IMAGES_PER_TASK 64
+
+HuffmanWorkPool::HuffmanWorkPool(int numThreads)
+{
+  if (numThreads <= 0) {
+    numThreads = max(1, (int) thread::hardware_concurrency());
+  }
+
+  generation = 0;
+  isStopping = false;
+  numPendingTasks = 0;
+  numStolen = 0;
+
+  for ( int threadi = 0; threadi < numThreads; threadi++ ) {
+    queues.push_back(unique_ptr<HuffWorkQueue>(new HuffWorkQueue()));
+  }
+
+  // Queue 0 belongs to the thread that calls run()
+
+  for ( int threadi = 1; threadi < numThreads; threadi++ ) {
+    workers.push_back(thread(&HuffmanWorkPool::workerLoop, this, threadi));
+  }
+}
+
+HuffmanWorkPool::~HuffmanWorkPool()
+{
+  {
+    lock_guard<mutex> lock(stateLock);
+    isStopping = true;
+  }
+
+  wakeCondition.notify_all();
+
+  for ( thread & worker : workers ) {
+    worker.join();
+  }
+}
+
+int
+HuffmanWorkPool::numThreads() const
+{
+  return (int) queues.size();
+}
+
+uint64_t
+HuffmanWorkPool::numStolenTasks() const
+{
+  return numStolen;
+}
+
+// Take the newest task from this thread's queue, or steal the oldest
+// task from another queue when this queue is empty.
+
+bool
+HuffmanWorkPool::popTask(int queuei, function<void()> & outTask)
+{
+  {
+    HuffWorkQueue & queue = *queues[queuei];
+    lock_guard<mutex> lock(queue.lock);
+    if (!queue.tasks.empty()) {
+      outTask = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      return true;
+    }
+  }
+
+  const int numQueues = (int) queues.size();
+
+  for ( int i = 1; i < numQueues; i++ ) {
+    HuffWorkQueue & queue = *queues[(queuei + i) % numQueues];
+    lock_guard<mutex> lock(queue.lock);
+    if (!queue.tasks.empty()) {
+      outTask = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      numStolen += 1;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Execute tasks until every queue is empty
+
+void
+HuffmanWorkPool::executeTasks(int queuei)
+{
+  function<void()> task;
+
+  while (popTask(queuei, task)) {
+    task();
+
+    if (numPendingTasks.fetch_sub(1) == 1) {
+      lock_guard<mutex> lock(stateLock);
+      doneCondition.notify_all();
+    }
+  }
+}
+
+void
+HuffmanWorkPool::workerLoop(int queuei)
+{
+  uint64_t seenGeneration = 0;
+
+  while (true) {
+    {
+      unique_lock<mutex> lock(stateLock);
+      wakeCondition.wait(lock, [&] { return isStopping || generation != seenGeneration; });
+      if (isStopping) {
+        return;
+      }
+      seenGeneration = generation;
+    }
+
+    executeTasks(queuei);
+  }
+}
+
+// Distribute the tasks round robin over the queues, wake the workers
+// and help execute tasks until the batch is done. This method must
+// not be called from more than one thread at a time.
+
+void
+HuffmanWorkPool::run(vector<function<void()> > & tasks)
+{
+  if (tasks.empty()) {
+    return;
+  }
+
+  const int numQueues = (int) queues.size();
+
+  numPendingTasks = (int) tasks.size();
+
+  for ( int taski = 0; taski < (int) tasks.size(); taski++ ) {
+    HuffWorkQueue & queue = *queues[taski % numQueues];
+    lock_guard<mutex> lock(queue.lock);
+    queue.tasks.push_back(std::move(tasks[taski]));
+  }
+
+  {
+    lock_guard<mutex> lock(stateLock);
+    generation += 1;
+  }
+
+  wakeCondition.notify_all();
+
+  executeTasks(0);
+
+  {
+    unique_lock<mutex> lock(stateLock);
+    doneCondition.wait(lock, [&] { return numPendingTasks == 0; });
+  }
+
+  tasks.clear();
+}
+
+// FNV-1a hash of a canonical header
+
+static inline
+uint64_t
+hashCanonHeader(const uint8_t *canonHeader)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for ( int i = 0; i < 256; i++ ) {
+    hash ^= canonHeader[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Validate the arguments of one image, the block offsets are checked
+// with the same rules as decodeHuffmanBlocksChecked.
+
+static inline
+HuffDecodeStatus
+validateImage(const HuffBatchImage & image)
+{
+  if (image.numBlocks < 0 || !HuffmanUtil::isSupportedBlockDim(image.blockDim)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockNumSymbols = image.blockDim * image.blockDim;
+
+  if (((int64_t) image.numBlocks * blockNumSymbols) > image.outBufferN) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  if (image.numBlocks == 0) {
+    return HUFF_DECODE_OK;
+  }
+
+  if (image.huffCodes == nullptr || image.blockBitOffsets == nullptr || image.outBuffer == nullptr) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  if (image.huffCodesN < 2) {
+    return HUFF_DECODE_ERROR_PADDING;
+  }
+
+  return HuffmanUtil::validateBlockBitOffsets(image.blockBitOffsets,
+                                              nullptr,
+                                              image.numBlocks,
+                                              1,
+                                              image.blockDim,
+                                              image.huffCodesN);
+}
+
+// Decode blocks [firstBlock, endBlock) of a validated image
+
+static inline
+HuffDecodeStatus
+decodeImageBlockRange(const HuffBatchImage & image,
+                      const HuffLookupSymbol *huffSymbolTable1,
+                      const HuffLookupSymbol *huffSymbolTable2,
+                      int firstBlock,
+                      int endBlock)
+{
+  HUFF_TRACE_SPAN("decode");
+
+  auto blockDecoder = [huffSymbolTable1, huffSymbolTable2](int tableId, const uint8_t *codes, uint32_t bitOffset, uint8_t *symbols, int numSymbols) -> uint32_t {
+    return HuffmanUtil::decodeHuffmanSymbolsAtBitOffset(huffSymbolTable1, huffSymbolTable2, codes, bitOffset, symbols, numSymbols);
+  };
+
+  return HuffmanUtil::decodeBlockRangeChecked(blockDecoder,
+                                              image.numBlocks,
+                                              image.blockDim,
+                                              image.huffCodes,
+                                              image.huffCodesN,
+                                              image.blockBitOffsets,
+                                              nullptr,
+                                              firstBlock,
+                                              endBlock,
+                                              image.outBuffer);
+}
+
+HuffmanBatchDecoder::HuffmanBatchDecoder(int numThreads)
+: pool(numThreads)
+{
+  numTables = 0;
+}
+
+int
+HuffmanBatchDecoder::numUniqueTables() const
+{
+  return numTables;
+}
+
+HuffmanWorkPool &
+HuffmanBatchDecoder::workPool()
+{
+  return pool;
+}
+
+// Generate tables for the distinct headers and validate the images,
+// then decode ranges of blocks.
+
+void
+HuffmanBatchDecoder::decodeBatch(
+                                 const vector<HuffBatchImage> & images,
+                                 vector<HuffDecodeStatus> & outStatus)
+{
+  const int debugOut = 0;
+
+  const int numImages = (int) images.size();
+
+  outStatus.assign(numImages, HUFF_DECODE_OK);
+
+  // Identical canonical headers share one table index
+
+  vector<int> imageTableIndex(numImages, -1);
+  vector<const uint8_t *> uniqueHeaders;
+  unordered_map<uint64_t, vector<int> > hashToTableIndexes;
+
+  for ( int imagei = 0; imagei < numImages; imagei++ ) {
+    const uint8_t *canonHeader = images[imagei].canonHeader;
+
+    if (canonHeader == nullptr) {
+      outStatus[imagei] = HUFF_DECODE_ERROR_TABLE;
+      continue;
+    }
+
+    vector<int> & tableIndexes = hashToTableIndexes[hashCanonHeader(canonHeader)];
+
+    for ( int tablei : tableIndexes ) {
+      if (memcmp(uniqueHeaders[tablei], canonHeader, 256) == 0) {
+        imageTableIndex[imagei] = tablei;
+        break;
+      }
+    }
+
+    if (imageTableIndex[imagei] == -1) {
+      imageTableIndex[imagei] = (int) uniqueHeaders.size();
+      tableIndexes.push_back((int) uniqueHeaders.size());
+      uniqueHeaders.push_back(canonHeader);
+    }
+  }
+
+  numTables = (int) uniqueHeaders.size();
+
+  if ((int) table1s.size() < numTables) {
+    table1s.resize(numTables);
+    table2s.resize(numTables);
+  }
+
+  tableStatus.assign(numTables, HUFF_DECODE_OK);
+
+  if (debugOut) {
+    printf("%d images : %d unique tables\n", numImages, numTables);
+  }
+
+  // Phase 1, table generation and validation
+
+  vector<function<void()> > tasks;
+
+  for ( int tablei = 0; tablei < numTables; tablei++ ) {
+    tasks.push_back([this, tablei, &uniqueHeaders] {
+      tableStatus[tablei] = HuffmanUtil::generateCheckedLookupTables(uniqueHeaders[tablei], table1s[tablei], table2s[tablei]);
+    });
+  }
+
+  for ( int firstImage = 0; firstImage < numImages; firstImage += HUFF_BATCH_IMAGES_PER_TASK ) {
+    const int endImage = min(numImages, firstImage + HUFF_BATCH_IMAGES_PER_TASK);
+    tasks.push_back([&images, &outStatus, firstImage, endImage] {
+      for ( int imagei = firstImage; imagei < endImage; imagei++ ) {
+        if (outStatus[imagei] == HUFF_DECODE_OK) {
+          outStatus[imagei] = validateImage(images[imagei]);
+        }
+      }
+    });
+  }
+
+  pool.run(tasks);
+
+  // Phase 2, decode ranges of blocks. A range writes its status only
+  // when it fails, so the ranges of one image share an atomic status.
+
+  unique_ptr<atomic<int>[]> imageStatus(new atomic<int>[numImages]);
+
+  for ( int imagei = 0; imagei < numImages; imagei++ ) {
+    if (outStatus[imagei] == HUFF_DECODE_OK && tableStatus[imageTableIndex[imagei]] != HUFF_DECODE_OK) {
+      outStatus[imagei] = tableStatus[imageTableIndex[imagei]];
+    }
+
+    imageStatus[imagei] = outStatus[imagei];
+
+    if (outStatus[imagei] != HUFF_DECODE_OK) {
+      continue;
+    }
+
+    const HuffBatchImage & image = images[imagei];
+    const HuffLookupSymbol *huffSymbolTable1 = table1s[imageTableIndex[imagei]].data();
+    const HuffLookupSymbol *huffSymbolTable2 = table2s[imageTableIndex[imagei]].data();
+    atomic<int> *statusPtr = &imageStatus[imagei];
+
+    for ( int firstBlock = 0; firstBlock < image.numBlocks; firstBlock += HUFF_BATCH_BLOCKS_PER_TASK ) {
+      const int endBlock = min(image.numBlocks, firstBlock + HUFF_BATCH_BLOCKS_PER_TASK);
+      tasks.push_back([&image, huffSymbolTable1, huffSymbolTable2, firstBlock, endBlock, statusPtr] {
+        HuffDecodeStatus status = decodeImageBlockRange(image, huffSymbolTable1, huffSymbolTable2, firstBlock, endBlock);
+        if (status != HUFF_DECODE_OK) {
+          *statusPtr = status;
+        }
+      });
+    }
+  }
+
+  pool.run(tasks);
+
+  for ( int imagei = 0; imagei < numImages; imagei++ ) {
+    outStatus[imagei] = (HuffDecodeStatus) imageStatus[imagei].load();
+  }
+}
@@ -0,0 +1,154 @@
+//
+//  HuffmanBatchDecoder.hpp
+//
+//  MIT Licensed
+//
+// Batch decoder for many encoded images, like the thousands of small
+// grayscale thumbnails decoded for one request. Each image is the
+// output of encodeHuffman: a canonical header, the code bytes with +2
+// bytes of padding and the block bit offsets. The decoder keeps a pool
+// of worker threads that is reused for every batch, so one decoder
+// should be shared rather than created per batch.
+//
+// A batch is decoded in two phases. First the lookup tables are
+// generated once for each distinct canonical header in the batch and
+// the block offsets of each image are validated. Then ranges of blocks
+// are decoded, each range is a task. Tasks are handed out round robin
+// to per thread queues and a thread that runs out of work steals from
+// the other queues, so a few large images do not leave threads idle.
+//
+// Input is treated as untrusted in the same way as
+// decodeHuffmanBlocksChecked, an invalid image only fails that image.
+
+#ifndef HuffmanBatchDecoder_hpp
+#define HuffmanBatchDecoder_hpp
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+// Blocks decoded by one task, a larger image is split into ranges
+
+#define HUFF_BATCH_BLOCKS_PER_TASK 256
+
+// One encoded image and its output buffer. outBufferN must hold
+// numBlocks blocks of (blockDim x blockDim) symbols.
+
+typedef struct {
+  const uint8_t *canonHeader;
+  const uint8_t *huffCodes;
+  int huffCodesN;
+  const uint32_t *blockBitOffsets;
+  int numBlocks;
+  int blockDim;
+  uint8_t *outBuffer;
+  int outBufferN;
+} HuffBatchImage;
+
+// Pool of worker threads with one task queue per thread. The thread
+// that calls run() also executes tasks until the batch is done.
+
+class HuffmanWorkPool {
+
+public:
+
+  // When numThreads is 0 one thread is used for each core
+
+  HuffmanWorkPool(int numThreads);
+
+  ~HuffmanWorkPool();
+
+  // Execute every task and return when all the tasks are done
+
+  void
+  run(vector<function<void()> > & tasks);
+
+  // Number of threads that execute tasks, including the caller
+
+  int
+  numThreads() const;
+
+  // Number of tasks that were stolen from another queue, for testing
+
+  uint64_t
+  numStolenTasks() const;
+
+private:
+
+  typedef struct {
+    mutex lock;
+    deque<function<void()> > tasks;
+  } HuffWorkQueue;
+
+  bool
+  popTask(int queuei, function<void()> & outTask);
+
+  void
+  executeTasks(int queuei);
+
+  void
+  workerLoop(int queuei);
+
+  vector<unique_ptr<HuffWorkQueue> > queues;
+  vector<thread> workers;
+
+  mutex stateLock;
+  condition_variable wakeCondition;
+  condition_variable doneCondition;
+  uint64_t generation;
+  bool isStopping;
+
+  atomic<int> numPendingTasks;
+  atomic<uint64_t> numStolen;
+
+};
+
+class HuffmanBatchDecoder {
+
+public:
+
+  // When numThreads is 0 one thread is used for each core
+
+  HuffmanBatchDecoder(int numThreads);
+
+  // Decode every image in the batch, outStatus holds the result for
+  // each image. The output buffer of an image that fails is undefined.
+
+  void
+  decodeBatch(
+              const vector<HuffBatchImage> & images,
+              vector<HuffDecodeStatus> & outStatus);
+
+  // Number of distinct canonical headers in the last batch
+
+  int
+  numUniqueTables() const;
+
+  HuffmanWorkPool &
+  workPool();
+
+private:
+
+  HuffmanWorkPool pool;
+
+  // Lookup tables for each distinct canonical header, reused between
+  // batches so that the vectors do not need to be allocated again.
+
+  vector<vector<HuffLookupSymbol> > table1s;
+  vector<vector<HuffLookupSymbol> > table2s;
+  vector<HuffDecodeStatus> tableStatus;
+  int numTables;
+
+};
+
+#endif // HuffmanBatchDecoder_hpp
@@ -0,0 +1,747 @@
+//
+//  HuffmanBlockKernels.cpp
+//
+//  MIT Licensed
+//
+
+#include "HuffmanBlockKernels.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HUFF_BLOCK_KERNELS_NEON
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HUFF_BLOCK_KERNELS_SSE2
+#endif
+
+// Vector of 16 bytes and the load, store and delta operations used by
+// the block kernels.
+
+#if defined(HUFF_BLOCK_KERNELS_NEON)
+
+typedef uint8x16_t HuffVec16;
+
+static inline
+HuffVec16
+vecZero()
+{
+  return vdupq_n_u8(0);
+}
+
+static inline
+HuffVec16
+vecLoad(const uint8_t *ptr)
+{
+  return vld1q_u8(ptr);
+}
+
+static inline
+void
+vecStore(uint8_t *ptr, HuffVec16 vec)
+{
+  vst1q_u8(ptr, vec);
+}
+
+static inline
+HuffVec16
+vecLoad8x2(const uint8_t *ptr0, const uint8_t *ptr1)
+{
+  return vcombine_u8(vld1_u8(ptr0), vld1_u8(ptr1));
+}
+
+static inline
+void
+vecStore8x2(uint8_t *ptr0, uint8_t *ptr1, HuffVec16 vec)
+{
+  vst1_u8(ptr0, vget_low_u8(vec));
+  vst1_u8(ptr1, vget_high_u8(vec));
+}
+
+// Each value minus the value before it, the value before the first byte
+// is the last byte of prev.
+
+static inline
+HuffVec16
+vecDelta(HuffVec16 vec, HuffVec16 prev)
+{
+  return vsubq_u8(vec, vextq_u8(prev, vec, 15));
+}
+
+// Shift bytes to higher positions, the low bytes are zero
+
+template <int numBytes>
+static inline
+HuffVec16
+vecShiftUp(HuffVec16 vec)
+{
+  return vextq_u8(vdupq_n_u8(0), vec, 16 - numBytes);
+}
+
+static inline
+HuffVec16
+vecAdd(HuffVec16 vec1, HuffVec16 vec2)
+{
+  return vaddq_u8(vec1, vec2);
+}
+
+// Broadcast the last byte to every byte
+
+static inline
+HuffVec16
+vecSplatLast(HuffVec16 vec)
+{
+  return vdupq_n_u8(vgetq_lane_u8(vec, 15));
+}
+
+#elif defined(HUFF_BLOCK_KERNELS_SSE2)
+
+typedef __m128i HuffVec16;
+
+static inline
+HuffVec16
+vecZero()
+{
+  return _mm_setzero_si128();
+}
+
+static inline
+HuffVec16
+vecLoad(const uint8_t *ptr)
+{
+  return _mm_loadu_si128((const __m128i *) ptr);
+}
+
+static inline
+void
+vecStore(uint8_t *ptr, HuffVec16 vec)
+{
+  _mm_storeu_si128((__m128i *) ptr, vec);
+}
+
+static inline
+HuffVec16
+vecLoad8x2(const uint8_t *ptr0, const uint8_t *ptr1)
+{
+  return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) ptr0), _mm_loadl_epi64((const __m128i *) ptr1));
+}
+
+static inline
+void
+vecStore8x2(uint8_t *ptr0, uint8_t *ptr1, HuffVec16 vec)
+{
+  _mm_storel_epi64((__m128i *) ptr0, vec);
+  _mm_storel_epi64((__m128i *) ptr1, _mm_unpackhi_epi64(vec, vec));
+}
+
+// Each value minus the value before it, the value before the first byte
+// is the last byte of prev.
+
+static inline
+HuffVec16
+vecDelta(HuffVec16 vec, HuffVec16 prev)
+{
+  return _mm_sub_epi8(vec, _mm_or_si128(_mm_slli_si128(vec, 1), _mm_srli_si128(prev, 15)));
+}
+
+// Shift bytes to higher positions, the low bytes are zero
+
+template <int numBytes>
+static inline
+HuffVec16
+vecShiftUp(HuffVec16 vec)
+{
+  return _mm_slli_si128(vec, numBytes);
+}
+
+static inline
+HuffVec16
+vecAdd(HuffVec16 vec1, HuffVec16 vec2)
+{
+  return _mm_add_epi8(vec1, vec2);
+}
+
+// Broadcast the last byte to every byte, SSE2 has no byte shuffle so
+// the byte is widened to a 32 bit lane first.
+
+static inline
+HuffVec16
+vecSplatLast(HuffVec16 vec)
+{
+  HuffVec16 high = _mm_unpackhi_epi8(vec, vec);
+  high = _mm_unpackhi_epi16(high, high);
+  return _mm_shuffle_epi32(high, 0xFF);
+}
+
+#else
+
+typedef struct {
+  uint8_t bytes[16];
+} HuffVec16;
+
+static inline
+HuffVec16
+vecZero()
+{
+  HuffVec16 vec;
+  memset(vec.bytes, 0, sizeof(vec.bytes));
+  return vec;
+}
+
+static inline
+HuffVec16
+vecLoad(const uint8_t *ptr)
+{
+  HuffVec16 vec;
+  memcpy(vec.bytes, ptr, 16);
+  return vec;
+}
+
+static inline
+void
+vecStore(uint8_t *ptr, HuffVec16 vec)
+{
+  memcpy(ptr, vec.bytes, 16);
+}
+
+static inline
+HuffVec16
+vecLoad8x2(const uint8_t *ptr0, const uint8_t *ptr1)
+{
+  HuffVec16 vec;
+  memcpy(&vec.bytes[0], ptr0, 8);
+  memcpy(&vec.bytes[8], ptr1, 8);
+  return vec;
+}
+
+static inline
+void
+vecStore8x2(uint8_t *ptr0, uint8_t *ptr1, HuffVec16 vec)
+{
+  memcpy(ptr0, &vec.bytes[0], 8);
+  memcpy(ptr1, &vec.bytes[8], 8);
+}
+
+// Each value minus the value before it, the value before the first byte
+// is the last byte of prev.
+
+static inline
+HuffVec16
+vecDelta(HuffVec16 vec, HuffVec16 prev)
+{
+  HuffVec16 deltas;
+  deltas.bytes[0] = vec.bytes[0] - prev.bytes[15];
+  for ( int i = 1; i < 16; i++ ) {
+    deltas.bytes[i] = vec.bytes[i] - vec.bytes[i-1];
+  }
+  return deltas;
+}
+
+// Shift bytes to higher positions, the low bytes are zero
+
+template <int numBytes>
+static inline
+HuffVec16
+vecShiftUp(HuffVec16 vec)
+{
+  HuffVec16 shifted = vecZero();
+  memcpy(&shifted.bytes[numBytes], vec.bytes, 16 - numBytes);
+  return shifted;
+}
+
+static inline
+HuffVec16
+vecAdd(HuffVec16 vec1, HuffVec16 vec2)
+{
+  HuffVec16 sum;
+  for ( int i = 0; i < 16; i++ ) {
+    sum.bytes[i] = vec1.bytes[i] + vec2.bytes[i];
+  }
+  return sum;
+}
+
+// Broadcast the last byte to every byte
+
+static inline
+HuffVec16
+vecSplatLast(HuffVec16 vec)
+{
+  HuffVec16 splat;
+  memset(splat.bytes, vec.bytes[15], sizeof(splat.bytes));
+  return splat;
+}
+
+#endif // HUFF_BLOCK_KERNELS_NEON
+
+// 4 rows of 4 bytes, the rows are gathered with 32 bit copies
+
+static inline
+HuffVec16
+vecLoad4x4(const uint8_t *ptr, int rowStride)
+{
+  uint8_t rows[16];
+  memcpy(&rows[0], ptr, 4);
+  memcpy(&rows[4], ptr + rowStride, 4);
+  memcpy(&rows[8], ptr + (2 * rowStride), 4);
+  memcpy(&rows[12], ptr + (3 * rowStride), 4);
+  return vecLoad(rows);
+}
+
+static inline
+void
+vecStore4x4(uint8_t *ptr, int rowStride, HuffVec16 vec)
+{
+  uint8_t rows[16];
+  vecStore(rows, vec);
+  memcpy(ptr, &rows[0], 4);
+  memcpy(ptr + rowStride, &rows[4], 4);
+  memcpy(ptr + (2 * rowStride), &rows[8], 4);
+  memcpy(ptr + (3 * rowStride), &rows[12], 4);
+}
+
+// Wrapping prefix sum of 16 bytes in 4 shift and add steps, then the
+// running total of the previous vectors is added to every byte.
+
+static inline
+HuffVec16
+vecPrefixSum(HuffVec16 vec, HuffVec16 carry)
+{
+  vec = vecAdd(vec, vecShiftUp<1>(vec));
+  vec = vecAdd(vec, vecShiftUp<2>(vec));
+  vec = vecAdd(vec, vecShiftUp<4>(vec));
+  vec = vecAdd(vec, vecShiftUp<8>(vec));
+  return vecAdd(vec, carry);
+}
+
+// In place prefix sum of numBytes deltas, the first delta is from 0
+
+static inline
+void
+prefixSum(uint8_t *bytes, int numBytes)
+{
+  HuffVec16 carry = vecZero();
+  int i = 0;
+
+  for ( ; (i + 16) <= numBytes; i += 16 ) {
+    HuffVec16 vec = vecPrefixSum(vecLoad(bytes + i), carry);
+    vecStore(bytes + i, vec);
+    carry = vecSplatLast(vec);
+  }
+
+  uint8_t prev = (i == 0) ? 0 : bytes[i - 1];
+
+  for ( ; i < numBytes; i++ ) {
+    prev += bytes[i];
+    bytes[i] = prev;
+  }
+}
+
+// Load the 16 bytes at vectori of a block in block order, the block is
+// read from a raster with rowStride bytes per row.
+
+template <int blockDim>
+static inline
+HuffVec16
+loadBlockVector(const uint8_t *blockPtr, int rowStride, int vectori)
+{
+  if (blockDim == 4) {
+    return vecLoad4x4(blockPtr, rowStride);
+  } else if (blockDim == 8) {
+    const uint8_t *rowPtr = blockPtr + ((vectori * 2) * rowStride);
+    return vecLoad8x2(rowPtr, rowPtr + rowStride);
+  } else {
+    const int rowi = (vectori * 16) / blockDim;
+    const int coli = (vectori * 16) % blockDim;
+    return vecLoad(blockPtr + (rowi * rowStride) + coli);
+  }
+}
+
+template <int blockDim>
+static inline
+void
+storeBlockVector(uint8_t *blockPtr, int rowStride, int vectori, HuffVec16 vec)
+{
+  if (blockDim == 4) {
+    vecStore4x4(blockPtr, rowStride, vec);
+  } else if (blockDim == 8) {
+    uint8_t *rowPtr = blockPtr + ((vectori * 2) * rowStride);
+    vecStore8x2(rowPtr, rowPtr + rowStride, vec);
+  } else {
+    const int rowi = (vectori * 16) / blockDim;
+    const int coli = (vectori * 16) % blockDim;
+    vecStore(blockPtr + (rowi * rowStride) + coli, vec);
+  }
+}
+
+// Split one whole block, the loop is unrolled for each block dimension
+
+template <int blockDim, bool isDelta>
+static inline
+void
+splitBlock(const uint8_t *blockPtr, int rowStride, uint8_t *outPtr)
+{
+  const int numVectors = (blockDim * blockDim) / 16;
+
+  HuffVec16 prev = vecZero();
+
+  for ( int vectori = 0; vectori < numVectors; vectori++ ) {
+    HuffVec16 vec = loadBlockVector<blockDim>(blockPtr, rowStride, vectori);
+
+    if (isDelta) {
+      vecStore(outPtr + (vectori * 16), vecDelta(vec, prev));
+      prev = vec;
+    } else {
+      vecStore(outPtr + (vectori * 16), vec);
+    }
+  }
+}
+
+template <int blockDim>
+static inline
+void
+flattenBlock(const uint8_t *blockPtr, uint8_t *outPtr, int rowStride)
+{
+  const int numVectors = (blockDim * blockDim) / 16;
+
+  for ( int vectori = 0; vectori < numVectors; vectori++ ) {
+    HuffVec16 vec = vecLoad(blockPtr + (vectori * 16));
+    storeBlockVector<blockDim>(outPtr, rowStride, vectori, vec);
+  }
+}
+
+// Split the image one row of blocks at a time, so that the blockDim
+// input rows being read stay in the cache while the output is written
+// in order. Partial blocks are copied to a padded block buffer first.
+
+template <int blockDim, bool isDelta>
+static
+void
+splitImage(
+           const uint8_t *inBytes,
+           uint8_t *outBlockBytes,
+           uint8_t *outBlockInit,
+           int width,
+           int height,
+           uint8_t zeroValue)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const int blockWidth = (width + blockDim - 1) / blockDim;
+  const int blockHeight = (height + blockDim - 1) / blockDim;
+
+  uint8_t paddedBlock[blockDim * blockDim];
+
+  uint8_t *outPtr = outBlockBytes;
+  int blocki = 0;
+
+  for ( int blockY = 0; blockY < blockHeight; blockY++ ) {
+    const int y = blockY * blockDim;
+    const int numRows = (height - y) < blockDim ? (height - y) : blockDim;
+    const uint8_t *rowPtr = inBytes + (y * width);
+
+    for ( int blockX = 0; blockX < blockWidth; blockX++, blocki++ ) {
+      const int x = blockX * blockDim;
+      const int numCols = (width - x) < blockDim ? (width - x) : blockDim;
+
+      if (numRows == blockDim && numCols == blockDim) {
+        splitBlock<blockDim, isDelta>(rowPtr + x, width, outPtr);
+      } else {
+        memset(paddedBlock, zeroValue, sizeof(paddedBlock));
+
+        for ( int rowi = 0; rowi < numRows; rowi++ ) {
+          memcpy(&paddedBlock[rowi * blockDim], rowPtr + (rowi * width) + x, numCols);
+        }
+
+        splitBlock<blockDim, isDelta>(paddedBlock, blockDim, outPtr);
+      }
+
+      if (isDelta && outBlockInit != NULL) {
+        outBlockInit[blocki] = outPtr[0];
+        outPtr[0] = 0;
+      }
+
+      outPtr += blockNumSymbols;
+    }
+  }
+}
+
+template <int blockDim>
+static
+void
+flattenImage(
+             const uint8_t *inBlockBytes,
+             uint8_t *outBytes,
+             int width,
+             int height)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const int blockWidth = (width + blockDim - 1) / blockDim;
+  const int blockHeight = (height + blockDim - 1) / blockDim;
+
+  uint8_t paddedBlock[blockDim * blockDim];
+
+  const uint8_t *inPtr = inBlockBytes;
+
+  for ( int blockY = 0; blockY < blockHeight; blockY++ ) {
+    const int y = blockY * blockDim;
+    const int numRows = (height - y) < blockDim ? (height - y) : blockDim;
+    uint8_t *rowPtr = outBytes + (y * width);
+
+    for ( int blockX = 0; blockX < blockWidth; blockX++ ) {
+      const int x = blockX * blockDim;
+      const int numCols = (width - x) < blockDim ? (width - x) : blockDim;
+
+      if (numRows == blockDim && numCols == blockDim) {
+        flattenBlock<blockDim>(inPtr, rowPtr + x, width);
+      } else {
+        flattenBlock<blockDim>(inPtr, paddedBlock, blockDim);
+
+        for ( int rowi = 0; rowi < numRows; rowi++ ) {
+          memcpy(rowPtr + (rowi * width) + x, &paddedBlock[rowi * blockDim], numCols);
+        }
+      }
+
+      inPtr += blockNumSymbols;
+    }
+  }
+}
+
+// Scalar split for block dimensions without a vector kernel
+
+static
+void
+splitImageScalar(
+                 const uint8_t *inBytes,
+                 uint8_t *outBlockBytes,
+                 uint8_t *outBlockInit,
+                 int width,
+                 int height,
+                 int blockDim,
+                 uint8_t zeroValue,
+                 bool isDelta)
+{
+  const int blockWidth = (width + blockDim - 1) / blockDim;
+  const int blockHeight = (height + blockDim - 1) / blockDim;
+
+  uint8_t *outPtr = outBlockBytes;
+  int blocki = 0;
+
+  for ( int blockY = 0; blockY < blockHeight; blockY++ ) {
+    for ( int blockX = 0; blockX < blockWidth; blockX++, blocki++ ) {
+      uint8_t prev = 0;
+
+      for ( int rowi = 0; rowi < blockDim; rowi++ ) {
+        const int y = (blockY * blockDim) + rowi;
+
+        for ( int coli = 0; coli < blockDim; coli++ ) {
+          const int x = (blockX * blockDim) + coli;
+          uint8_t value = zeroValue;
+
+          if (x < width && y < height) {
+            value = inBytes[(y * width) + x];
+          }
+
+          if (isDelta) {
+            *outPtr++ = value - prev;
+            prev = value;
+          } else {
+            *outPtr++ = value;
+          }
+        }
+      }
+
+      if (isDelta && outBlockInit != NULL) {
+        uint8_t *blockPtr = outPtr - (blockDim * blockDim);
+        outBlockInit[blocki] = blockPtr[0];
+        blockPtr[0] = 0;
+      }
+    }
+  }
+}
+
+static
+void
+flattenImageScalar(
+                   const uint8_t *inBlockBytes,
+                   uint8_t *outBytes,
+                   int width,
+                   int height,
+                   int blockDim)
+{
+  const int blockWidth = (width + blockDim - 1) / blockDim;
+  const int blockHeight = (height + blockDim - 1) / blockDim;
+
+  const uint8_t *inPtr = inBlockBytes;
+
+  for ( int blockY = 0; blockY < blockHeight; blockY++ ) {
+    for ( int blockX = 0; blockX < blockWidth; blockX++ ) {
+      for ( int rowi = 0; rowi < blockDim; rowi++ ) {
+        const int y = (blockY * blockDim) + rowi;
+
+        for ( int coli = 0; coli < blockDim; coli++ ) {
+          const int x = (blockX * blockDim) + coli;
+          uint8_t value = *inPtr++;
+
+          if (x < width && y < height) {
+            outBytes[(y * width) + x] = value;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <bool isDelta>
+static
+void
+splitImageForBlockDim(
+                      const uint8_t *inBytes,
+                      uint8_t *outBlockBytes,
+                      uint8_t *outBlockInit,
+                      int width,
+                      int height,
+                      int blockDim,
+                      uint8_t zeroValue)
+{
+#if defined(DEBUG)
+  assert(blockDim > 0);
+#endif // DEBUG
+
+  switch (blockDim) {
+    case 4:
+      splitImage<4, isDelta>(inBytes, outBlockBytes, outBlockInit, width, height, zeroValue);
+      break;
+    case 8:
+      splitImage<8, isDelta>(inBytes, outBlockBytes, outBlockInit, width, height, zeroValue);
+      break;
+    case 16:
+      splitImage<16, isDelta>(inBytes, outBlockBytes, outBlockInit, width, height, zeroValue);
+      break;
+    case 32:
+      splitImage<32, isDelta>(inBytes, outBlockBytes, outBlockInit, width, height, zeroValue);
+      break;
+    default:
+      splitImageScalar(inBytes, outBlockBytes, outBlockInit, width, height, blockDim, zeroValue, isDelta);
+      break;
+  }
+}
+
+// Split a width x height image into block ordered values
+
+void
+HuffmanBlockKernels::splitImageToBlocks(
+                                        const uint8_t *inBytes,
+                                        uint8_t *outBlockBytes,
+                                        int width,
+                                        int height,
+                                        int blockDim,
+                                        uint8_t zeroValue)
+{
+  HUFF_TRACE_SPAN("block split");
+
+  splitImageForBlockDim<false>(inBytes, outBlockBytes, NULL, width, height, blockDim, zeroValue);
+}
+
+// Split a width x height image into block ordered deltas
+
+void
+HuffmanBlockKernels::splitImageToBlockDeltas(
+                                             const uint8_t *inBytes,
+                                             uint8_t *outBlockBytes,
+                                             uint8_t *outBlockInit,
+                                             int width,
+                                             int height,
+                                             int blockDim,
+                                             uint8_t zeroValue)
+{
+  HUFF_TRACE_SPAN("block split delta");
+
+  splitImageForBlockDim<true>(inBytes, outBlockBytes, outBlockInit, width, height, blockDim, zeroValue);
+}
+
+// Write block ordered values to a width x height image
+
+void
+HuffmanBlockKernels::flattenBlocksToImage(
+                                          const uint8_t *inBlockBytes,
+                                          uint8_t *outBytes,
+                                          int width,
+                                          int height,
+                                          int blockDim)
+{
+  HUFF_TRACE_SPAN("reorder");
+
+#if defined(DEBUG)
+  assert(blockDim > 0);
+#endif // DEBUG
+
+  switch (blockDim) {
+    case 4:
+      flattenImage<4>(inBlockBytes, outBytes, width, height);
+      break;
+    case 8:
+      flattenImage<8>(inBlockBytes, outBytes, width, height);
+      break;
+    case 16:
+      flattenImage<16>(inBlockBytes, outBytes, width, height);
+      break;
+    case 32:
+      flattenImage<32>(inBlockBytes, outBytes, width, height);
+      break;
+    default:
+      flattenImageScalar(inBlockBytes, outBytes, width, height, blockDim);
+      break;
+  }
+}
+
+// Reconstruct values from signed byte deltas in place
+
+void
+HuffmanBlockKernels::decodeDeltas(
+                                  uint8_t *bytes,
+                                  int numBytes)
+{
+  prefixSum(bytes, numBytes);
+}
+
+// Reconstruct each block from its signed byte deltas in place
+
+void
+HuffmanBlockKernels::decodeBlockDeltas(
+                                       uint8_t *blockBytes,
+                                       const uint8_t *blockInit,
+                                       int numBlocks,
+                                       int blockDim)
+{
+  HUFF_TRACE_SPAN("delta decode");
+
+  const int blockNumSymbols = blockDim * blockDim;
+
+  uint8_t *blockPtr = blockBytes;
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    if (blockInit != NULL) {
+      blockPtr[0] = blockInit[blocki];
+    }
+
+    prefixSum(blockPtr, blockNumSymbols);
+
+    blockPtr += blockNumSymbols;
+  }
+}
+
+// Name of the vector instruction set the kernels were compiled for
+
+const char *
+HuffmanBlockKernels::vectorImplName()
+{
+#if defined(HUFF_BLOCK_KERNELS_NEON)
+  return "NEON";
+#elif defined(HUFF_BLOCK_KERNELS_SSE2)
+  return "SSE2";
+#else
+  return "scalar";
+#endif // HUFF_BLOCK_KERNELS_NEON
+}
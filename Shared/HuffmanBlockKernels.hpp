@@ -0,0 +1,96 @@
+//
+//  HuffmanBlockKernels.hpp
+//
+//  MIT Licensed
+//
+// Kernels that split a raster image into NxN blocks and flatten blocks
+// back into a raster image, with the block values in raster order. The
+// split can be fused with the 1D delta of each block so that the block
+// order input to the encoder is generated in one pass over the image,
+// and the deltas can be reconstructed in place with a vector prefix sum.
+//
+// Each block is moved as 16 byte vectors: a 4x4 block is one vector, an
+// 8x8 block is four vectors that each hold two rows and larger blocks
+// are loaded 16 bytes of a row at a time. NEON is used on ARM, SSE2 on
+// x86 and a portable scalar implementation otherwise. Partial blocks
+// along the right and bottom edges go through a padded block buffer,
+// so the vector loop never reads or writes past the image.
+
+#ifndef HuffmanBlockKernels_hpp
+#define HuffmanBlockKernels_hpp
+
+#include <cstdint>
+
+using namespace std;
+
+class HuffmanBlockKernels {
+
+public:
+
+  // Split a width x height image into block ordered values, blocks along
+  // the right and bottom edges are padded with zeroValue.
+
+  static void
+  splitImageToBlocks(
+                     const uint8_t *inBytes,
+                     uint8_t *outBlockBytes,
+                     int width,
+                     int height,
+                     int blockDim,
+                     uint8_t zeroValue);
+
+  // Split a width x height image into blocks and write the signed byte
+  // deltas of each block, the first delta of a block is a delta from 0.
+  // When outBlockInit is not NULL the first value of each block is
+  // written to outBlockInit and the first delta is set to 0.
+
+  static void
+  splitImageToBlockDeltas(
+                          const uint8_t *inBytes,
+                          uint8_t *outBlockBytes,
+                          uint8_t *outBlockInit,
+                          int width,
+                          int height,
+                          int blockDim,
+                          uint8_t zeroValue);
+
+  // Write block ordered values to a width x height image, the zero
+  // padding in blocks along the right and bottom edges is cropped.
+
+  static void
+  flattenBlocksToImage(
+                       const uint8_t *inBlockBytes,
+                       uint8_t *outBytes,
+                       int width,
+                       int height,
+                       int blockDim);
+
+  // Reconstruct values from signed byte deltas in place, the first
+  // delta is a delta from 0. The wrapping sum of each 16 bytes is
+  // computed with 4 shifted adds.
+
+  static void
+  decodeDeltas(
+               uint8_t *bytes,
+               int numBytes);
+
+  // Reconstruct numBlocks blocks from the signed byte deltas of each
+  // block in place, this is the inverse of splitImageToBlockDeltas.
+  // When blockInit is not NULL the first value of each block is read
+  // from blockInit.
+
+  static void
+  decodeBlockDeltas(
+                    uint8_t *blockBytes,
+                    const uint8_t *blockInit,
+                    int numBlocks,
+                    int blockDim);
+
+  // Name of the vector instruction set the kernels were compiled for
+
+  static const char *
+  vectorImplName();
+
+};
+
+#endif // HuffmanBlockKernels_hpp
@@ -0,0 +1,203 @@
+//
+//  HuffmanCanonicalDecoder.cpp
+//
+//  MIT Licensed
+//
+
+#include "HuffmanCanonicalDecoder.hpp"
+
+#include "HuffmanTrace.hpp"
+#include "huff_util.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include <assert.h>
+
+// Generate the canonical metadata, codes are assigned in order of
+// increasing length and then in symbol order as in
+// huff_generate_canonical_codes.
+
+HuffDecodeStatus
+HuffmanCanonicalDecoder::generateTable(
+                                       const uint8_t *canonTable,
+                                       HuffCanonicalTable & outTable)
+{
+  HUFF_TRACE_SPAN("table generation");
+
+  // Kraft sum in units of 2^-16, a valid prefix code sums to at most 1.0
+
+  uint32_t kraftSum = 0;
+  int numCodesOfWidth[17];
+  memset(numCodesOfWidth, 0, sizeof(numCodesOfWidth));
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    const int bitWidth = canonTable[symbol];
+    if (bitWidth == 0) {
+      continue;
+    }
+    if (bitWidth > 16) {
+      return HUFF_DECODE_ERROR_TABLE;
+    }
+    kraftSum += (1 << (16 - bitWidth));
+    numCodesOfWidth[bitWidth] += 1;
+  }
+
+  if (kraftSum == 0 || kraftSum > (1 << 16)) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  memset(&outTable, 0, sizeof(outTable));
+
+  int minLength = 16;
+  int maxLength = 1;
+
+  for ( int bitWidth = 1; bitWidth <= 16; bitWidth++ ) {
+    if (numCodesOfWidth[bitWidth] > 0) {
+      minLength = (bitWidth < minLength) ? bitWidth : minLength;
+      maxLength = bitWidth;
+    }
+  }
+
+  outTable.minLength = (uint8_t) minLength;
+  outTable.maxLength = (uint8_t) maxLength;
+
+  // The first code of each length follows the codes of the shorter
+  // lengths, the Kraft sum check means the codes fit in 16 bits.
+
+  uint32_t code = 0;
+  int symboli = 0;
+
+  for ( int bitWidth = 1; bitWidth <= 16; bitWidth++ ) {
+    const int numCodes = numCodesOfWidth[bitWidth];
+
+    if (bitWidth > maxLength) {
+      outTable.lastCodes[bitWidth - 1] = outTable.lastCodes[maxLength - 1];
+      continue;
+    }
+
+    outTable.symbolOffsets[bitWidth - 1] = (uint16_t) (code - symboli);
+
+    // Lengths shorter than minLength are never searched
+
+    if (bitWidth >= minLength) {
+      outTable.lastCodes[bitWidth - 1] = (uint16_t) (((code + numCodes) << (16 - bitWidth)) - 1);
+    }
+
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      if (canonTable[symbol] == bitWidth) {
+        outTable.symbols[symboli++] = (uint8_t) symbol;
+      }
+    }
+
+    code = (code + numCodes) << 1;
+  }
+
+  outTable.lastCodes[16] = 0xFFFF;
+
+#if defined(DEBUG)
+  {
+    vector<uint8_t> table(canonTable, canonTable + 256);
+    vector<uint16_t> codes = huff_generate_canonical_codes(table);
+
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      if (canonTable[symbol] == 0) {
+        continue;
+      }
+      uint8_t decodedSymbol;
+      unsigned int bitWidth = huff_canonical_decode_symbol(&outTable, codes[symbol], &decodedSymbol);
+      assert(bitWidth == canonTable[symbol]);
+      assert(decodedSymbol == symbol);
+    }
+  }
+#endif // DEBUG
+
+  return HUFF_DECODE_OK;
+}
+
+uint32_t
+HuffmanCanonicalDecoder::decodeSymbolsAtBitOffset(
+                                                  const HuffCanonicalTable *table,
+                                                  const uint8_t *huffBuff,
+                                                  uint32_t bitOffset,
+                                                  uint8_t *outBuffer,
+                                                  int numSymbols)
+{
+  uint32_t numBitsRead = bitOffset;
+
+  for ( int i = 0; i < numSymbols; i++ ) {
+    uint16_t inputBitPattern = huff_read_code_bits(huffBuff, numBitsRead);
+    numBitsRead += huff_canonical_decode_symbol(table, inputBitPattern, &outBuffer[i]);
+  }
+
+  return numBitsRead;
+}
+
+// Checked decode of one stream, blocks must be contiguous in huffBuff
+// beginning at bit 0.
+
+HuffDecodeStatus
+HuffmanCanonicalDecoder::decodeHuffmanBlocksChecked(
+                                                    const uint8_t *canonHeader,
+                                                    int numBlocks,
+                                                    int blockDim,
+                                                    const uint8_t *huffBuff,
+                                                    int huffBuffN,
+                                                    const uint32_t *blockBitOffsets,
+                                                    uint8_t *outBuffer,
+                                                    int outBufferN)
+{
+  HUFF_TRACE_SPAN("canonical decode");
+
+  if (numBlocks < 0 || !HuffmanUtil::isSupportedBlockDim(blockDim)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockNumSymbols = blockDim * blockDim;
+
+  if (((int64_t) numBlocks * blockNumSymbols) > outBufferN) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  if (numBlocks == 0) {
+    return HUFF_DECODE_OK;
+  }
+
+  if (canonHeader == nullptr || huffBuff == nullptr || blockBitOffsets == nullptr || outBuffer == nullptr) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  // The buffer must end with +2 bytes of read ahead padding
+
+  if (huffBuffN < 2) {
+    return HUFF_DECODE_ERROR_PADDING;
+  }
+
+  HuffCanonicalTable table;
+
+  HuffDecodeStatus status = generateTable(canonHeader, table);
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  status = HuffmanUtil::validateBlockBitOffsets(blockBitOffsets, nullptr, numBlocks, 1, blockDim, huffBuffN);
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  auto blockDecoder = [&table](int tableId, const uint8_t *codes, uint32_t bitOffset, uint8_t *symbols, int numSymbols) -> uint32_t {
+    return decodeSymbolsAtBitOffset(&table, codes, bitOffset, symbols, numSymbols);
+  };
+
+  return HuffmanUtil::decodeBlockRangeChecked(blockDecoder,
+                                              numBlocks,
+                                              blockDim,
+                                              huffBuff,
+                                              huffBuffN,
+                                              blockBitOffsets,
+                                              nullptr,
+                                              0,
+                                              numBlocks,
+                                              outBuffer);
+}
@@ -0,0 +1,136 @@
+//
+//  HuffmanCanonicalDecoder.hpp
+//
+//  MIT Licensed
+//
+// Table free canonical decoder. The lookup table decoders need 64K
+// entries or table1 plus a variable size table2 for each canonical
+// table. This decoder keeps only the canonical metadata, the symbols in
+// code order and for each code length the left justified last code and
+// the offset from a code to its index in the symbol order. A table is
+// about 320 bytes, 256 of which are the symbols, so hundreds of streams
+// with distinct tables can be decoded without thrashing the cache.
+//
+// Canonical codes are assigned in increasing code length order, so the
+// left justified codes of each length are larger than the codes of any
+// shorter length. The length of the code at the front of a 16 bit
+// window is the first length whose last code is >= the window. The
+// search starts at the number of leading 1 bits in the window, since a
+// code that is all 1 bits is the last code of the longest length.
+
+#ifndef HuffmanCanonicalDecoder_hpp
+#define HuffmanCanonicalDecoder_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+// Canonical metadata for one table. Index (L - 1) is for code length L,
+// lengths past maxLength repeat the last code of maxLength and index 16
+// is a 0xFFFF sentinel that is reached only by an invalid bit pattern.
+
+typedef struct {
+  uint16_t lastCodes[17];
+  uint16_t symbolOffsets[16];
+  uint8_t minLength;
+  uint8_t maxLength;
+  uint8_t symbols[256];
+} HuffCanonicalTable;
+
+// Number of leading 1 bits in a 16 bit window, in the range 0 to 16
+
+static inline
+unsigned int
+huff_count_leading_ones(uint16_t window)
+{
+  // The 0x8000 bit stops the count at 16 when every window bit is 1
+  const uint32_t inverted = ((uint32_t) (uint16_t) ~window << 16) | 0x8000;
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned int) __builtin_clz(inverted);
+#else
+  unsigned int count = 0;
+  while ((inverted & (0x80000000 >> count)) == 0) {
+    count += 1;
+  }
+  return count;
+#endif // __GNUC__
+}
+
+// Decode the symbol at the front of a left justified 16 bit window and
+// return the code length. An invalid bit pattern returns symbol 0 with
+// a 16 bit width, the same as an unused lookup table entry.
+
+static inline
+unsigned int
+huff_canonical_decode_symbol(
+                             const HuffCanonicalTable *table,
+                             uint16_t window,
+                             uint8_t *outSymbol)
+{
+  unsigned int bitWidth = huff_count_leading_ones(window);
+
+  if (bitWidth < table->minLength) {
+    bitWidth = table->minLength;
+  } else if (bitWidth > table->maxLength) {
+    bitWidth = table->maxLength;
+  }
+
+  while (window > table->lastCodes[bitWidth - 1]) {
+    bitWidth += 1;
+  }
+
+  if (bitWidth > 16) {
+    *outSymbol = 0;
+    return 16;
+  }
+
+  const unsigned int symboli = (window >> (16 - bitWidth)) - table->symbolOffsets[bitWidth - 1];
+  *outSymbol = table->symbols[symboli & 0xFF];
+  return bitWidth;
+}
+
+class HuffmanCanonicalDecoder {
+
+public:
+
+  // Generate the canonical metadata for a canonical table of 256 bit
+  // widths. Returns HUFF_DECODE_ERROR_TABLE under the same conditions as
+  // generateCheckedLookupTables.
+
+  static HuffDecodeStatus
+  generateTable(
+                const uint8_t *canonTable,
+                HuffCanonicalTable & outTable);
+
+  // Decode numSymbols symbols beginning at bitOffset and return the
+  // bit offset after the last code. huffBuff must have +2 bytes of
+  // read ahead padding after the last code bit.
+
+  static uint32_t
+  decodeSymbolsAtBitOffset(
+                           const HuffCanonicalTable *table,
+                           const uint8_t *huffBuff,
+                           uint32_t bitOffset,
+                           uint8_t *outBuffer,
+                           int numSymbols);
+
+  // Decode block ordered symbols from one stream with a single table,
+  // the input is validated in the same way as decodeHuffmanBlocksChecked.
+
+  static HuffDecodeStatus
+  decodeHuffmanBlocksChecked(
+                             const uint8_t *canonHeader,
+                             int numBlocks,
+                             int blockDim,
+                             const uint8_t *huffBuff,
+                             int huffBuffN,
+                             const uint32_t *blockBitOffsets,
+                             uint8_t *outBuffer,
+                             int outBufferN);
+
+};
+
+#endif // HuffmanCanonicalDecoder_hpp
@@ -0,0 +1,286 @@
+// C++ impl of color image encoding with a YCoCg-R transform
+//  MIT Licensed
+
+#include "HuffmanColor.hpp"
+
+#include <vector>
+#include <cstdint>
+
+#include <assert.h>
+
+using namespace std;
+
+// Lossless YCoCg-R lifting steps. Co and Cg are computed modulo 256 so
+// that each channel fits in a byte, the shifts operate on the signed
+// 8 bit value so that each step can be exactly inverted.
+
+static inline
+void
+rgbToYCoCgR(uint8_t R, uint8_t G, uint8_t B, uint8_t & Y, uint8_t & Co, uint8_t & Cg)
+{
+  int8_t co = (int8_t) (R - B);
+  uint8_t t = B + (co >> 1);
+  int8_t cg = (int8_t) (G - t);
+  Y = t + (cg >> 1);
+  Co = (uint8_t) co;
+  Cg = (uint8_t) cg;
+}
+
+static inline
+void
+ycocgRToRGB(uint8_t Y, uint8_t Co, uint8_t Cg, uint8_t & R, uint8_t & G, uint8_t & B)
+{
+  int8_t co = (int8_t) Co;
+  int8_t cg = (int8_t) Cg;
+  uint8_t t = Y - (cg >> 1);
+  G = cg + t;
+  B = t - (co >> 1);
+  R = B + co;
+}
+
+// Convert pixels to YCoCg-R and write each channel as a plane
+// of block ordered values.
+
+void
+HuffmanColor::splitIntoPlanes(
+                              const uint8_t *pixels,
+                              int width,
+                              int height,
+                              HuffColorFormat format,
+                              int blockDim,
+                              vector<vector<uint8_t> > & outPlanes)
+{
+  const int numChannels = (int) format;
+  const int blockWidth = HuffmanUtil::numBlocksForDim(width, blockDim);
+  const int blockHeight = HuffmanUtil::numBlocksForDim(height, blockDim);
+  const int planeNumBytes = blockWidth * blockHeight * blockDim * blockDim;
+
+  outPlanes.resize(numChannels);
+
+  for ( auto & plane : outPlanes ) {
+    plane.assign(planeNumBytes, 0);
+  }
+
+  uint8_t *yPtr = outPlanes[0].data();
+  uint8_t *coPtr = outPlanes[1].data();
+  uint8_t *cgPtr = outPlanes[2].data();
+  uint8_t *aPtr = (numChannels == 4) ? outPlanes[3].data() : nullptr;
+
+  for ( int row = 0; row < height; row++ ) {
+    const uint8_t *rowPtr = pixels + (row * width * numChannels);
+    const int blockRowOffset = (row / blockDim) * blockWidth * blockDim * blockDim;
+    const int rowInBlockOffset = (row % blockDim) * blockDim;
+
+    for ( int col = 0; col < width; col++ ) {
+      const uint8_t *pixelPtr = rowPtr + (col * numChannels);
+
+      uint8_t R, G, B;
+
+      if (format == HUFF_COLOR_BGRA) {
+        B = pixelPtr[0];
+        G = pixelPtr[1];
+        R = pixelPtr[2];
+      } else {
+        R = pixelPtr[0];
+        G = pixelPtr[1];
+        B = pixelPtr[2];
+      }
+
+      const int offset = blockRowOffset + ((col / blockDim) * blockDim * blockDim) + rowInBlockOffset + (col % blockDim);
+
+      rgbToYCoCgR(R, G, B, yPtr[offset], coPtr[offset], cgPtr[offset]);
+
+      if (aPtr != nullptr) {
+        aPtr[offset] = pixelPtr[3];
+      }
+    }
+  }
+}
+
+// Interleave block ordered planes back to BGRA8 pixels in one pass
+
+void
+HuffmanColor::interleavePlanesToBGRA(
+                                     const vector<vector<uint8_t> > & planes,
+                                     int width,
+                                     int height,
+                                     int blockDim,
+                                     uint32_t *outPixels)
+{
+  assert(planes.size() == 3 || planes.size() == 4);
+
+  const int blockWidth = HuffmanUtil::numBlocksForDim(width, blockDim);
+
+  const uint8_t *yPtr = planes[0].data();
+  const uint8_t *coPtr = planes[1].data();
+  const uint8_t *cgPtr = planes[2].data();
+  const uint8_t *aPtr = (planes.size() == 4) ? planes[3].data() : nullptr;
+
+  for ( int row = 0; row < height; row++ ) {
+    uint32_t *rowPtr = outPixels + (row * width);
+    const int blockRowOffset = (row / blockDim) * blockWidth * blockDim * blockDim;
+    const int rowInBlockOffset = (row % blockDim) * blockDim;
+
+    for ( int col = 0; col < width; col++ ) {
+      const int offset = blockRowOffset + ((col / blockDim) * blockDim * blockDim) + rowInBlockOffset + (col % blockDim);
+
+      uint8_t R, G, B;
+      ycocgRToRGB(yPtr[offset], coPtr[offset], cgPtr[offset], R, G, B);
+
+      uint32_t A = (aPtr != nullptr) ? aPtr[offset] : 0xFF;
+
+      rowPtr[col] = (A << 24) | (R << 16) | (G << 8) | B;
+    }
+  }
+}
+
+// Encode color pixels, each plane is predicted and encoded on its own
+
+void
+HuffmanColor::encodeColor(
+                          const uint8_t *pixels,
+                          int width,
+                          int height,
+                          HuffColorFormat format,
+                          int blockDim,
+                          HuffPredictor predictor,
+                          int maxNumTables,
+                          vector<uint8_t> & outFileHeader,
+                          vector<HuffColorPlane> & outPlanes)
+{
+  const int numChannels = (int) format;
+  const int blockNumSymbols = blockDim * blockDim;
+
+  // A table id is one byte, so at most 255 tables fit in the header
+
+  if (maxNumTables > 255) {
+    maxNumTables = 255;
+  }
+
+  // Noisy blocks are stored raw unless coding saves more than 1/16
+  // of the raw size, a raw block is copied instead of decoded.
+  const int rawBlockThresholdBits = (blockNumSymbols * 8) / 16;
+
+  vector<vector<uint8_t> > planes;
+  splitIntoPlanes(pixels, width, height, format, blockDim, planes);
+
+  outPlanes.resize(numChannels);
+
+  vector<uint8_t> residuals;
+  vector<uint8_t> planeFileHeader;
+  int numTables = 1;
+
+  for ( int planei = 0; planei < numChannels; planei++ ) {
+    vector<uint8_t> & plane = planes[planei];
+    HuffColorPlane & encodedPlane = outPlanes[planei];
+
+    const int numBlocks = (int) plane.size() / blockNumSymbols;
+
+    residuals.resize(plane.size());
+
+    HuffmanUtil::encodePredictedBlocks(plane.data(), residuals.data(), numBlocks, blockDim, predictor, encodedPlane.blockPredictors);
+
+    HuffmanUtil::encodeHuffmanMultipleTables(residuals.data(),
+                                             (int) residuals.size(),
+                                             planeFileHeader,
+                                             encodedPlane.canonHeaders,
+                                             encodedPlane.huffCodes,
+                                             encodedPlane.blockBitOffsets,
+                                             encodedPlane.blockTableIds,
+                                             blockDim,
+                                             maxNumTables,
+                                             true,
+                                             rawBlockThresholdBits);
+
+    if ((int) encodedPlane.canonHeaders.size() > numTables) {
+      numTables = (int) encodedPlane.canonHeaders.size();
+    }
+  }
+
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, width * height * numChannels);
+  header.blockDim = blockDim;
+  header.predictor = predictor;
+  header.numTables = numTables;
+  header.numChannels = numChannels;
+  HuffmanUtil::generateFileHeader(header, outFileHeader);
+}
+
+// Decode planes generated by encodeColor to BGRA8 pixels. The header
+// and the planes are validated before anything is decoded.
+
+HuffDecodeStatus
+HuffmanColor::decodeColor(
+                          const uint8_t *fileHeader,
+                          int fileHeaderN,
+                          const vector<HuffColorPlane> & planes,
+                          int width,
+                          int height,
+                          uint32_t *outPixels)
+{
+  HuffFileHeader header;
+
+  if (fileHeader == nullptr || outPixels == nullptr || width <= 0 || height <= 0 ||
+      !HuffmanUtil::parseFileHeader(fileHeader, fileHeaderN, header)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int numChannels = header.numChannels;
+
+  if ((numChannels != HUFF_COLOR_RGB && numChannels != HUFF_COLOR_BGRA) || (int) planes.size() != numChannels ||
+      header.numBytes != (uint64_t) width * height * numChannels || header.scanOrder != HUFF_SCAN_RASTER ||
+      header.bitsPerSample != 8 || header.entropyCoder != HUFF_ENTROPY_HUFFMAN || header.blockInitPlane != 0) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockDim = header.blockDim;
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numBlocks = HuffmanUtil::numBlocksForDim(width, blockDim) * HuffmanUtil::numBlocksForDim(height, blockDim);
+
+  vector<vector<uint8_t> > decodedPlanes(planes.size());
+  vector<uint8_t> residuals(numBlocks * blockNumSymbols);
+
+  for ( int planei = 0; planei < (int) planes.size(); planei++ ) {
+    const HuffColorPlane & plane = planes[planei];
+
+    if ((int) plane.canonHeaders.size() > header.numTables) {
+      return HUFF_DECODE_ERROR_TABLE;
+    }
+
+    if ((int) plane.blockBitOffsets.size() != numBlocks || (int) plane.blockTableIds.size() != numBlocks ||
+        (int) plane.blockPredictors.size() != numBlocks) {
+      return HUFF_DECODE_ERROR_ARGUMENTS;
+    }
+
+    // Every block uses the header predictor unless it is adaptive
+
+    for ( uint8_t blockPredictor : plane.blockPredictors ) {
+      if (blockPredictor >= HUFF_PREDICTOR_NUM ||
+          (header.predictor != HUFF_PREDICTOR_ADAPTIVE && blockPredictor != header.predictor)) {
+        return HUFF_DECODE_ERROR_ARGUMENTS;
+      }
+    }
+
+    HuffDecodeStatus status = HuffmanUtil::decodeHuffmanBlocksChecked(plane.canonHeaders,
+                                                                      numBlocks,
+                                                                      blockDim,
+                                                                      plane.huffCodes.data(),
+                                                                      (int) plane.huffCodes.size(),
+                                                                      plane.blockBitOffsets.data(),
+                                                                      plane.blockTableIds.data(),
+                                                                      residuals.data(),
+                                                                      (int) residuals.size());
+
+    if (status != HUFF_DECODE_OK) {
+      return status;
+    }
+
+    decodedPlanes[planei].resize(residuals.size());
+
+    HuffmanUtil::decodePredictedBlocks(residuals.data(), decodedPlanes[planei].data(), numBlocks, blockDim, plane.blockPredictors.data());
+  }
+
+  interleavePlanesToBGRA(decodedPlanes, width, height, blockDim, outPixels);
+
+  return HUFF_DECODE_OK;
+}
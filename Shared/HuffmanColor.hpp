@@ -0,0 +1,101 @@
+//
+//  HuffmanColor.hpp
+//
+//  MIT Licensed
+//
+// Color image support for the huffman block encoder. RGB or BGRA
+// pixels are decorrelated with the lossless YCoCg-R transform and
+// then split into planes of NxN blocks. Each plane is encoded with
+// its own huffman tables and block bit offsets.
+
+#ifndef HuffmanColor_hpp
+#define HuffmanColor_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+// Pixel layout of the color input. HUFF_COLOR_RGB is 3 bytes
+// per pixel and HUFF_COLOR_BGRA is 4 bytes per pixel with
+// the alpha channel encoded as a 4th plane.
+
+typedef enum {
+  HUFF_COLOR_RGB = 3,
+  HUFF_COLOR_BGRA = 4,
+} HuffColorFormat;
+
+// The encoded output for one plane
+
+typedef struct {
+  vector<vector<uint8_t> > canonHeaders;
+  vector<uint8_t> huffCodes;
+  vector<uint32_t> blockBitOffsets;
+  vector<uint8_t> blockTableIds;
+  vector<uint8_t> blockPredictors;
+} HuffColorPlane;
+
+class HuffmanColor {
+
+public:
+
+  // Convert pixels to YCoCg-R and write each channel as a plane
+  // of block ordered values. Blocks along the right and bottom
+  // edges are zero padded. Planes are Y, Co, Cg and then A.
+
+  static void
+  splitIntoPlanes(
+                  const uint8_t *pixels,
+                  int width,
+                  int height,
+                  HuffColorFormat format,
+                  int blockDim,
+                  vector<vector<uint8_t> > & outPlanes);
+
+  // Interleave block ordered planes back to BGRA8 pixels while
+  // inverting the YCoCg-R transform. When there is no alpha
+  // plane the alpha channel is set to 0xFF.
+
+  static void
+  interleavePlanesToBGRA(
+                         const vector<vector<uint8_t> > & planes,
+                         int width,
+                         int height,
+                         int blockDim,
+                         uint32_t *outPixels);
+
+  // Encode color pixels, one HuffColorPlane is generated for each
+  // channel. At most 255 tables are used for each plane and the file
+  // header records the largest number of tables used by a plane.
+
+  static void
+  encodeColor(
+              const uint8_t *pixels,
+              int width,
+              int height,
+              HuffColorFormat format,
+              int blockDim,
+              HuffPredictor predictor,
+              int maxNumTables,
+              vector<uint8_t> & outFileHeader,
+              vector<HuffColorPlane> & outPlanes);
+
+  // Decode planes generated by encodeColor to BGRA8 pixels. The file
+  // header is parsed for the block dimension and number of channels,
+  // the input is treated as untrusted in the same way as
+  // decodeHuffmanBlocksChecked.
+
+  static HuffDecodeStatus
+  decodeColor(
+              const uint8_t *fileHeader,
+              int fileHeaderN,
+              const vector<HuffColorPlane> & planes,
+              int width,
+              int height,
+              uint32_t *outPixels);
+
+};
+
+#endif // HuffmanColor_hpp
@@ -0,0 +1,356 @@
+// C++ impl of a shared table dictionary for small tiles
+//  MIT Licensed
+
+#include "HuffmanDictionary.hpp"
+
+#include "huff_util.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <assert.h>
+
+using namespace std;
+
+// Symbol histogram of a span of bytes
+
+static inline
+void
+histogramForBytes(const uint8_t *inBytes, int inNumBytes, uint32_t *outFrequencies)
+{
+  memset(outFrequencies, 0, 256 * sizeof(uint32_t));
+  
+  for ( int i = 0; i < inNumBytes; i++ ) {
+    outFrequencies[inBytes[i]] += 1;
+  }
+}
+
+// Number of bits needed to encode a histogram with a canonical table
+
+static inline
+uint64_t
+numBitsForHistogram(const uint32_t *frequencies, const vector<uint8_t> & table)
+{
+  uint64_t numBits = 0;
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    numBits += (uint64_t) frequencies[symbol] * table[symbol];
+  }
+  
+  return numBits;
+}
+
+// Generate a table where every symbol has a code, each count is
+// incremented so that symbols not seen in training get a long code.
+
+static
+vector<uint8_t>
+generateCompleteTable(const uint32_t *frequencies)
+{
+  uint32_t smoothed[256];
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    smoothed[symbol] = frequencies[symbol] + 1;
+  }
+  
+  vector<uint8_t> table(256);
+  huff_build_limited_code_widths(smoothed, table.data());
+  return table;
+}
+
+// Cluster the training tiles and generate one table per cluster
+
+void
+HuffmanDictionary::buildDictionary(
+                                   const vector<vector<uint8_t> > & trainingTiles,
+                                   int maxNumTables,
+                                   HuffDictionary & outDictionary)
+{
+  const int debugOut = 0;
+  
+  // Max number of refinement passes over the tile assignments
+  const int maxNumIterations = 8;
+  
+  assert(maxNumTables >= 1 && maxNumTables <= HUFF_DICTIONARY_MAX_NUM_TABLES);
+  
+  const int numTiles = (int) trainingTiles.size();
+  
+  vector<vector<uint32_t> > tileFrequencies(numTiles, vector<uint32_t>(256));
+  vector<uint32_t> globalFrequencies(256);
+  
+  for ( int tilei = 0; tilei < numTiles; tilei++ ) {
+    const vector<uint8_t> & tile = trainingTiles[tilei];
+    histogramForBytes(tile.data(), (int) tile.size(), tileFrequencies[tilei].data());
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      globalFrequencies[symbol] += tileFrequencies[tilei][symbol];
+    }
+  }
+  
+  vector<vector<uint8_t> > tables;
+  tables.push_back(generateCompleteTable(globalFrequencies.data()));
+  
+  int numTables = min(maxNumTables, numTiles);
+  
+  if (numTables > 1) {
+    // Seed clusters by sorting tiles on the number of bits per symbol
+    // with the global table and splitting into equal size groups.
+    
+    vector<double> tileBitsPerSymbol(numTiles);
+    vector<int> sortedTiles(numTiles);
+    
+    for ( int tilei = 0; tilei < numTiles; tilei++ ) {
+      const int tileNumBytes = max(1, (int) trainingTiles[tilei].size());
+      tileBitsPerSymbol[tilei] = (double) numBitsForHistogram(tileFrequencies[tilei].data(), tables[0]) / tileNumBytes;
+      sortedTiles[tilei] = tilei;
+    }
+    
+    stable_sort(begin(sortedTiles), end(sortedTiles),
+                [&tileBitsPerSymbol](int t1, int t2) -> bool {
+                  return tileBitsPerSymbol[t1] < tileBitsPerSymbol[t2];
+                });
+    
+    vector<int> tileTableIds(numTiles);
+    
+    for ( int i = 0; i < numTiles; i++ ) {
+      tileTableIds[sortedTiles[i]] = (int) (((int64_t)i * numTables) / numTiles);
+    }
+    
+    for ( int iteration = 0; iteration < maxNumIterations; iteration++ ) {
+      // Generate a table for each cluster, empty clusters are dropped
+      
+      vector<vector<uint32_t> > clusterFrequencies(numTables, vector<uint32_t>(256));
+      vector<int> clusterNumTiles(numTables);
+      
+      for ( int tilei = 0; tilei < numTiles; tilei++ ) {
+        vector<uint32_t> & freq = clusterFrequencies[tileTableIds[tilei]];
+        for ( int symbol = 0; symbol < 256; symbol++ ) {
+          freq[symbol] += tileFrequencies[tilei][symbol];
+        }
+        clusterNumTiles[tileTableIds[tilei]] += 1;
+      }
+      
+      vector<int> tableIdRemap(numTables, -1);
+      tables.clear();
+      
+      for ( int tablei = 0; tablei < numTables; tablei++ ) {
+        if (clusterNumTiles[tablei] > 0) {
+          tableIdRemap[tablei] = (int) tables.size();
+          tables.push_back(generateCompleteTable(clusterFrequencies[tablei].data()));
+        }
+      }
+      
+      numTables = (int) tables.size();
+      
+      for ( int tilei = 0; tilei < numTiles; tilei++ ) {
+        tileTableIds[tilei] = tableIdRemap[tileTableIds[tilei]];
+      }
+      
+      if (iteration == (maxNumIterations - 1)) {
+        break;
+      }
+      
+      // Reassign each tile to the table that encodes it with the fewest bits
+      
+      int numChanged = 0;
+      
+      for ( int tilei = 0; tilei < numTiles; tilei++ ) {
+        int bestTableId = tileTableIds[tilei];
+        uint64_t bestNumBits = numBitsForHistogram(tileFrequencies[tilei].data(), tables[bestTableId]);
+        
+        for ( int tablei = 0; tablei < numTables; tablei++ ) {
+          uint64_t numBits = numBitsForHistogram(tileFrequencies[tilei].data(), tables[tablei]);
+          if (numBits < bestNumBits) {
+            bestNumBits = numBits;
+            bestTableId = tablei;
+          }
+        }
+        
+        if (bestTableId != tileTableIds[tilei]) {
+          tileTableIds[tilei] = bestTableId;
+          numChanged += 1;
+        }
+      }
+      
+      if (debugOut) {
+        printf("iteration %d : %d tables : %d tiles changed table\n", iteration, numTables, numChanged);
+      }
+      
+      if (numChanged == 0) {
+        break;
+      }
+    }
+  }
+  
+  outDictionary.canonHeaders = std::move(tables);
+  
+  bool worked = prepareLookupTables(outDictionary);
+  assert(worked);
+}
+
+// Write the file header and then each canonical header
+
+void
+HuffmanDictionary::generateDictionaryBytes(
+                                           const HuffDictionary & dictionary,
+                                           vector<uint8_t> & outBytes)
+{
+  const int numTables = (int) dictionary.canonHeaders.size();
+  
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, numTables * 256);
+  header.numTables = (uint8_t) numTables;
+  HuffmanUtil::generateFileHeader(header, outBytes);
+  
+  for ( const vector<uint8_t> & canonHeader : dictionary.canonHeaders ) {
+    outBytes.insert(outBytes.end(), canonHeader.begin(), canonHeader.end());
+  }
+}
+
+// Parse a dictionary and generate the lookup tables
+
+bool
+HuffmanDictionary::parseDictionaryBytes(
+                                        const uint8_t *bytes,
+                                        int numBytes,
+                                        HuffDictionary & outDictionary)
+{
+  // The dictionary is always written with the settings count byte
+  
+  HuffFileHeader header;
+  
+  if (numBytes < 9 || !HuffmanUtil::parseFileHeader(bytes, numBytes, header)) {
+    return false;
+  }
+  
+  const int headerNumBytes = 9 + bytes[8];
+  const int numTables = header.numTables;
+  
+  if (numTables > HUFF_DICTIONARY_MAX_NUM_TABLES ||
+      header.numBytes != (uint32_t) (numTables * 256) ||
+      (headerNumBytes + (numTables * 256)) > numBytes) {
+    return false;
+  }
+  
+  outDictionary.canonHeaders.resize(numTables);
+  
+  for ( int tablei = 0; tablei < numTables; tablei++ ) {
+    const uint8_t *tablePtr = bytes + headerNumBytes + (tablei * 256);
+    outDictionary.canonHeaders[tablei].assign(tablePtr, tablePtr + 256);
+  }
+  
+  return prepareLookupTables(outDictionary);
+}
+
+// Generate table1 and table2 for each entry without going through
+// the module state used by parseCanonicalHeader.
+
+bool
+HuffmanDictionary::prepareLookupTables(HuffDictionary & dictionary)
+{
+  const int numTables = (int) dictionary.canonHeaders.size();
+  
+  dictionary.table1s.resize(numTables);
+  dictionary.table2s.resize(numTables);
+  
+  for ( int tablei = 0; tablei < numTables; tablei++ ) {
+    HuffDecodeStatus status = HuffmanUtil::generateCheckedLookupTables(dictionary.canonHeaders[tablei].data(),
+                                                                      dictionary.table1s[tablei],
+                                                                      dictionary.table2s[tablei]);
+    if (status != HUFF_DECODE_OK) {
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+// Select the table with the fewest bits for a tile
+
+int
+HuffmanDictionary::selectTable(
+                               const HuffDictionary & dictionary,
+                               const uint8_t *inBytes,
+                               int inNumBytes)
+{
+  uint32_t frequencies[256];
+  histogramForBytes(inBytes, inNumBytes, frequencies);
+  
+  int bestTableId = 0;
+  uint64_t bestNumBits = UINT64_MAX;
+  
+  for ( int tablei = 0; tablei < (int) dictionary.canonHeaders.size(); tablei++ ) {
+    uint64_t numBits = numBitsForHistogram(frequencies, dictionary.canonHeaders[tablei]);
+    if (numBits < bestNumBits) {
+      bestNumBits = numBits;
+      bestTableId = tablei;
+    }
+  }
+  
+  return bestTableId;
+}
+
+// Encode a tile with the best table from the dictionary
+
+int
+HuffmanDictionary::encodeTile(
+                              const HuffDictionary & dictionary,
+                              const uint8_t *inBytes,
+                              int inNumBytes,
+                              int blockDim,
+                              vector<uint8_t> & outHuffCodes,
+                              vector<uint32_t> & outBlockBitOffsets)
+{
+  const int tableId = selectTable(dictionary, inBytes, inNumBytes);
+  const vector<uint8_t> & canonHeader = dictionary.canonHeaders[tableId];
+  
+  uint32_t frequencies[256];
+  histogramForBytes(inBytes, inNumBytes, frequencies);
+  
+  const uint64_t numCodeBits = numBitsForHistogram(frequencies, canonHeader);
+  
+  outHuffCodes.resize(((numCodeBits + 7) / 8) + 2);
+  outBlockBitOffsets.resize(inNumBytes / (blockDim * blockDim));
+  
+  vector<uint8_t> fileHeader;
+  
+  bool worked = HuffmanUtil::encodeHuffmanToBuffers(inBytes,
+                                                    inNumBytes,
+                                                    blockDim,
+                                                    canonHeader.data(),
+                                                    outHuffCodes.data(),
+                                                    (int) outHuffCodes.size(),
+                                                    outBlockBitOffsets.data(),
+                                                    (int) outBlockBitOffsets.size(),
+                                                    fileHeader);
+  assert(worked);
+  
+  return tableId;
+}
+
+// Decode a tile with prepared lookup tables
+
+void
+HuffmanDictionary::decodeTile(
+                              const HuffDictionary & dictionary,
+                              int tableId,
+                              int numBlocks,
+                              int blockDim,
+                              const uint8_t *huffCodes,
+                              const uint32_t *blockBitOffsets,
+                              uint8_t *outBuffer)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const HuffLookupSymbol *huffSymbolTable1 = dictionary.table1s[tableId].data();
+  const HuffLookupSymbol *huffSymbolTable2 = dictionary.table2s[tableId].data();
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    HuffmanUtil::decodeHuffmanSymbolsAtBitOffset(huffSymbolTable1,
+                                                 huffSymbolTable2,
+                                                 huffCodes,
+                                                 blockBitOffsets[blocki],
+                                                 outBuffer + (blocki * blockNumSymbols),
+                                                 blockNumSymbols);
+  }
+}
@@ -0,0 +1,110 @@
+//
+//  HuffmanDictionary.hpp
+//
+//  MIT Licensed
+//
+// Shared table dictionary for encoding many small tiles. A tileset
+// stores N canonical tables once and each tile refers to one of them
+// with a 1 byte table id instead of carrying its own 256 byte canonical
+// header and file header. The decoder generates the lookup tables for
+// each dictionary entry once and reuses them for every tile.
+//
+// Every symbol has a code in a dictionary table, so a tile can contain
+// symbols that were not seen when the dictionary was built.
+
+#ifndef HuffmanDictionary_hpp
+#define HuffmanDictionary_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+// Max number of tables in a dictionary, a table id is stored in a byte
+
+#define HUFF_DICTIONARY_MAX_NUM_TABLES 255
+
+typedef struct {
+  vector<vector<uint8_t> > canonHeaders;
+  
+  // Lookup tables for each entry, generated by prepareLookupTables()
+  
+  vector<vector<HuffLookupSymbol> > table1s;
+  vector<vector<HuffLookupSymbol> > table2s;
+} HuffDictionary;
+
+class HuffmanDictionary {
+
+public:
+
+  // Build a dictionary of at most maxNumTables tables from a set of
+  // training tiles. Tiles are clustered by symbol statistics and one
+  // table is generated for each cluster.
+  
+  static void
+  buildDictionary(
+                  const vector<vector<uint8_t> > & trainingTiles,
+                  int maxNumTables,
+                  HuffDictionary & outDictionary);
+  
+  // Write the dictionary as a file header followed by the canonical
+  // headers, the header numTables field holds the number of tables.
+  
+  static void
+  generateDictionaryBytes(
+                          const HuffDictionary & dictionary,
+                          vector<uint8_t> & outBytes);
+  
+  // Parse dictionary bytes and generate the lookup tables. Returns
+  // false when the bytes are not a valid dictionary.
+  
+  static bool
+  parseDictionaryBytes(
+                       const uint8_t *bytes,
+                       int numBytes,
+                       HuffDictionary & outDictionary);
+  
+  // Generate lookup tables for every entry, returns false when a
+  // canonical header is not valid.
+  
+  static bool
+  prepareLookupTables(HuffDictionary & dictionary);
+  
+  // Return the id of the table that encodes inBytes with the fewest bits
+  
+  static int
+  selectTable(
+              const HuffDictionary & dictionary,
+              const uint8_t *inBytes,
+              int inNumBytes);
+  
+  // Encode one tile of block ordered symbols with the best table and
+  // return the table id. outHuffCodes includes the +2 bytes of read
+  // ahead padding and there is one bit offset for each block.
+  
+  static int
+  encodeTile(
+             const HuffDictionary & dictionary,
+             const uint8_t *inBytes,
+             int inNumBytes,
+             int blockDim,
+             vector<uint8_t> & outHuffCodes,
+             vector<uint32_t> & outBlockBitOffsets);
+  
+  // Decode one tile with the prepared lookup tables of tableId
+  
+  static void
+  decodeTile(
+             const HuffDictionary & dictionary,
+             int tableId,
+             int numBlocks,
+             int blockDim,
+             const uint8_t *huffCodes,
+             const uint32_t *blockBitOffsets,
+             uint8_t *outBuffer);
+
+};
+
+#endif // HuffmanDictionary_hpp
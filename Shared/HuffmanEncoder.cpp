@@ -7,6 +7,7 @@
 #include "HuffmanEncoder.hpp"
 
 #include "huff_util.hpp"
+#include "HuffmanTrace.hpp"
 
 const static int MAX_NUM_SYMBOLS = 256;
 
@@ -27,6 +28,8 @@ HuffmanEncoder::HuffmanEncoder() {
 
 void
 HuffmanEncoder::determine_frequency(const vector<uint8_t> & bytes) {
+  const int debugOut = 0;
+  
   for (uint8_t b : bytes) {
     frequency[b] += 1;
   }
@@ -35,19 +38,15 @@ HuffmanEncoder::determine_frequency(const vector<uint8_t> & bytes) {
   for (int c = 0; c < MAX_NUM_SYMBOLS; c++) {
     if (frequency[c] > 0) {
       numActiveSymbols += 1;
-//#if defined(DEBUG)
-      if ((1)) {
-      printf("frequency[%3d] = %8d\n", c, frequency[c]);
+      if (debugOut) {
+        printf("frequency[%3d] = %8d\n", c, frequency[c]);
       }
-//#endif // DEBUG
     }
   }
   
-//#if defined(DEBUG)
-  if ((1)) {
-      printf("numActiveSymbols = %d\n", numActiveSymbols);
+  if (debugOut) {
+    printf("numActiveSymbols = %d\n", numActiveSymbols);
   }
-//#endif // DEBUG
 }
 
 void
@@ -313,13 +312,24 @@ HuffmanEncoder::encode(const vector<uint8_t> & bytes,
                        vector<uint8_t> & canonicalTableBytes,
                        vector<uint8_t> & huffmanCodeBytes)
 {
-  determine_frequency(bytes);
-  stack.resize(numActiveSymbols - 1);
-  allocate_tree();
+  {
+    HUFF_TRACE_SPAN("histogram");
+    determine_frequency(bytes);
+  }
+  
+  {
+    HUFF_TRACE_SPAN("tree build");
+    stack.resize(numActiveSymbols - 1);
+    allocate_tree();
+    
+    add_leaves();
+    build_tree();
+  }
   
-  add_leaves();
-  build_tree();
-  create_canonical_codes_from_tree();
+  {
+    HUFF_TRACE_SPAN("canonical codes");
+    create_canonical_codes_from_tree();
+  }
   
   // Write known bit pattern and original number of bytes as header
 
@@ -350,6 +360,8 @@ HuffmanEncoder::encode(const vector<uint8_t> & bytes,
   
   // Write to huffmanCodeBytes
   
+  HUFF_TRACE_SPAN("bit writing");
+  
   huffmanCodeBytes.clear();
   huffmanCodeBytes.reserve(bytes.size());
   
@@ -393,4 +405,3 @@ HuffmanEncoder::lookupBufferBitOffsets(const vector<uint32_t> & offsets)
   
   return bitOffsets;
 }
-
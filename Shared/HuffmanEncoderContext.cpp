@@ -0,0 +1,216 @@
+// C++ impl of a reusable arena backed huffman encoder
+//  MIT Licensed
+
+#include "HuffmanEncoderContext.hpp"
+
+#include "huff_util.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <assert.h>
+
+using namespace std;
+
+// Arena allocations are aligned to 16 bytes
+
+#define HUFF_ARENA_ALIGNMENT 16
+
+// Fixed size scratch memory, stored at the start of the arena
+
+typedef struct {
+  uint32_t frequency[256];
+  uint16_t codes[256];
+} HuffEncoderContextScratch;
+
+static inline
+uint32_t
+alignArenaSize(uint32_t numBytes)
+{
+  return ((numBytes + HUFF_ARENA_ALIGNMENT - 1) / HUFF_ARENA_ALIGNMENT) * HUFF_ARENA_ALIGNMENT;
+}
+
+HuffmanEncoderContext::HuffmanEncoderContext()
+{
+  scratchNumBytes = alignArenaSize(sizeof(HuffEncoderContextScratch));
+  arena.resize(scratchNumBytes);
+  arenaUsed = scratchNumBytes;
+  numArenaGrows = 0;
+}
+
+// Rewind to just after the scratch memory
+
+void
+HuffmanEncoderContext::reset()
+{
+  arenaUsed = scratchNumBytes;
+  outputs.clear();
+}
+
+// Allocate from the arena and return the offset, the arena is only
+// resized when the allocation does not fit in the current memory.
+
+uint32_t
+HuffmanEncoderContext::arenaAlloc(uint32_t numBytes)
+{
+  const uint32_t offset = arenaUsed;
+  const uint32_t newUsed = offset + alignArenaSize(numBytes);
+  
+  if (newUsed > arena.size()) {
+    size_t newSize = arena.size() * 2;
+    if (newSize < newUsed) {
+      newSize = newUsed;
+    }
+    arena.resize(newSize);
+    numArenaGrows += 1;
+  }
+  
+  arenaUsed = newUsed;
+  return offset;
+}
+
+// Build the canonical table for the symbol frequencies in the scratch
+// memory. When a code would be longer than 16 bits the frequencies are
+// scaled down and the tree is built again, as in HuffmanUtil.
+
+void
+HuffmanEncoderContext::buildCanonicalTable(uint8_t *outCanonHeader)
+{
+  const HuffEncoderContextScratch *scratch = (const HuffEncoderContextScratch *) arena.data();
+  huff_build_limited_code_widths(scratch->frequency, outCanonHeader);
+}
+
+// Encode into the arena, the arena is grown at most once for each
+// allocation and only when a frame is larger than any previous frame.
+
+int
+HuffmanEncoderContext::encode(const uint8_t *inBytes,
+                              int inNumBytes,
+                              int blockDim)
+{
+#if defined(DEBUG)
+  assert(inNumBytes > 0);
+#endif // DEBUG
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  HuffEncoderContextOutput output;
+  output.canonHeaderOffset = arenaAlloc(256);
+  
+  {
+    HUFF_TRACE_SPAN("histogram");
+    
+    HuffEncoderContextScratch *scratch = (HuffEncoderContextScratch *) arena.data();
+    
+    memset(scratch->frequency, 0, sizeof(scratch->frequency));
+    
+    for ( int i = 0; i < inNumBytes; i++ ) {
+      scratch->frequency[inBytes[i]] += 1;
+    }
+  }
+  
+  {
+    HUFF_TRACE_SPAN("tree build");
+    buildCanonicalTable(arena.data() + output.canonHeaderOffset);
+  }
+  
+  uint64_t numCodeBits = 0;
+  
+  {
+    HUFF_TRACE_SPAN("canonical codes");
+    
+    HuffEncoderContextScratch *scratch = (HuffEncoderContextScratch *) arena.data();
+    const uint8_t *canonHeader = arena.data() + output.canonHeaderOffset;
+    
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      numCodeBits += (uint64_t) scratch->frequency[symbol] * canonHeader[symbol];
+    }
+    
+    huff_generate_canonical_codes_in_place(canonHeader, scratch->codes);
+  }
+  
+  output.numHuffCodeBytes = (uint32_t) ((numCodeBits + 7) / 8) + 2;
+  output.numBlocks = inNumBytes / blockNumSymbols;
+  output.huffCodesOffset = arenaAlloc(output.numHuffCodeBytes);
+  output.blockBitOffsetsOffset = arenaAlloc(output.numBlocks * sizeof(uint32_t));
+  
+  // The arena does not move after the last allocation
+  
+  const HuffEncoderContextScratch *scratch = (const HuffEncoderContextScratch *) arena.data();
+  const uint8_t *canonHeader = arena.data() + output.canonHeaderOffset;
+  uint8_t *huffCodesPtr = arena.data() + output.huffCodesOffset;
+  uint32_t *blockBitOffsetsPtr = (uint32_t *) (arena.data() + output.blockBitOffsetsOffset);
+  
+  HUFF_TRACE_SPAN("bit writing");
+  
+  memset(huffCodesPtr, 0, output.numHuffCodeBytes);
+  
+  uint32_t bitOffset = 0;
+  
+  for ( int offset = 0; offset < inNumBytes; offset += blockNumSymbols ) {
+    const int numSymbols = min(blockNumSymbols, inNumBytes - offset);
+    
+    if (numSymbols == blockNumSymbols) {
+      blockBitOffsetsPtr[offset / blockNumSymbols] = bitOffset;
+    }
+    
+    for ( int i = 0; i < numSymbols; i++ ) {
+      const uint8_t symbol = inBytes[offset + i];
+      const int bitWidth = canonHeader[symbol];
+      huff_write_code_bits(huffCodesPtr, bitOffset, scratch->codes[symbol], bitWidth);
+      bitOffset += bitWidth;
+    }
+  }
+  
+#if defined(DEBUG)
+  assert(bitOffset == numCodeBits);
+#endif // DEBUG
+  
+  outputs.push_back(output);
+  return (int) outputs.size() - 1;
+}
+
+const uint8_t *
+HuffmanEncoderContext::canonHeader(int outputi) const
+{
+  return arena.data() + outputs[outputi].canonHeaderOffset;
+}
+
+const uint8_t *
+HuffmanEncoderContext::huffCodes(int outputi) const
+{
+  return arena.data() + outputs[outputi].huffCodesOffset;
+}
+
+int
+HuffmanEncoderContext::numHuffCodeBytes(int outputi) const
+{
+  return (int) outputs[outputi].numHuffCodeBytes;
+}
+
+const uint32_t *
+HuffmanEncoderContext::blockBitOffsets(int outputi) const
+{
+  return (const uint32_t *) (arena.data() + outputs[outputi].blockBitOffsetsOffset);
+}
+
+int
+HuffmanEncoderContext::numBlocks(int outputi) const
+{
+  return (int) outputs[outputi].numBlocks;
+}
+
+size_t
+HuffmanEncoderContext::arenaCapacity() const
+{
+  return arena.size();
+}
+
+int
+HuffmanEncoderContext::arenaGrowCount() const
+{
+  return numArenaGrows;
+}
@@ -0,0 +1,94 @@
+//
+//  HuffmanEncoderContext.hpp
+//
+//  MIT Licensed
+//
+// Reusable huffman encoder for encoding a sequence of frames. The symbol
+// histogram, the canonical codes, the block bit offsets and the huffman
+// codes are carved out of one arena and the tree is built in fixed size
+// arrays on the stack by huff_build_code_widths(). Calling
+// reset() rewinds the arena but keeps the memory, so once the arena has
+// grown to hold the largest frame, encoding a frame does not allocate.
+//
+// The output is identical to HuffmanUtil::encodeHuffman().
+
+#ifndef HuffmanEncoderContext_hpp
+#define HuffmanEncoderContext_hpp
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Arena offsets of the output of one encode() call
+
+typedef struct {
+  uint32_t canonHeaderOffset;
+  uint32_t huffCodesOffset;
+  uint32_t numHuffCodeBytes;
+  uint32_t blockBitOffsetsOffset;
+  uint32_t numBlocks;
+} HuffEncoderContextOutput;
+
+class HuffmanEncoderContext
+{
+private:
+  vector<uint8_t> arena;
+  
+  // Arena offset of the first byte after the scratch memory and
+  // the offset where the next allocation begins.
+  
+  uint32_t scratchNumBytes;
+  uint32_t arenaUsed;
+  
+  // Number of times the arena had to be grown
+  
+  int numArenaGrows;
+  
+  vector<HuffEncoderContextOutput> outputs;
+  
+  uint32_t arenaAlloc(uint32_t numBytes);
+  
+  void buildCanonicalTable(uint8_t *outCanonHeader);
+  
+public:
+  
+  HuffmanEncoderContext();
+  
+  // Rewind the arena, the output of every encode() call since the last
+  // reset() is discarded. The arena memory is not released.
+  
+  void reset();
+  
+  // Encode inBytes into the arena and return the index of the output.
+  // Every full (blockDim x blockDim) block gets a bit offset. encode()
+  // can be called for each plane of a frame before reset() is called.
+  
+  int encode(const uint8_t *inBytes,
+             int inNumBytes,
+             int blockDim);
+  
+  // Access the output of an encode() call, the pointers are valid until
+  // the next call to encode() or reset().
+  
+  const uint8_t * canonHeader(int outputi) const;
+  
+  const uint8_t * huffCodes(int outputi) const;
+  
+  // Number of code bytes including the +2 bytes of read ahead padding
+  
+  int numHuffCodeBytes(int outputi) const;
+  
+  const uint32_t * blockBitOffsets(int outputi) const;
+  
+  int numBlocks(int outputi) const;
+  
+  // Size of the arena and the number of times it was grown
+  
+  size_t arenaCapacity() const;
+  
+  int arenaGrowCount() const;
+  
+};
+
+#endif // HuffmanEncoderContext_hpp
@@ -0,0 +1,632 @@
+// C++ reference emulator of the GPU huffman decode passes
+//  MIT Licensed
+
+#include "HuffmanGPUEmulator.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <functional>
+#include <mutex>
+
+#include <assert.h>
+
+using namespace std;
+
+// Convert a double to the nearest half float, ties round to even.
+// Converting from double means that a float result computed with
+// more precision than a half is rounded only once.
+
+static
+uint16_t
+halfFromDouble(double d)
+{
+  if (std::isnan(d)) {
+    return 0x7E00;
+  }
+
+  uint16_t sign = std::signbit(d) ? 0x8000 : 0;
+  double a = fabs(d);
+
+  // 65520 is the smallest value that rounds up to infinity
+
+  if (a >= 65520.0) {
+    return sign | 0x7C00;
+  }
+
+  if (a == 0.0) {
+    return sign;
+  }
+
+  int e;
+  frexp(a, &e);
+  int exponent = e - 1;
+
+  if (exponent < -14) {
+    // Subnormal values are a multiple of 2^-24, a rounded value of
+    // 1024 becomes the smallest normal value.
+    uint16_t mantissa = (uint16_t) nearbyint(ldexp(a, 24));
+    return sign | mantissa;
+  }
+
+  int mantissa = (int) nearbyint(ldexp(a, 10 - exponent));
+
+  if (mantissa == 2048) {
+    mantissa = 1024;
+    exponent += 1;
+    if (exponent > 15) {
+      return sign | 0x7C00;
+    }
+  }
+
+  return sign | (uint16_t) ((exponent + 15) << 10) | (uint16_t) (mantissa - 1024);
+}
+
+// IEEE 754 half float conversion with round to nearest even
+
+uint16_t
+HuffmanGPUEmulator::halfFromFloat(float f)
+{
+  return halfFromDouble(f);
+}
+
+float
+HuffmanGPUEmulator::floatFromHalf(uint16_t h)
+{
+  const int sign = (h & 0x8000) ? -1 : 1;
+  const int exponent = (h >> 10) & 0x1F;
+  const int mantissa = h & 0x3FF;
+
+  if (exponent == 0x1F) {
+    return (mantissa == 0) ? (sign * INFINITY) : NAN;
+  } else if (exponent == 0) {
+    return sign * ldexpf((float) mantissa, -24);
+  } else {
+    return sign * ldexpf((float) (mantissa | 0x400), exponent - 25);
+  }
+}
+
+// Half precision multiply, the float product of two half values is exact
+
+static inline
+uint16_t
+halfMul(uint16_t h1, uint16_t h2)
+{
+  return halfFromDouble((double) HuffmanGPUEmulator::floatFromHalf(h1) * HuffmanGPUEmulator::floatFromHalf(h2));
+}
+
+// Half precision divide
+
+static inline
+uint16_t
+halfDiv(uint16_t h1, uint16_t h2)
+{
+  return halfFromDouble((double) HuffmanGPUEmulator::floatFromHalf(h1) / HuffmanGPUEmulator::floatFromHalf(h2));
+}
+
+// Store a half value into a BGRA8Unorm render target component
+
+uint8_t
+HuffmanGPUEmulator::unormByteFromHalf(uint16_t h)
+{
+  float f = floatFromHalf(h);
+
+  if (!(f > 0.0f)) {
+    return 0;
+  } else if (f >= 1.0f) {
+    return 0xFF;
+  }
+
+  return (uint8_t) nearbyintf(f * 255.0f);
+}
+
+// Read a BGRA8Unorm texture component as a half value
+
+uint16_t
+HuffmanGPUEmulator::halfFromUnormByte(uint8_t b)
+{
+  return halfFromDouble(b / 255.0);
+}
+
+// Conversion tables generated once from the reference conversions above,
+// the per pixel logic only ever converts byte values and the half values
+// generated from byte values.
+
+typedef struct {
+  uint16_t halfFromUnormByte[256];
+  uint16_t halfNormFromUshort[256];
+  uint16_t ushortFromHalf[0x10000];
+  uint8_t unormByteFromHalf[0x10000];
+} HuffGPUEmulatorTables;
+
+static
+const HuffGPUEmulatorTables &
+conversionTables()
+{
+  static HuffGPUEmulatorTables *tables = nullptr;
+  static once_flag tablesOnce;
+
+  call_once(tablesOnce, []() {
+    tables = new HuffGPUEmulatorTables();
+
+    const uint16_t h255 = HuffmanGPUEmulator::halfFromFloat(255.0f);
+
+    for ( int b = 0; b < 256; b++ ) {
+      tables->halfFromUnormByte[b] = HuffmanGPUEmulator::halfFromUnormByte(b);
+      // Shader logic is (value / 255.0h)
+      tables->halfNormFromUshort[b] = halfDiv(HuffmanGPUEmulator::halfFromFloat(b), h255);
+    }
+
+    for ( int h = 0; h < 0x10000; h++ ) {
+      // Shader logic is round(inHalf * 255.0h)
+      float f = roundf(HuffmanGPUEmulator::floatFromHalf(halfMul(h, h255)));
+      tables->ushortFromHalf[h] = (f > 0.0f && f < 65536.0f) ? (uint16_t) f : 0;
+      tables->unormByteFromHalf[h] = HuffmanGPUEmulator::unormByteFromHalf(h);
+    }
+  });
+
+  return *tables;
+}
+
+// Emulate the shader ushort_from_half() logic, round(inHalf * 255.0h)
+
+static inline
+uint16_t
+ushortFromHalf(uint16_t h)
+{
+  return conversionTables().ushortFromHalf[h];
+}
+
+// Emulate the shader (value / 255.0h) logic for a byte value
+
+static inline
+uint16_t
+halfNormFromUshort(uint16_t value)
+{
+#if defined(DEBUG)
+  assert(value < 256);
+#endif // DEBUG
+  return conversionTables().halfNormFromUshort[value];
+}
+
+// Read a BGRA8Unorm texture component as a half value
+
+static inline
+uint16_t
+halfFromTextureByte(uint8_t b)
+{
+  return conversionTables().halfFromUnormByte[b];
+}
+
+// Pack 4 half values into a BGRA8Unorm pixel
+
+static inline
+uint32_t
+pixelFromHalf4(uint16_t b, uint16_t g, uint16_t r, uint16_t a)
+{
+  const uint8_t *unormByteFromHalf = conversionTables().unormByteFromHalf;
+  uint32_t B = unormByteFromHalf[b];
+  uint32_t G = unormByteFromHalf[g];
+  uint32_t R = unormByteFromHalf[r];
+  uint32_t A = unormByteFromHalf[a];
+  return (A << 24) | (R << 16) | (G << 8) | B;
+}
+
+// Emulate calc_gid_from_frag_norm_coord() for the fragment at pixel (x, y)
+
+void
+HuffmanGPUEmulator::gidFromFragment(int x, int y, int width, int height, uint16_t & gidX, uint16_t & gidY)
+{
+  // The rasterizer interpolates the texture coordinate to the pixel center
+
+  const float textureSizeX = (float) width;
+  const float textureSizeY = (float) height;
+  float cx = ((float) x + 0.5f) / textureSizeX;
+  float cy = ((float) y + 0.5f) / textureSizeY;
+  const float halfPixelX = (1.0f / textureSizeX) / 2.0f;
+  const float halfPixelY = (1.0f / textureSizeY) / 2.0f;
+  cx -= halfPixelX;
+  cy -= halfPixelY;
+  gidX = (uint16_t) roundf(cx * textureSizeX);
+  gidY = (uint16_t) roundf(cy * textureSizeY);
+}
+
+// Invoke func for ranges of rows, each range is processed on its own thread
+
+static
+void
+parallelForRows(int numRows,
+                int numThreads,
+                const function<void(int rowStart, int rowEnd)> & func)
+{
+  if (numThreads > numRows) {
+    numThreads = numRows;
+  }
+
+  if (numThreads <= 1) {
+    func(0, numRows);
+    return;
+  }
+
+  vector<thread> threads;
+  threads.reserve(numThreads);
+
+  for ( int threadi = 0; threadi < numThreads; threadi++ ) {
+    int rowStart = (int) (((int64_t) numRows * threadi) / numThreads);
+    int rowEnd = (int) (((int64_t) numRows * (threadi + 1)) / numThreads);
+    threads.push_back(thread(func, rowStart, rowEnd));
+  }
+
+  for ( thread & t : threads ) {
+    t.join();
+  }
+}
+
+// Emulate huffDecodeSymbol()
+
+static inline
+HuffLookupSymbol
+huffDecodeSymbol(
+                 const HuffGPUEmulatorInputs & inputs,
+                 const uint32_t currentNumBits)
+{
+  const uint16_t table1BitNum = HUFF_TABLE1_NUM_BITS;
+  const uint16_t table2BitNum = HUFF_TABLE2_NUM_BITS;
+  const uint16_t numBitsInByte = 8;
+  int numBytesRead = int(currentNumBits / numBitsInByte);
+  uint16_t numBitsReadMod8 = (currentNumBits % numBitsInByte);
+
+  const uint8_t *huffBuff = inputs.huffBuff;
+
+  uint16_t inputBitPattern = 0;
+  uint16_t b0 = huffBuff[numBytesRead];
+  uint16_t b1 = huffBuff[numBytesRead+1];
+  uint16_t b2 = huffBuff[numBytesRead+2];
+
+  b0 <<= numBitsReadMod8;
+  b0 &= 0xFF;
+  inputBitPattern = b0 << 8;
+
+  inputBitPattern |= b1 << numBitsReadMod8;
+
+  b2 >>= (8 - numBitsReadMod8);
+  inputBitPattern |= b2;
+
+  uint16_t table1Pattern = inputBitPattern >> (16 - table1BitNum);
+  uint16_t table2Pattern = inputBitPattern & (0xFFFF >> (16 - table2BitNum));
+
+  HuffLookupSymbol hls = inputs.huffSymbolTable1[table1Pattern];
+
+  if (hls.bitWidth == 0) {
+    const uint16_t offset = hls.symbol * HUFF_TABLE2_SIZE;
+    const uint16_t offsetPlusPattern = table2Pattern + offset;
+    hls = inputs.huffSymbolTable2[offsetPlusPattern];
+  }
+
+  return hls;
+}
+
+// Emulate decode_one_huffman_symbol(), returns the half output value
+
+static inline
+uint16_t
+decodeOneHuffmanSymbol(
+                       const HuffGPUEmulatorInputs & inputs,
+                       const uint32_t numBitsReadForBlockRoot,
+                       uint16_t & numBitsRead,
+                       uint16_t & prevSymbol)
+{
+  uint32_t currentNumBits = numBitsReadForBlockRoot + numBitsRead;
+
+  HuffLookupSymbol hls = huffDecodeSymbol(inputs, currentNumBits);
+  numBitsRead += hls.bitWidth;
+
+#if defined(IMPL_DELTAS_BEFORE_HUFF_ENCODING)
+  uint16_t outSymbol = (prevSymbol + hls.symbol) & 0xFF;
+  prevSymbol = outSymbol;
+#else
+  uint16_t outSymbol = hls.symbol;
+#endif // IMPL_DELTAS_BEFORE_HUFF_ENCODING
+
+  return halfNormFromUshort(outSymbol);
+}
+
+// Read the numBitsRead and prevSymbol state for the block at gid and
+// return the block index.
+
+static inline
+int
+readBlockState(
+               const HuffGPUEmulatorInputs & inputs,
+               const uint32_t *inBitsReadTexture,
+               int x,
+               int y,
+               uint16_t & numBitsRead,
+               uint16_t & prevSymbol)
+{
+  const int blockWidth = inputs.rtd.blockWidth;
+  const int blockHeight = inputs.rtd.blockHeight;
+
+  uint16_t gidX, gidY;
+  HuffmanGPUEmulator::gidFromFragment(x, y, blockWidth, blockHeight, gidX, gidY);
+
+  const int blocki = (int(gidY) * blockWidth) + gidX;
+
+  uint32_t bitsRead4 = inBitsReadTexture[blocki];
+
+  uint16_t bitsReadB = ushortFromHalf(halfFromTextureByte(bitsRead4 & 0xFF));
+  uint16_t bitsReadG = ushortFromHalf(halfFromTextureByte((bitsRead4 >> 8) & 0xFF));
+
+  numBitsRead = (bitsReadG << 8) | bitsReadB;
+
+#if defined(IMPL_DELTAS_BEFORE_HUFF_ENCODING)
+  prevSymbol = ushortFromHalf(halfFromTextureByte((bitsRead4 >> 16) & 0xFF));
+#else
+  prevSymbol = 0;
+#endif // IMPL_DELTAS_BEFORE_HUFF_ENCODING
+
+  return blocki;
+}
+
+// Decode 4 symbols and pack into one BGRA pixel in (B, G, R, A) order
+
+static inline
+uint32_t
+decodeFourSymbols(
+                  const HuffGPUEmulatorInputs & inputs,
+                  const uint32_t numBitsReadForBlockRoot,
+                  uint16_t & numBitsRead,
+                  uint16_t & prevSymbol)
+{
+  uint16_t b = decodeOneHuffmanSymbol(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+  uint16_t g = decodeOneHuffmanSymbol(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+  uint16_t r = decodeOneHuffmanSymbol(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+  uint16_t a = decodeOneHuffmanSymbol(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+  return pixelFromHalf4(b, g, r, a);
+}
+
+// Generate the initial state texture
+
+void
+HuffmanGPUEmulator::initStateTexture(
+                                     const HuffGPUEmulatorInputs & inputs,
+                                     const uint8_t *blockInitValues,
+                                     vector<uint32_t> & outStateTexture)
+{
+  const int numBlocks = inputs.rtd.blockWidth * inputs.rtd.blockHeight;
+
+  outStateTexture.resize(numBlocks);
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    uint32_t blockInitVal = (blockInitValues != nullptr) ? blockInitValues[blocki] : 0;
+    outStateTexture[blocki] = (blockInitVal << 16) | (0);
+  }
+}
+
+// Emulate huffFragmentShaderB8W12
+
+void
+HuffmanGPUEmulator::renderPass12(
+                                 const HuffGPUEmulatorInputs & inputs,
+                                 const uint32_t *inBitsReadTexture,
+                                 uint32_t *outC0,
+                                 uint32_t *outC1,
+                                 uint32_t *outC2,
+                                 uint32_t *outNumBitsRead,
+                                 int numThreads)
+{
+  const int blockWidth = inputs.rtd.blockWidth;
+  const int blockHeight = inputs.rtd.blockHeight;
+  const uint16_t halfOne = halfFromFloat(1.0f);
+
+  parallelForRows(blockHeight, numThreads, [&](int rowStart, int rowEnd) {
+    for ( int y = rowStart; y < rowEnd; y++ ) {
+      for ( int x = 0; x < blockWidth; x++ ) {
+        uint16_t numBitsRead;
+        uint16_t prevSymbol;
+        const int blocki = readBlockState(inputs, inBitsReadTexture, x, y, numBitsRead, prevSymbol);
+        const uint32_t numBitsReadForBlockRoot = inputs.blockStartBitOffsets[blocki];
+        const int outOffset = (y * blockWidth) + x;
+
+        outC0[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+        outC1[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+        outC2[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+
+        // Emit 16 bit numBitsRead in BG components
+        // Emit 8 bit prev symbol value in R component
+
+        outNumBitsRead[outOffset] = pixelFromHalf4(halfNormFromUshort(numBitsRead & 0xFF),
+                                                   halfNormFromUshort((numBitsRead >> 8) & 0xFF),
+                                                   halfNormFromUshort(prevSymbol),
+                                                   halfOne);
+      }
+    }
+  });
+}
+
+// Emulate huffFragmentShaderB8W16
+
+void
+HuffmanGPUEmulator::renderPass16(
+                                 const HuffGPUEmulatorInputs & inputs,
+                                 const uint32_t *inBitsReadTexture,
+                                 uint32_t *outC0,
+                                 uint32_t *outC1,
+                                 uint32_t *outC2,
+                                 uint32_t *outC3,
+                                 int numThreads)
+{
+  const int blockWidth = inputs.rtd.blockWidth;
+  const int blockHeight = inputs.rtd.blockHeight;
+
+  parallelForRows(blockHeight, numThreads, [&](int rowStart, int rowEnd) {
+    for ( int y = rowStart; y < rowEnd; y++ ) {
+      for ( int x = 0; x < blockWidth; x++ ) {
+        uint16_t numBitsRead;
+        uint16_t prevSymbol;
+        const int blocki = readBlockState(inputs, inBitsReadTexture, x, y, numBitsRead, prevSymbol);
+        const uint32_t numBitsReadForBlockRoot = inputs.blockStartBitOffsets[blocki];
+        const int outOffset = (y * blockWidth) + x;
+
+        outC0[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+        outC1[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+        outC2[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+        outC3[outOffset] = decodeFourSymbols(inputs, numBitsReadForBlockRoot, numBitsRead, prevSymbol);
+      }
+    }
+  });
+}
+
+// Emulate the blit of 16 slices into the combined slices texture
+
+void
+HuffmanGPUEmulator::blitSlices(
+                               const HuffGPUEmulatorInputs & inputs,
+                               const uint32_t * const *sliceTextures,
+                               vector<uint32_t> & outCombinedSlices,
+                               int & outCombinedWidth,
+                               int & outCombinedHeight)
+{
+  const int blockWidth = inputs.rtd.blockWidth;
+  const int blockHeight = inputs.rtd.blockHeight;
+
+  const int maxCol = 4096 / 512; // max 8 blocks in one row
+
+  int combinedNumElemsHeight = (blockWidth * 16) / (blockWidth * maxCol);
+  if (((blockWidth * 16) % (blockWidth * maxCol)) != 0) {
+    combinedNumElemsHeight++;
+  }
+
+  outCombinedWidth = blockWidth * maxCol;
+  outCombinedHeight = blockHeight * combinedNumElemsHeight;
+
+  outCombinedSlices.assign(outCombinedWidth * outCombinedHeight, 0);
+
+  int outCol = 0;
+  int outRow = 0;
+
+  for ( int slice = 0; slice < 16; slice++ ) {
+    const uint32_t *blockTxt = sliceTextures[slice];
+
+    for ( int y = 0; y < blockHeight; y++ ) {
+      const uint32_t *inRowPtr = blockTxt + (y * blockWidth);
+      uint32_t *outRowPtr = outCombinedSlices.data() + (((outRow * blockHeight) + y) * outCombinedWidth) + (outCol * blockWidth);
+      memcpy(outRowPtr, inRowPtr, blockWidth * sizeof(uint32_t));
+    }
+
+    outCol += 1;
+
+    if (outCol == maxCol) {
+      outCol = 0;
+      outRow += 1;
+    }
+  }
+}
+
+// Emulate cropAndGrayscaleFromTexturesFragmentShader
+
+void
+HuffmanGPUEmulator::cropAndGrayscale(
+                                     const HuffGPUEmulatorInputs & inputs,
+                                     const uint32_t *combinedSlices,
+                                     int combinedWidth,
+                                     uint32_t *outPixels,
+                                     int numThreads)
+{
+  const int width = inputs.rtd.width;
+  const int height = inputs.rtd.height;
+  const uint16_t blockWidth = inputs.rtd.blockWidth;
+  const uint16_t blockHeight = inputs.rtd.blockHeight;
+  const uint16_t blockDim = HUFF_BLOCK_DIM;
+  const uint16_t maxNumBlocksInColumn = 8;
+  const uint16_t halfOne = halfFromFloat(1.0f);
+
+  parallelForRows(height, numThreads, [&](int rowStart, int rowEnd) {
+    for ( int y = rowStart; y < rowEnd; y++ ) {
+      for ( int x = 0; x < width; x++ ) {
+        uint16_t gidX, gidY;
+        gidFromFragment(x, y, width, height, gidX, gidY);
+
+        uint16_t blockRootX = gidX / blockDim;
+        uint16_t blockRootY = gidY / blockDim;
+        uint16_t offsetFromBlockRootX = gidX - (blockRootX * blockDim);
+        uint16_t offsetFromBlockRootY = gidY - (blockRootY * blockDim);
+        uint16_t offsetFromBlockRoot = (offsetFromBlockRootY * blockDim) + offsetFromBlockRootX;
+        uint16_t slice = (offsetFromBlockRoot / 4) % 16;
+
+        uint16_t inX = blockRootX + ((slice % maxNumBlocksInColumn) * blockWidth);
+        uint16_t inY = blockRootY + ((slice / maxNumBlocksInColumn) * blockHeight);
+
+        uint32_t inPixel = combinedSlices[(inY * combinedWidth) + inX];
+
+        // For (0, 1, 2, 3, 0, 1, 2, 3, ...) choose (B, G, R, A)
+
+        uint16_t remXOf4 = offsetFromBlockRoot % 4;
+        uint16_t value = halfFromTextureByte((inPixel >> (remXOf4 * 8)) & 0xFF);
+
+        outPixels[(y * width) + x] = pixelFromHalf4(value, value, value, halfOne);
+      }
+    }
+  });
+}
+
+// Execute all the passes in the order used by drawInMTKView
+
+void
+HuffmanGPUEmulator::decodeFrame(
+                                const HuffGPUEmulatorInputs & inputs,
+                                const uint8_t *blockInitValues,
+                                HuffGPUEmulatorFrame & frame,
+                                int numThreads)
+{
+  const int numBlocks = inputs.rtd.blockWidth * inputs.rtd.blockHeight;
+
+  vector<uint32_t> initState;
+  initStateTexture(inputs, blockInitValues, initState);
+
+  for ( int i = 0; i < 4; i++ ) {
+    frame.stateTextures[i].resize(numBlocks);
+  }
+
+  for ( int i = 0; i < 16; i++ ) {
+    frame.sliceTextures[i].resize(numBlocks);
+  }
+
+  // 4 passes of 12 symbols, the state output of each pass is the input of the next
+
+  const uint32_t *inBitsReadTexture = initState.data();
+
+  for ( int pass = 0; pass < 4; pass++ ) {
+    renderPass12(inputs,
+                 inBitsReadTexture,
+                 frame.sliceTextures[(pass * 3) + 0].data(),
+                 frame.sliceTextures[(pass * 3) + 1].data(),
+                 frame.sliceTextures[(pass * 3) + 2].data(),
+                 frame.stateTextures[pass].data(),
+                 numThreads);
+
+    inBitsReadTexture = frame.stateTextures[pass].data();
+  }
+
+  renderPass16(inputs,
+               inBitsReadTexture,
+               frame.sliceTextures[12].data(),
+               frame.sliceTextures[13].data(),
+               frame.sliceTextures[14].data(),
+               frame.sliceTextures[15].data(),
+               numThreads);
+
+  const uint32_t *slicePtrs[16];
+
+  for ( int i = 0; i < 16; i++ ) {
+    slicePtrs[i] = frame.sliceTextures[i].data();
+  }
+
+  blitSlices(inputs, slicePtrs, frame.combinedSlices, frame.combinedWidth, frame.combinedHeight);
+
+  frame.outPixels.resize(inputs.rtd.width * inputs.rtd.height);
+
+  cropAndGrayscale(inputs, frame.combinedSlices.data(), frame.combinedWidth, frame.outPixels.data(), numThreads);
+}
@@ -0,0 +1,145 @@
+//
+//  HuffmanGPUEmulator.hpp
+//
+//  MIT Licensed
+//
+// CPU reference implementation of the multi pass GPU decode pipeline
+// in AAPLShaders.metal. Each render pass is executed for every pixel
+// of a plain BGRA buffer with the same half float conversions that
+// the shaders and BGRA8Unorm render targets apply, so that pipeline
+// layout changes can be checked for bit exact results without a GPU.
+//
+// A texture is a buffer of 32 bit BGRA pixels in the same layout as
+// the rest of this project: (A << 24) | (R << 16) | (G << 8) | B.
+
+#ifndef HuffmanGPUEmulator_hpp
+#define HuffmanGPUEmulator_hpp
+
+#include <cstdint>
+#include <vector>
+
+// This header is pure C and can be included in either Objc or C++
+#include "HuffmanLookupSymbol.h"
+
+using namespace std;
+
+// Inputs shared by all the huffman decode render passes
+
+typedef struct {
+  const uint32_t *blockStartBitOffsets;
+  const uint8_t *huffBuff;
+  const HuffLookupSymbol *huffSymbolTable1;
+  const HuffLookupSymbol *huffSymbolTable2;
+  RenderTargetDimensionsAndBlockDimensionsUniform rtd;
+} HuffGPUEmulatorInputs;
+
+// Textures written by a full frame decode. There are 4 state textures,
+// one for each 12 symbol pass, and 16 slices with 4 symbols each.
+
+typedef struct {
+  vector<uint32_t> stateTextures[4];
+  vector<uint32_t> sliceTextures[16];
+  vector<uint32_t> combinedSlices;
+  int combinedWidth;
+  int combinedHeight;
+  vector<uint32_t> outPixels;
+} HuffGPUEmulatorFrame;
+
+class HuffmanGPUEmulator {
+
+public:
+
+  // IEEE 754 half float conversion with round to nearest even
+
+  static uint16_t
+  halfFromFloat(float f);
+
+  static float
+  floatFromHalf(uint16_t h);
+
+  // Store a half value into a BGRA8Unorm render target component
+
+  static uint8_t
+  unormByteFromHalf(uint16_t h);
+
+  // Read a BGRA8Unorm texture component as a half value
+
+  static uint16_t
+  halfFromUnormByte(uint8_t b);
+
+  // Emulate the shader calc_gid_from_frag_norm_coord() logic for the
+  // fragment at pixel (x, y) in a render target of the given size.
+
+  static void
+  gidFromFragment(int x, int y, int width, int height, uint16_t & gidX, uint16_t & gidY);
+
+  // Generate the initial state texture of (blockWidth x blockHeight)
+  // pixels. When blockInitValues is not NULL, the R component of each
+  // pixel holds the initial previous symbol for the block.
+
+  static void
+  initStateTexture(
+                   const HuffGPUEmulatorInputs & inputs,
+                   const uint8_t *blockInitValues,
+                   vector<uint32_t> & outStateTexture);
+
+  // Emulate huffFragmentShaderB8W12, decodes 12 symbols for each block
+  // into 3 textures and writes the numBitsRead and prevSymbol state.
+
+  static void
+  renderPass12(
+               const HuffGPUEmulatorInputs & inputs,
+               const uint32_t *inBitsReadTexture,
+               uint32_t *outC0,
+               uint32_t *outC1,
+               uint32_t *outC2,
+               uint32_t *outNumBitsRead,
+               int numThreads);
+
+  // Emulate huffFragmentShaderB8W16, decodes 16 symbols for each block
+  // into 4 textures.
+
+  static void
+  renderPass16(
+               const HuffGPUEmulatorInputs & inputs,
+               const uint32_t *inBitsReadTexture,
+               uint32_t *outC0,
+               uint32_t *outC1,
+               uint32_t *outC2,
+               uint32_t *outC3,
+               int numThreads);
+
+  // Emulate the blit of 16 slice textures into a combined texture where
+  // each row contains up to 8 slices.
+
+  static void
+  blitSlices(
+             const HuffGPUEmulatorInputs & inputs,
+             const uint32_t * const *sliceTextures,
+             vector<uint32_t> & outCombinedSlices,
+             int & outCombinedWidth,
+             int & outCombinedHeight);
+
+  // Emulate cropAndGrayscaleFromTexturesFragmentShader, writes one
+  // grayscale BGRA pixel for each (width x height) output pixel.
+
+  static void
+  cropAndGrayscale(
+                   const HuffGPUEmulatorInputs & inputs,
+                   const uint32_t *combinedSlices,
+                   int combinedWidth,
+                   uint32_t *outPixels,
+                   int numThreads);
+
+  // Execute all the passes in the order used by drawInMTKView
+
+  static void
+  decodeFrame(
+              const HuffGPUEmulatorInputs & inputs,
+              const uint8_t *blockInitValues,
+              HuffGPUEmulatorFrame & frame,
+              int numThreads);
+
+};
+
+#endif // HuffmanGPUEmulator_hpp
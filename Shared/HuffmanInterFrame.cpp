@@ -0,0 +1,296 @@
+//
+//  HuffmanInterFrame.cpp
+//
+//  MIT Licensed
+//
+
+#include "HuffmanInterFrame.hpp"
+
+#include "HuffmanBlockKernels.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#include <assert.h>
+
+// Sum of absolute residuals, the residuals are signed bytes
+
+static inline
+int
+sumAbsResiduals(const uint8_t *residuals, int numResiduals)
+{
+  int sumAbs = 0;
+  for ( int i = 0; i < numResiduals; i++ ) {
+    sumAbs += abs((int)(int8_t)residuals[i]);
+  }
+  return sumAbs;
+}
+
+HuffmanInterFrameEncoder::HuffmanInterFrameEncoder(int width, int height, int blockDim)
+{
+#if defined(DEBUG)
+  assert(width > 0 && height > 0);
+  assert(HuffmanUtil::isSupportedBlockDim(blockDim));
+#endif // DEBUG
+
+  this->width = width;
+  this->height = height;
+  this->blockDim = blockDim;
+  numBlocks = HuffmanUtil::numBlocksForDim(width, blockDim) * HuffmanUtil::numBlocksForDim(height, blockDim);
+  hasPrevFrame = false;
+
+  prevBlocks.resize(numBlocks * blockDim * blockDim);
+  curBlocks.resize(numBlocks * blockDim * blockDim);
+  residuals.resize(numBlocks * blockDim * blockDim);
+  memset(modeCounts, 0, sizeof(modeCounts));
+}
+
+// Encode the next frame, the residuals of the coded blocks are
+// collected in order and then huffman coded with one table.
+
+void
+HuffmanInterFrameEncoder::encodeFrame(
+                                      const uint8_t *pixels,
+                                      bool isKeyFrame,
+                                      vector<uint8_t> & outFileHeader,
+                                      HuffInterFrameEncoded & outEncoded)
+{
+  HUFF_TRACE_SPAN("encode inter frame");
+
+  const int blockNumSymbols = blockDim * blockDim;
+  const bool isIntraOnly = isKeyFrame || !hasPrevFrame;
+
+  HuffmanBlockKernels::splitImageToBlocks(pixels, curBlocks.data(), width, height, blockDim, 0);
+
+  outEncoded.blockModes.resize(numBlocks);
+  memset(modeCounts, 0, sizeof(modeCounts));
+
+  uint8_t intraResiduals[32 * 32];
+  uint8_t *residualsPtr = residuals.data();
+  int numCodedBlocks = 0;
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint8_t *curBlockPtr = curBlocks.data() + (blocki * blockNumSymbols);
+    const uint8_t *prevBlockPtr = prevBlocks.data() + (blocki * blockNumSymbols);
+    uint8_t *blockResidualsPtr = residualsPtr + (numCodedBlocks * blockNumSymbols);
+
+    HuffBlockMode mode = HUFF_BLOCK_MODE_INTRA;
+
+    if (!isIntraOnly && memcmp(curBlockPtr, prevBlockPtr, blockNumSymbols) == 0) {
+      mode = HUFF_BLOCK_MODE_SKIP;
+    } else {
+      // Intra residuals are written to a scratch block so that the
+      // temporal residuals can be compared before either is kept.
+
+      uint8_t prev = 0;
+      for ( int i = 0; i < blockNumSymbols; i++ ) {
+        intraResiduals[i] = curBlockPtr[i] - prev;
+        prev = curBlockPtr[i];
+      }
+
+      if (!isIntraOnly) {
+        for ( int i = 0; i < blockNumSymbols; i++ ) {
+          blockResidualsPtr[i] = curBlockPtr[i] - prevBlockPtr[i];
+        }
+
+        if (sumAbsResiduals(blockResidualsPtr, blockNumSymbols) < sumAbsResiduals(intraResiduals, blockNumSymbols)) {
+          mode = HUFF_BLOCK_MODE_TEMPORAL;
+        }
+      }
+
+      if (mode == HUFF_BLOCK_MODE_INTRA) {
+        memcpy(blockResidualsPtr, intraResiduals, blockNumSymbols);
+      }
+
+      numCodedBlocks += 1;
+    }
+
+    outEncoded.blockModes[blocki] = (uint8_t) mode;
+    modeCounts[mode] += 1;
+  }
+
+  const int numCodedSymbols = numCodedBlocks * blockNumSymbols;
+
+  if (numCodedBlocks == 0) {
+    // Every block was skipped, there are no codes to decode
+    outEncoded.canonHeader.assign(256, 0);
+    outEncoded.huffCodes.assign(2, 0);
+    outEncoded.blockBitOffsets.clear();
+  } else {
+    HuffEncodeBufferSizes sizes;
+    vector<uint8_t> sectionFileHeader;
+
+    outEncoded.canonHeader.resize(256);
+
+    HuffmanUtil::queryEncodeBufferSizes(residualsPtr, numCodedSymbols, blockDim, outEncoded.canonHeader.data(), sizes);
+
+    outEncoded.huffCodes.resize(sizes.numCodeBytes);
+    outEncoded.blockBitOffsets.resize(sizes.numBlocks);
+
+    bool worked = HuffmanUtil::encodeHuffmanToBuffers(residualsPtr,
+                                                      numCodedSymbols,
+                                                      blockDim,
+                                                      outEncoded.canonHeader.data(),
+                                                      outEncoded.huffCodes.data(),
+                                                      (int) outEncoded.huffCodes.size(),
+                                                      outEncoded.blockBitOffsets.data(),
+                                                      (int) outEncoded.blockBitOffsets.size(),
+                                                      sectionFileHeader);
+    assert(worked);
+  }
+
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, numCodedSymbols);
+  header.blockDim = blockDim;
+  HuffmanUtil::generateFileHeader(header, outFileHeader);
+
+  // The current frame is the reference for the next frame
+
+  curBlocks.swap(prevBlocks);
+  hasPrevFrame = true;
+}
+
+int
+HuffmanInterFrameEncoder::numBlocksWithMode(HuffBlockMode mode) const
+{
+  return modeCounts[mode];
+}
+
+HuffmanInterFrameDecoder::HuffmanInterFrameDecoder(int width, int height)
+{
+#if defined(DEBUG)
+  assert(width > 0 && height > 0);
+#endif // DEBUG
+
+  this->width = width;
+  this->height = height;
+  frameBlockDim = 0;
+  hasFrame = false;
+
+  frame.resize(width * height);
+}
+
+// Decode the codes of every coded block first, so that a corrupt frame
+// is detected before the previous frame is modified. Then only the
+// pixels of the coded blocks are written.
+
+HuffDecodeStatus
+HuffmanInterFrameDecoder::decodeFrame(
+                                      const uint8_t *fileHeader,
+                                      int fileHeaderN,
+                                      const HuffInterFrameEncoded & encoded)
+{
+  HUFF_TRACE_SPAN("decode inter frame");
+
+  HuffFileHeader header;
+
+  if (fileHeader == nullptr || !HuffmanUtil::parseFileHeader(fileHeader, fileHeaderN, header) ||
+      header.entropyCoder != HUFF_ENTROPY_HUFFMAN || header.bitsPerSample != 8) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockDim = header.blockDim;
+  const int blockNumSymbols = blockDim * blockDim;
+  const int blockWidth = HuffmanUtil::numBlocksForDim(width, blockDim);
+  const int blockHeight = HuffmanUtil::numBlocksForDim(height, blockDim);
+  const int numBlocks = blockWidth * blockHeight;
+
+  if ((int) encoded.blockModes.size() != numBlocks) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  // Skip and temporal blocks refer to the blocks of the previous frame
+
+  const bool hasReference = hasFrame && (frameBlockDim == blockDim);
+  int numCodedBlocks = 0;
+
+  for ( uint8_t mode : encoded.blockModes ) {
+    if (mode >= HUFF_BLOCK_MODE_NUM || (mode != HUFF_BLOCK_MODE_INTRA && !hasReference)) {
+      return HUFF_DECODE_ERROR_ARGUMENTS;
+    }
+    if (mode != HUFF_BLOCK_MODE_SKIP) {
+      numCodedBlocks += 1;
+    }
+  }
+
+  if (header.numBytes != (uint64_t) numCodedBlocks * blockNumSymbols ||
+      (int) encoded.blockBitOffsets.size() != numCodedBlocks) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  if (numCodedBlocks > 0) {
+    if (encoded.canonHeader.size() != 256) {
+      return HUFF_DECODE_ERROR_TABLE;
+    }
+
+    vector<vector<uint8_t> > canonHeaders;
+    canonHeaders.push_back(encoded.canonHeader);
+
+    residuals.resize(numCodedBlocks * blockNumSymbols);
+
+    HuffDecodeStatus status = HuffmanUtil::decodeHuffmanBlocksChecked(canonHeaders,
+                                                                      numCodedBlocks,
+                                                                      blockDim,
+                                                                      encoded.huffCodes.data(),
+                                                                      (int) encoded.huffCodes.size(),
+                                                                      encoded.blockBitOffsets.data(),
+                                                                      nullptr,
+                                                                      residuals.data(),
+                                                                      (int) residuals.size());
+
+    if (status != HUFF_DECODE_OK) {
+      return status;
+    }
+  }
+
+  // Apply the residuals of each coded block to the pixels of the block,
+  // pixels past the right and bottom edges are cropped.
+
+  uint8_t *residualsPtr = residuals.data();
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const HuffBlockMode mode = (HuffBlockMode) encoded.blockModes[blocki];
+
+    if (mode == HUFF_BLOCK_MODE_SKIP) {
+      continue;
+    }
+
+    const int x = (blocki % blockWidth) * blockDim;
+    const int y = (blocki / blockWidth) * blockDim;
+    const int numCols = (width - x) < blockDim ? (width - x) : blockDim;
+    const int numRows = (height - y) < blockDim ? (height - y) : blockDim;
+
+    if (mode == HUFF_BLOCK_MODE_INTRA) {
+      HuffmanBlockKernels::decodeDeltas(residualsPtr, blockNumSymbols);
+
+      for ( int row = 0; row < numRows; row++ ) {
+        memcpy(&frame[((y + row) * width) + x], residualsPtr + (row * blockDim), numCols);
+      }
+    } else {
+      for ( int row = 0; row < numRows; row++ ) {
+        uint8_t *framePtr = &frame[((y + row) * width) + x];
+        const uint8_t *rowResidualsPtr = residualsPtr + (row * blockDim);
+
+        for ( int col = 0; col < numCols; col++ ) {
+          framePtr[col] += rowResidualsPtr[col];
+        }
+      }
+    }
+
+    residualsPtr += blockNumSymbols;
+  }
+
+  frameBlockDim = blockDim;
+  hasFrame = true;
+
+  return HUFF_DECODE_OK;
+}
+
+const uint8_t *
+HuffmanInterFrameDecoder::framePixels() const
+{
+  return frame.data();
+}
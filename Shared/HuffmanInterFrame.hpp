@@ -0,0 +1,122 @@
+//
+//  HuffmanInterFrame.hpp
+//
+//  MIT Licensed
+//
+// Inter frame coding for a sequence of frames with the same dimensions,
+// for example a screen recording where most of each frame is the same
+// as the previous frame. Each block is compared to the co-located block
+// of the previous frame:
+//
+// HUFF_BLOCK_MODE_SKIP : the block did not change, no codes are stored
+// HUFF_BLOCK_MODE_TEMPORAL : the byte difference from the previous block
+// HUFF_BLOCK_MODE_INTRA : the 1D delta in block order of a key frame
+//
+// A changed block is coded with the temporal or the intra residuals,
+// whichever has the smaller sum of absolute residuals. Only the coded
+// blocks have huffman codes and a block bit offset, the mode of every
+// block is stored as one byte in the same way as the block predictors.
+//
+// Coding is lossless, so the previous reconstructed frame is the
+// previous input frame. The decoder keeps the previous frame and
+// writes only the blocks that are not skipped.
+
+#ifndef HuffmanInterFrame_hpp
+#define HuffmanInterFrame_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+typedef enum {
+  HUFF_BLOCK_MODE_INTRA = 0,
+  HUFF_BLOCK_MODE_TEMPORAL,
+  HUFF_BLOCK_MODE_SKIP,
+  HUFF_BLOCK_MODE_NUM,
+} HuffBlockMode;
+
+// The encoded output for one frame
+
+typedef struct {
+  vector<uint8_t> canonHeader;
+  vector<uint8_t> huffCodes;
+  vector<uint32_t> blockBitOffsets;
+  vector<uint8_t> blockModes;
+} HuffInterFrameEncoded;
+
+class HuffmanInterFrameEncoder {
+
+public:
+
+  HuffmanInterFrameEncoder(int width, int height, int blockDim);
+
+  // Encode the next frame. When isKeyFrame is true or when there is no
+  // previous frame every block is coded as an intra block.
+
+  void
+  encodeFrame(
+              const uint8_t *pixels,
+              bool isKeyFrame,
+              vector<uint8_t> & outFileHeader,
+              HuffInterFrameEncoded & outEncoded);
+
+  // Number of blocks of each mode in the last frame
+
+  int
+  numBlocksWithMode(HuffBlockMode mode) const;
+
+private:
+
+  int width;
+  int height;
+  int blockDim;
+  int numBlocks;
+  bool hasPrevFrame;
+
+  // Previous and current frame split into zero padded blocks
+
+  vector<uint8_t> prevBlocks;
+  vector<uint8_t> curBlocks;
+  vector<uint8_t> residuals;
+  int modeCounts[HUFF_BLOCK_MODE_NUM];
+
+};
+
+class HuffmanInterFrameDecoder {
+
+public:
+
+  HuffmanInterFrameDecoder(int width, int height);
+
+  // Decode the next frame over the previous frame. A frame with a skip
+  // or temporal block can only follow a decoded frame with the same
+  // block dimension. The previous frame is not modified when a frame
+  // fails to decode.
+
+  HuffDecodeStatus
+  decodeFrame(
+              const uint8_t *fileHeader,
+              int fileHeaderN,
+              const HuffInterFrameEncoded & encoded);
+
+  // Pixels of the last decoded frame, width x height in raster order
+
+  const uint8_t *
+  framePixels() const;
+
+private:
+
+  int width;
+  int height;
+  int frameBlockDim;
+  bool hasFrame;
+
+  vector<uint8_t> frame;
+  vector<uint8_t> residuals;
+
+};
+
+#endif // HuffmanInterFrame_hpp
@@ -0,0 +1,331 @@
+// C++ impl of the render pass schedule planner and CPU executor
+//  MIT Licensed
+
+#include "HuffmanPassPlanner.hpp"
+
+#include "HuffmanUtil.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <assert.h>
+
+using namespace std;
+
+// Max width of a canonical huffman code in bits
+
+static const int maxCodeBitWidth = 16;
+
+// Number of symbols stored in one BGRA pixel
+
+static const int numSymbolsPerPixel = 4;
+
+// Number of channels in one state pixel
+
+static const int numStateChannels = 4;
+
+// Limits that correspond to the existing Metal pipeline
+
+HuffPassPlannerConfig
+HuffmanPassPlanner::defaultConfig()
+{
+  HuffPassPlannerConfig config;
+  config.blockDim = HUFF_BLOCK_DIM;
+  config.maxColorAttachments = 4;
+  config.bitsPerStateChannel = 8;
+  config.maxTextureDim = 4096;
+  return config;
+}
+
+// Number of bits needed to represent values in the range [0, maxValue]
+
+static inline
+int
+numBitsForMaxValue(uint32_t maxValue)
+{
+  int numBits = 0;
+  while (maxValue > 0) {
+    numBits += 1;
+    maxValue >>= 1;
+  }
+  return numBits;
+}
+
+// Generate a pass schedule for a width x height frame
+
+bool
+HuffmanPassPlanner::planPasses(
+                               const HuffPassPlannerConfig & config,
+                               int width,
+                               int height,
+                               HuffPassSchedule & outSchedule)
+{
+  if (config.blockDim < 1 || config.maxColorAttachments < 1 ||
+      config.bitsPerStateChannel < 1 || config.bitsPerStateChannel > 16 ||
+      config.maxTextureDim < 1 || width < 1 || height < 1) {
+    return false;
+  }
+
+  HuffPassSchedule & schedule = outSchedule;
+
+  schedule.config = config;
+  schedule.width = width;
+  schedule.height = height;
+  schedule.blockWidth = (width + config.blockDim - 1) / config.blockDim;
+  schedule.blockHeight = (height + config.blockDim - 1) / config.blockDim;
+
+  const int blockNumSymbols = config.blockDim * config.blockDim;
+  const int maxSymbolsInLastPass = config.maxColorAttachments * numSymbolsPerPixel;
+  const int maxSymbolsInStatePass = (config.maxColorAttachments - 1) * numSymbolsPerPixel;
+
+  // Every pass but the last gives up one attachment to the state
+
+  schedule.passes.clear();
+
+  int symboli = 0;
+
+  while ((blockNumSymbols - symboli) > maxSymbolsInLastPass) {
+    if (maxSymbolsInStatePass == 0) {
+      return false;
+    }
+
+    HuffPassSchedulePass pass;
+    pass.firstSymbol = symboli;
+    pass.numSymbols = maxSymbolsInStatePass;
+    pass.firstSlice = symboli / numSymbolsPerPixel;
+    pass.numSliceAttachments = config.maxColorAttachments - 1;
+    pass.writesState = true;
+    schedule.passes.push_back(pass);
+
+    symboli += pass.numSymbols;
+  }
+
+  {
+    HuffPassSchedulePass pass;
+    pass.firstSymbol = symboli;
+    pass.numSymbols = blockNumSymbols - symboli;
+    pass.firstSlice = symboli / numSymbolsPerPixel;
+    pass.numSliceAttachments = (pass.numSymbols + numSymbolsPerPixel - 1) / numSymbolsPerPixel;
+    pass.writesState = false;
+    schedule.passes.push_back(pass);
+  }
+
+  // The largest numBitsRead value stored in the state is written after
+  // the last pass that writes state.
+
+  const uint32_t maxNumBitsRead = symboli * maxCodeBitWidth;
+  const int numBitsReadBits = numBitsForMaxValue(maxNumBitsRead);
+
+  schedule.numBitsReadChannels = (numBitsReadBits + config.bitsPerStateChannel - 1) / config.bitsPerStateChannel;
+  schedule.prevSymbolChannel = -1;
+
+#if defined(IMPL_DELTAS_BEFORE_HUFF_ENCODING)
+  if (symboli > 0) {
+    if (config.bitsPerStateChannel < 8) {
+      return false;
+    }
+    schedule.prevSymbolChannel = schedule.numBitsReadChannels;
+  }
+#endif // IMPL_DELTAS_BEFORE_HUFF_ENCODING
+
+  const int numChannelsUsed = schedule.numBitsReadChannels + ((schedule.prevSymbolChannel >= 0) ? 1 : 0);
+
+  if (numChannelsUsed > numStateChannels) {
+    return false;
+  }
+
+  // Pack slices into rows as wide as the max texture dimension and
+  // split rows over pages when the atlas would be too tall.
+
+  if (schedule.blockWidth > config.maxTextureDim || schedule.blockHeight > config.maxTextureDim) {
+    return false;
+  }
+
+  schedule.numSlices = (blockNumSymbols + numSymbolsPerPixel - 1) / numSymbolsPerPixel;
+
+  schedule.slicesPerRow = config.maxTextureDim / schedule.blockWidth;
+  if (schedule.slicesPerRow > schedule.numSlices) {
+    schedule.slicesPerRow = schedule.numSlices;
+  }
+
+  const int numRows = (schedule.numSlices + schedule.slicesPerRow - 1) / schedule.slicesPerRow;
+
+  schedule.rowsPerPage = config.maxTextureDim / schedule.blockHeight;
+  if (schedule.rowsPerPage > numRows) {
+    schedule.rowsPerPage = numRows;
+  }
+
+  schedule.slicesPerPage = schedule.slicesPerRow * schedule.rowsPerPage;
+  schedule.numPages = (schedule.numSlices + schedule.slicesPerPage - 1) / schedule.slicesPerPage;
+  schedule.atlasWidth = schedule.slicesPerRow * schedule.blockWidth;
+  schedule.atlasHeight = schedule.rowsPerPage * schedule.blockHeight;
+
+  return true;
+}
+
+// Map an output pixel to the atlas location of the decoded symbol
+
+HuffAtlasCoord
+HuffmanPassPlanner::atlasCoordForPixel(
+                                       const HuffPassSchedule & schedule,
+                                       int x,
+                                       int y)
+{
+  const int blockDim = schedule.config.blockDim;
+
+  const int blockRootX = x / blockDim;
+  const int blockRootY = y / blockDim;
+  const int offsetFromBlockRoot = ((y % blockDim) * blockDim) + (x % blockDim);
+
+  const int slice = offsetFromBlockRoot / numSymbolsPerPixel;
+  const int sliceInPage = slice % schedule.slicesPerPage;
+
+  HuffAtlasCoord coord;
+  coord.page = slice / schedule.slicesPerPage;
+  coord.x = ((sliceInPage % schedule.slicesPerRow) * schedule.blockWidth) + blockRootX;
+  coord.y = ((sliceInPage / schedule.slicesPerRow) * schedule.blockHeight) + blockRootY;
+  coord.component = offsetFromBlockRoot % numSymbolsPerPixel;
+  return coord;
+}
+
+// Print the passes and atlas layout
+
+void
+HuffmanPassPlanner::printSchedule(const HuffPassSchedule & schedule)
+{
+  printf("%d x %d frame : %d x %d blocks of %d x %d\n", schedule.width, schedule.height, schedule.blockWidth, schedule.blockHeight, schedule.config.blockDim, schedule.config.blockDim);
+
+  for ( int passi = 0; passi < (int) schedule.passes.size(); passi++ ) {
+    const HuffPassSchedulePass & pass = schedule.passes[passi];
+    printf("pass %d : symbols [%4d, %4d) : slices [%3d, %3d)%s\n", passi, pass.firstSymbol, pass.firstSymbol + pass.numSymbols, pass.firstSlice, pass.firstSlice + pass.numSliceAttachments, pass.writesState ? " : writes state" : "");
+  }
+
+  printf("state : numBitsRead in %d channels : prevSymbol in channel %d\n", schedule.numBitsReadChannels, schedule.prevSymbolChannel);
+  printf("atlas : %d slices : %d per row : %d rows per page : %d pages of %d x %d\n", schedule.numSlices, schedule.slicesPerRow, schedule.rowsPerPage, schedule.numPages, schedule.atlasWidth, schedule.atlasHeight);
+}
+
+// Execute the schedule on the CPU
+
+bool
+HuffmanPassPlanner::executeSchedule(
+                                    const HuffPassSchedule & schedule,
+                                    const HuffPassInputs & inputs,
+                                    const uint8_t *blockInitValues,
+                                    HuffPassFrame & frame)
+{
+  const int blockDim = schedule.config.blockDim;
+  const int bitsPerStateChannel = schedule.config.bitsPerStateChannel;
+  const uint32_t stateChannelMask = (1 << bitsPerStateChannel) - 1;
+  const uint64_t maxNumBitsRead = ((uint64_t) 1 << (schedule.numBitsReadChannels * bitsPerStateChannel)) - 1;
+  const int numBlocks = schedule.blockWidth * schedule.blockHeight;
+
+  // Integer state channels for each block, the state texture read
+  // by a pass is the state texture written by the previous pass.
+
+  vector<uint16_t> inState(numBlocks * numStateChannels, 0);
+  vector<uint16_t> outState(numBlocks * numStateChannels, 0);
+
+  if (blockInitValues != nullptr && schedule.prevSymbolChannel >= 0) {
+    for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+      inState[(blocki * numStateChannels) + schedule.prevSymbolChannel] = blockInitValues[blocki];
+    }
+  }
+
+  vector<vector<uint32_t> > slices(schedule.numSlices, vector<uint32_t>(numBlocks, 0));
+
+  vector<uint8_t> symbols(blockDim * blockDim);
+
+  for ( const HuffPassSchedulePass & pass : schedule.passes ) {
+    for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+      const uint16_t *blockInState = &inState[blocki * numStateChannels];
+
+      uint32_t numBitsRead = 0;
+      for ( int channeli = schedule.numBitsReadChannels - 1; channeli >= 0; channeli-- ) {
+        numBitsRead = (numBitsRead << bitsPerStateChannel) | blockInState[channeli];
+      }
+
+      const uint32_t numBitsReadForBlockRoot = inputs.blockStartBitOffsets[blocki];
+
+      uint32_t endBitOffset = HuffmanUtil::decodeHuffmanSymbolsAtBitOffset(inputs.huffSymbolTable1,
+                                                                           inputs.huffSymbolTable2,
+                                                                           inputs.huffBuff,
+                                                                           numBitsReadForBlockRoot + numBitsRead,
+                                                                           symbols.data(),
+                                                                           pass.numSymbols);
+
+      numBitsRead = endBitOffset - numBitsReadForBlockRoot;
+
+#if defined(IMPL_DELTAS_BEFORE_HUFF_ENCODING)
+      uint8_t prevSymbol = (schedule.prevSymbolChannel >= 0) ? blockInState[schedule.prevSymbolChannel] : 0;
+
+      for ( int i = 0; i < pass.numSymbols; i++ ) {
+        prevSymbol += symbols[i];
+        symbols[i] = prevSymbol;
+      }
+#else
+      uint8_t prevSymbol = 0;
+#endif // IMPL_DELTAS_BEFORE_HUFF_ENCODING
+
+      // Symbols are written to attachments in (B, G, R, A) order
+
+      for ( int i = 0; i < pass.numSymbols; i++ ) {
+        const int slice = pass.firstSlice + (i / numSymbolsPerPixel);
+        const int component = i % numSymbolsPerPixel;
+        slices[slice][blocki] |= ((uint32_t) symbols[i]) << (component * 8);
+      }
+
+      if (pass.writesState) {
+        if (numBitsRead > maxNumBitsRead) {
+          return false;
+        }
+
+        uint16_t *blockOutState = &outState[blocki * numStateChannels];
+
+        for ( int channeli = 0; channeli < schedule.numBitsReadChannels; channeli++ ) {
+          blockOutState[channeli] = (numBitsRead >> (channeli * bitsPerStateChannel)) & stateChannelMask;
+        }
+
+        if (schedule.prevSymbolChannel >= 0) {
+          blockOutState[schedule.prevSymbolChannel] = prevSymbol;
+        }
+      }
+    }
+
+    if (pass.writesState) {
+      inState.swap(outState);
+    }
+  }
+
+  // Copy each slice into its atlas page
+
+  frame.atlasPages.assign(schedule.numPages, vector<uint32_t>(schedule.atlasWidth * schedule.atlasHeight, 0));
+
+  for ( int slice = 0; slice < schedule.numSlices; slice++ ) {
+    const int sliceInPage = slice % schedule.slicesPerPage;
+    const int outX = (sliceInPage % schedule.slicesPerRow) * schedule.blockWidth;
+    const int outY = (sliceInPage / schedule.slicesPerRow) * schedule.blockHeight;
+    vector<uint32_t> & page = frame.atlasPages[slice / schedule.slicesPerPage];
+
+    for ( int y = 0; y < schedule.blockHeight; y++ ) {
+      memcpy(&page[((outY + y) * schedule.atlasWidth) + outX],
+             &slices[slice][y * schedule.blockWidth],
+             schedule.blockWidth * sizeof(uint32_t));
+    }
+  }
+
+  // Crop pass reads one component for each output pixel
+
+  frame.outPixels.resize(schedule.width * schedule.height);
+
+  for ( int y = 0; y < schedule.height; y++ ) {
+    for ( int x = 0; x < schedule.width; x++ ) {
+      HuffAtlasCoord coord = atlasCoordForPixel(schedule, x, y);
+      uint32_t pixel = frame.atlasPages[coord.page][(coord.y * schedule.atlasWidth) + coord.x];
+      frame.outPixels[(y * schedule.width) + x] = (pixel >> (coord.component * 8)) & 0xFF;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,153 @@
+//
+//  HuffmanPassPlanner.hpp
+//
+//  MIT Licensed
+//
+// Planner for the render target decode pipeline. Each render pass
+// decodes a run of symbols for every block and writes 4 symbols to
+// each color attachment. Every pass but the last also writes the
+// running numBitsRead and prevSymbol state to one attachment so that
+// the next pass can continue decoding. The symbol attachments are
+// then copied into an atlas of slices that the crop pass reads from.
+//
+// With 8x8 blocks, 4 color attachments and 8 bit state channels the
+// planner generates the 12+12+12+12+16 passes used in drawInMTKView.
+
+#ifndef HuffmanPassPlanner_hpp
+#define HuffmanPassPlanner_hpp
+
+#include <cstdint>
+#include <vector>
+
+// This header is pure C and can be included in either Objc or C++
+#include "HuffmanLookupSymbol.h"
+
+using namespace std;
+
+// Hardware limits the schedule must fit within
+
+typedef struct {
+  int blockDim;
+  int maxColorAttachments;
+  int bitsPerStateChannel;
+  int maxTextureDim;
+} HuffPassPlannerConfig;
+
+// One render pass, symbols [firstSymbol, firstSymbol+numSymbols) of each
+// block are written to slices [firstSlice, firstSlice+numSliceAttachments).
+// When writesState is true the state is written to the attachment that
+// follows the slice attachments.
+
+typedef struct {
+  int firstSymbol;
+  int numSymbols;
+  int firstSlice;
+  int numSliceAttachments;
+  bool writesState;
+} HuffPassSchedulePass;
+
+typedef struct {
+  HuffPassPlannerConfig config;
+
+  int width;
+  int height;
+  int blockWidth;
+  int blockHeight;
+
+  vector<HuffPassSchedulePass> passes;
+
+  // Each slice is a (blockWidth x blockHeight) texture with 4 symbols
+  // per pixel. Slices are packed into rows of an atlas texture and
+  // when one atlas texture is not large enough more pages are used.
+
+  int numSlices;
+  int slicesPerRow;
+  int rowsPerPage;
+  int slicesPerPage;
+  int numPages;
+  int atlasWidth;
+  int atlasHeight;
+
+  // State channels, numBitsRead is split over numBitsReadChannels channels
+  // starting with the least significant bits in channel 0. prevSymbol is
+  // stored in prevSymbolChannel or -1 when deltas are not decoded.
+
+  int numBitsReadChannels;
+  int prevSymbolChannel;
+} HuffPassSchedule;
+
+// Location of one output pixel in the slice atlas
+
+typedef struct {
+  int page;
+  int x;
+  int y;
+  int component;
+} HuffAtlasCoord;
+
+// Buffers read by the executor
+
+typedef struct {
+  const uint32_t *blockStartBitOffsets;
+  const uint8_t *huffBuff;
+  const HuffLookupSymbol *huffSymbolTable1;
+  const HuffLookupSymbol *huffSymbolTable2;
+} HuffPassInputs;
+
+// Textures written by the executor
+
+typedef struct {
+  vector<vector<uint32_t> > atlasPages;
+  vector<uint8_t> outPixels;
+} HuffPassFrame;
+
+class HuffmanPassPlanner {
+
+public:
+
+  // Limits that correspond to the existing Metal pipeline
+
+  static HuffPassPlannerConfig
+  defaultConfig();
+
+  // Generate a pass schedule for a width x height frame. Returns false
+  // when the limits in config cannot hold the decode state or when a
+  // slice does not fit in a texture.
+
+  static bool
+  planPasses(
+             const HuffPassPlannerConfig & config,
+             int width,
+             int height,
+             HuffPassSchedule & outSchedule);
+
+  // Map an output pixel to the atlas page, pixel and BGRA component
+  // that holds the decoded symbol.
+
+  static HuffAtlasCoord
+  atlasCoordForPixel(
+                     const HuffPassSchedule & schedule,
+                     int x,
+                     int y);
+
+  // Print the passes and atlas layout
+
+  static void
+  printSchedule(const HuffPassSchedule & schedule);
+
+  // Execute the schedule on the CPU. Each pass is run for every block
+  // with the state read from and written to integer channels of
+  // bitsPerStateChannel bits, the slices are copied into the atlas pages
+  // and the output pixels are read back through atlasCoordForPixel().
+  // Returns false when a state value does not fit in its channels.
+
+  static bool
+  executeSchedule(
+                  const HuffPassSchedule & schedule,
+                  const HuffPassInputs & inputs,
+                  const uint8_t *blockInitValues,
+                  HuffPassFrame & frame);
+
+};
+
+#endif // HuffmanPassPlanner_hpp
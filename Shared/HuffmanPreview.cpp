@@ -0,0 +1,387 @@
+//
+//  HuffmanPreview.cpp
+//
+//  MIT Licensed
+//
+
+#include "HuffmanPreview.hpp"
+
+#include "HuffmanBlockKernels.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include <assert.h>
+
+// MED prediction for a plane value from the left, above and above left
+// values, the first row and column are predicted from one neighbor.
+
+static inline
+int
+predictPlaneValue(const uint8_t *plane, int planeWidth, int x, int y)
+{
+  if (x == 0 && y == 0) {
+    return 0;
+  } else if (y == 0) {
+    return plane[x - 1];
+  } else if (x == 0) {
+    return plane[(y - 1) * planeWidth];
+  }
+
+  const int a = plane[(y * planeWidth) + x - 1];
+  const int b = plane[((y - 1) * planeWidth) + x];
+  const int c = plane[((y - 1) * planeWidth) + x - 1];
+
+  return HuffmanUtil::predictMED(a, b, c);
+}
+
+// Number of plane residuals once padded to a whole number of groups
+
+static inline
+int
+paddedPlaneNumSymbols(int planeNumValues)
+{
+  const int groupNumSymbols = HUFF_PREVIEW_PLANE_GROUP_DIM * HUFF_PREVIEW_PLANE_GROUP_DIM;
+  return HuffmanUtil::numBlocksForDim(planeNumValues, groupNumSymbols) * groupNumSymbols;
+}
+
+// Encode one section, inNumBytes is a multiple of the block size
+
+static
+void
+encodeSection(
+              const uint8_t *inBytes,
+              int inNumBytes,
+              int blockDim,
+              vector<uint8_t> & outCanonHeader,
+              vector<uint8_t> & outHuffCodes,
+              vector<uint32_t> & outBlockBitOffsets)
+{
+  HuffEncodeBufferSizes sizes;
+  vector<uint8_t> sectionFileHeader;
+
+  outCanonHeader.resize(256);
+
+  HuffmanUtil::queryEncodeBufferSizes(inBytes, inNumBytes, blockDim, outCanonHeader.data(), sizes);
+
+  outHuffCodes.resize(sizes.numCodeBytes);
+  outBlockBitOffsets.resize(sizes.numBlocks);
+
+  bool worked = HuffmanUtil::encodeHuffmanToBuffers(inBytes,
+                                                    inNumBytes,
+                                                    blockDim,
+                                                    outCanonHeader.data(),
+                                                    outHuffCodes.data(),
+                                                    (int) outHuffCodes.size(),
+                                                    outBlockBitOffsets.data(),
+                                                    (int) outBlockBitOffsets.size(),
+                                                    sectionFileHeader);
+  assert(worked);
+}
+
+// Parse the file header and check that it describes a width x height
+// image encoded with a block init plane.
+
+static
+bool
+parsePreviewHeader(
+                   const uint8_t *fileHeader,
+                   int fileHeaderN,
+                   int width,
+                   int height,
+                   HuffFileHeader & header)
+{
+  if (fileHeader == nullptr || width <= 0 || height <= 0 ||
+      !HuffmanUtil::parseFileHeader(fileHeader, fileHeaderN, header)) {
+    return false;
+  }
+
+  if (header.blockInitPlane != 1 || header.entropyCoder != HUFF_ENTROPY_HUFFMAN ||
+      header.predictor != HUFF_PREDICTOR_DELTA || header.scanOrder != HUFF_SCAN_RASTER ||
+      header.numTables != 1 || header.numChannels != 1 || header.bitsPerSample != 8) {
+    return false;
+  }
+
+  const int blockDim = header.blockDim;
+  const uint64_t numBlockSymbols = (uint64_t) HuffmanUtil::numBlocksForDim(width, blockDim) * HuffmanUtil::numBlocksForDim(height, blockDim) * blockDim * blockDim;
+
+  return (numBlockSymbols <= 0x7FFFFFFF && header.numBytes == numBlockSymbols);
+}
+
+// Decode the block init plane section
+
+static
+HuffDecodeStatus
+decodePlane(
+            const HuffPreviewEncoded & encoded,
+            int planeWidth,
+            int planeHeight,
+            uint8_t *outPlane)
+{
+  const int groupDim = HUFF_PREVIEW_PLANE_GROUP_DIM;
+  const int planeNumValues = planeWidth * planeHeight;
+  const int paddedNumSymbols = paddedPlaneNumSymbols(planeNumValues);
+  const int numGroups = paddedNumSymbols / (groupDim * groupDim);
+
+  if (encoded.planeCanonHeader.size() != 256) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  if ((int) encoded.planeBitOffsets.size() != numGroups) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  vector<vector<uint8_t> > canonHeaders;
+  canonHeaders.push_back(encoded.planeCanonHeader);
+
+  vector<uint8_t> residuals(paddedNumSymbols);
+
+  HuffDecodeStatus status = HuffmanUtil::decodeHuffmanBlocksChecked(canonHeaders,
+                                                                    numGroups,
+                                                                    groupDim,
+                                                                    encoded.planeHuffCodes.data(),
+                                                                    (int) encoded.planeHuffCodes.size(),
+                                                                    encoded.planeBitOffsets.data(),
+                                                                    nullptr,
+                                                                    residuals.data(),
+                                                                    (int) residuals.size());
+
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  // Values are reconstructed in raster order, so the neighbors used by
+  // the predictor have already been written.
+
+  for ( int y = 0; y < planeHeight; y++ ) {
+    for ( int x = 0; x < planeWidth; x++ ) {
+      const int offset = (y * planeWidth) + x;
+      const int pred = predictPlaneValue(outPlane, planeWidth, x, y);
+      outPlane[offset] = (uint8_t) (residuals[offset] + pred);
+    }
+  }
+
+  return HUFF_DECODE_OK;
+}
+
+// Dimensions of the block init plane
+
+void
+HuffmanPreview::previewSize(
+                            int width,
+                            int height,
+                            int blockDim,
+                            int & outPreviewWidth,
+                            int & outPreviewHeight)
+{
+  outPreviewWidth = HuffmanUtil::numBlocksForDim(width, blockDim);
+  outPreviewHeight = HuffmanUtil::numBlocksForDim(height, blockDim);
+}
+
+// Encode an image with a block init plane section
+
+bool
+HuffmanPreview::encodeImage(
+                            const uint8_t *pixels,
+                            int width,
+                            int height,
+                            int blockDim,
+                            vector<uint8_t> & outFileHeader,
+                            HuffPreviewEncoded & outEncoded)
+{
+  HUFF_TRACE_SPAN("encode preview");
+
+  if (pixels == nullptr || width <= 0 || height <= 0 || !HuffmanUtil::isSupportedBlockDim(blockDim)) {
+    return false;
+  }
+
+  int planeWidth;
+  int planeHeight;
+  previewSize(width, height, blockDim, planeWidth, planeHeight);
+
+  const int numBlocks = planeWidth * planeHeight;
+  const int numBlockSymbols = numBlocks * blockDim * blockDim;
+
+  // Block deltas with the first delta of each block moved to the plane
+
+  vector<uint8_t> blockDeltas(numBlockSymbols);
+  vector<uint8_t> plane(numBlocks);
+
+  HuffmanBlockKernels::splitImageToBlockDeltas(pixels, blockDeltas.data(), plane.data(), width, height, blockDim, 0);
+
+  encodeSection(blockDeltas.data(), numBlockSymbols, blockDim, outEncoded.canonHeader, outEncoded.huffCodes, outEncoded.blockBitOffsets);
+
+  // Plane residuals, the padding after the last value is zero
+
+  vector<uint8_t> planeResiduals(paddedPlaneNumSymbols(numBlocks));
+
+  for ( int y = 0; y < planeHeight; y++ ) {
+    for ( int x = 0; x < planeWidth; x++ ) {
+      const int offset = (y * planeWidth) + x;
+      const int pred = predictPlaneValue(plane.data(), planeWidth, x, y);
+      planeResiduals[offset] = (uint8_t) (plane[offset] - pred);
+    }
+  }
+
+  encodeSection(planeResiduals.data(), (int) planeResiduals.size(), HUFF_PREVIEW_PLANE_GROUP_DIM, outEncoded.planeCanonHeader, outEncoded.planeHuffCodes, outEncoded.planeBitOffsets);
+
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, numBlockSymbols);
+  header.blockDim = blockDim;
+  header.blockInitPlane = 1;
+  HuffmanUtil::generateFileHeader(header, outFileHeader);
+
+  return true;
+}
+
+// Decode only the block init plane
+
+HuffDecodeStatus
+HuffmanPreview::decodePreview(
+                              const uint8_t *fileHeader,
+                              int fileHeaderN,
+                              const HuffPreviewEncoded & encoded,
+                              int width,
+                              int height,
+                              uint8_t *outPreview)
+{
+  HUFF_TRACE_SPAN("decode preview");
+
+  HuffFileHeader header;
+
+  if (outPreview == nullptr || !parsePreviewHeader(fileHeader, fileHeaderN, width, height, header)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  int planeWidth;
+  int planeHeight;
+  previewSize(width, height, header.blockDim, planeWidth, planeHeight);
+
+  return decodePlane(encoded, planeWidth, planeHeight, outPreview);
+}
+
+// Bilinear upsample, the value of block (bx, by) is at pixel
+// (bx * blockDim, by * blockDim) and pixels past the last block value
+// in a row or column repeat the edge value.
+
+void
+HuffmanPreview::upsamplePreview(
+                                const uint8_t *preview,
+                                int previewWidth,
+                                int previewHeight,
+                                int blockDim,
+                                int width,
+                                int height,
+                                uint8_t *outPixels)
+{
+  HUFF_TRACE_SPAN("upsample preview");
+
+#if defined(DEBUG)
+  assert(previewWidth > 0 && previewHeight > 0 && blockDim > 0);
+#endif // DEBUG
+
+  // Fixed point weights with blockDim steps between block values
+
+  for ( int y = 0; y < height; y++ ) {
+    int by0 = y / blockDim;
+    int fy = y % blockDim;
+
+    if (by0 >= previewHeight - 1) {
+      by0 = previewHeight - 1;
+      fy = 0;
+    }
+
+    const int by1 = (by0 + 1 < previewHeight) ? (by0 + 1) : by0;
+    const uint8_t *row0 = preview + (by0 * previewWidth);
+    const uint8_t *row1 = preview + (by1 * previewWidth);
+    uint8_t *outRow = outPixels + (y * width);
+
+    for ( int x = 0; x < width; x++ ) {
+      int bx0 = x / blockDim;
+      int fx = x % blockDim;
+
+      if (bx0 >= previewWidth - 1) {
+        bx0 = previewWidth - 1;
+        fx = 0;
+      }
+
+      const int bx1 = (bx0 + 1 < previewWidth) ? (bx0 + 1) : bx0;
+
+      const int top = (row0[bx0] * (blockDim - fx)) + (row0[bx1] * fx);
+      const int bottom = (row1[bx0] * (blockDim - fx)) + (row1[bx1] * fx);
+      const int sum = (top * (blockDim - fy)) + (bottom * fy);
+      const int scale = blockDim * blockDim;
+
+      outRow[x] = (uint8_t) ((sum + (scale / 2)) / scale);
+    }
+  }
+}
+
+// Decode the full image
+
+HuffDecodeStatus
+HuffmanPreview::decodeImage(
+                            const uint8_t *fileHeader,
+                            int fileHeaderN,
+                            const HuffPreviewEncoded & encoded,
+                            int width,
+                            int height,
+                            uint8_t *outPixels)
+{
+  HuffFileHeader header;
+
+  if (outPixels == nullptr || !parsePreviewHeader(fileHeader, fileHeaderN, width, height, header)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockDim = header.blockDim;
+
+  int planeWidth;
+  int planeHeight;
+  previewSize(width, height, blockDim, planeWidth, planeHeight);
+
+  const int numBlocks = planeWidth * planeHeight;
+  const int numBlockSymbols = numBlocks * blockDim * blockDim;
+
+  if ((int) encoded.blockBitOffsets.size() != numBlocks) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  if (encoded.canonHeader.size() != 256) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  vector<uint8_t> plane(numBlocks);
+
+  HuffDecodeStatus status = decodePlane(encoded, planeWidth, planeHeight, plane.data());
+
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  vector<vector<uint8_t> > canonHeaders;
+  canonHeaders.push_back(encoded.canonHeader);
+
+  vector<uint8_t> blockBytes(numBlockSymbols);
+
+  status = HuffmanUtil::decodeHuffmanBlocksChecked(canonHeaders,
+                                                   numBlocks,
+                                                   blockDim,
+                                                   encoded.huffCodes.data(),
+                                                   (int) encoded.huffCodes.size(),
+                                                   encoded.blockBitOffsets.data(),
+                                                   nullptr,
+                                                   blockBytes.data(),
+                                                   (int) blockBytes.size());
+
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  HuffmanBlockKernels::decodeBlockDeltas(blockBytes.data(), plane.data(), numBlocks, blockDim);
+  HuffmanBlockKernels::flattenBlocksToImage(blockBytes.data(), outPixels, width, height, blockDim);
+
+  return HUFF_DECODE_OK;
+}
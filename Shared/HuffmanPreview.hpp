@@ -0,0 +1,109 @@
+//
+//  HuffmanPreview.hpp
+//
+//  MIT Licensed
+//
+// Encoding with a stored block init plane. The first value of each
+// block is removed from the block deltas and collected into a plane of
+// (width / blockDim) x (height / blockDim) values, the top left pixel
+// of each block. The plane is entropy coded in its own small section,
+// so a preview of the image can be decoded without reading the huffman
+// codes of the blocks. This makes it possible to show a preview in a
+// scrubbing or gallery view while the full decode runs later.
+//
+// The block deltas are the HUFF_PREDICTOR_DELTA residuals with the
+// first delta of each block set to 0. The plane is predicted with MED
+// in raster order and the residuals are coded as groups of
+// HUFF_PREVIEW_PLANE_GROUP_DIM x HUFF_PREVIEW_PLANE_GROUP_DIM symbols
+// with the same canonical table and block bit offsets as an image.
+
+#ifndef HuffmanPreview_hpp
+#define HuffmanPreview_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+#define HUFF_PREVIEW_PLANE_GROUP_DIM 32
+
+// The encoded output for one image, the block init plane section is
+// stored after the block section.
+
+typedef struct {
+  vector<uint8_t> canonHeader;
+  vector<uint8_t> huffCodes;
+  vector<uint32_t> blockBitOffsets;
+  vector<uint8_t> planeCanonHeader;
+  vector<uint8_t> planeHuffCodes;
+  vector<uint32_t> planeBitOffsets;
+} HuffPreviewEncoded;
+
+class HuffmanPreview {
+
+public:
+
+  // Dimensions of the block init plane, one value for each block
+
+  static void
+  previewSize(
+              int width,
+              int height,
+              int blockDim,
+              int & outPreviewWidth,
+              int & outPreviewHeight);
+
+  // Encode a width x height image with a block init plane section.
+  // Returns false when the block dimension is not supported.
+
+  static bool
+  encodeImage(
+              const uint8_t *pixels,
+              int width,
+              int height,
+              int blockDim,
+              vector<uint8_t> & outFileHeader,
+              HuffPreviewEncoded & outEncoded);
+
+  // Decode only the block init plane into outPreview, which must hold
+  // previewSize() values. The block codes are not read.
+
+  static HuffDecodeStatus
+  decodePreview(
+                const uint8_t *fileHeader,
+                int fileHeaderN,
+                const HuffPreviewEncoded & encoded,
+                int width,
+                int height,
+                uint8_t *outPreview);
+
+  // Scale a preview up to width x height with bilinear filtering, each
+  // preview value is positioned at the top left pixel of its block.
+
+  static void
+  upsamplePreview(
+                  const uint8_t *preview,
+                  int previewWidth,
+                  int previewHeight,
+                  int blockDim,
+                  int width,
+                  int height,
+                  uint8_t *outPixels);
+
+  // Decode the full image, the block init plane is decoded first and
+  // then restores the first value of each block.
+
+  static HuffDecodeStatus
+  decodeImage(
+              const uint8_t *fileHeader,
+              int fileHeaderN,
+              const HuffPreviewEncoded & encoded,
+              int width,
+              int height,
+              uint8_t *outPixels);
+
+};
+
+#endif // HuffmanPreview_hpp
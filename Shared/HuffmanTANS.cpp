@@ -0,0 +1,633 @@
+// C++ impl of the table driven ANS entropy coder
+//  MIT Licensed
+
+#include "HuffmanTANS.hpp"
+
+#include "huff_util.hpp"
+#include "HuffmanTrace.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+
+#include <assert.h>
+
+using namespace std;
+
+// Encode table entry for one symbol, see FSE_symbolCompressionTransform
+
+typedef struct {
+  uint32_t deltaNumBits;
+  int32_t deltaFindState;
+} HuffTansSymbolTransform;
+
+// Index of the highest set bit
+
+static inline
+int
+highBitIndex(uint32_t value)
+{
+#if defined(DEBUG)
+  assert(value != 0);
+#endif // DEBUG
+
+  int index = 0;
+  while ((value >> (index + 1)) != 0) {
+    index += 1;
+  }
+  return index;
+}
+
+// Spread the states of each symbol over the table so that the states
+// of a symbol are not clustered. The step is odd, so every position of
+// the power of 2 table is visited once.
+
+static inline
+void
+spreadSymbols(const uint16_t *normalizedCounts,
+              int tableLog,
+              uint8_t *outTableSymbols)
+{
+  const int tableSize = 1 << tableLog;
+  const int tableMask = tableSize - 1;
+  const int step = (tableSize >> 1) + (tableSize >> 3) + 3;
+
+  int position = 0;
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    for ( int i = 0; i < normalizedCounts[symbol]; i++ ) {
+      outTableSymbols[position] = (uint8_t) symbol;
+      position = (position + step) & tableMask;
+    }
+  }
+
+#if defined(DEBUG)
+  assert(position == 0);
+#endif // DEBUG
+}
+
+// Normalize symbol counts, each count is scaled and rounded and then
+// single counts are moved between symbols where doing so costs the
+// fewest bits until the counts sum to the table size.
+
+bool
+HuffmanTANS::normalizeCounts(
+                             const uint32_t *frequencies,
+                             int tableLog,
+                             uint16_t *outNormalizedCounts)
+{
+  const int tableSize = 1 << tableLog;
+
+  uint64_t total = 0;
+  int numUsedSymbols = 0;
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    total += frequencies[symbol];
+    if (frequencies[symbol] > 0) {
+      numUsedSymbols += 1;
+    }
+  }
+
+  if (numUsedSymbols == 0 || numUsedSymbols > tableSize) {
+    return false;
+  }
+
+  int sum = 0;
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    const uint32_t freq = frequencies[symbol];
+    int count = 0;
+    if (freq > 0) {
+      count = (int) ((((uint64_t) freq * tableSize) + (total / 2)) / total);
+      if (count < 1) {
+        count = 1;
+      }
+    }
+    outNormalizedCounts[symbol] = (uint16_t) count;
+    sum += count;
+  }
+
+  while (sum != tableSize) {
+    int bestSymbol = -1;
+    double bestCost = 0.0;
+
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      const int count = outNormalizedCounts[symbol];
+      const uint32_t freq = frequencies[symbol];
+
+      if (freq == 0 || (sum > tableSize && count == 1)) {
+        continue;
+      }
+
+      // Change in the number of bits for this symbol
+
+      const int newCount = (sum > tableSize) ? (count - 1) : (count + 1);
+      const double cost = freq * log2((double) count / newCount);
+
+      if (bestSymbol == -1 || cost < bestCost) {
+        bestSymbol = symbol;
+        bestCost = cost;
+      }
+    }
+
+    if (sum > tableSize) {
+      outNormalizedCounts[bestSymbol] -= 1;
+      sum -= 1;
+    } else {
+      outNormalizedCounts[bestSymbol] += 1;
+      sum += 1;
+    }
+  }
+
+  return true;
+}
+
+// Estimate the total bits for each table log and keep the smallest
+
+int
+HuffmanTANS::selectTableLog(
+                            const uint32_t *frequencies,
+                            int numBlocks)
+{
+  int bestTableLog = HUFF_TANS_MAX_TABLE_LOG;
+  double bestNumBits = 0.0;
+  bool isFirst = true;
+
+  uint16_t normalizedCounts[256];
+
+  for ( int tableLog = HUFF_TANS_MIN_TABLE_LOG; tableLog <= HUFF_TANS_MAX_TABLE_LOG; tableLog++ ) {
+    if (!normalizeCounts(frequencies, tableLog, normalizedCounts)) {
+      continue;
+    }
+
+    double numBits = (double) numBlocks * tableLog;
+
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      if (frequencies[symbol] > 0) {
+        numBits += frequencies[symbol] * (tableLog - log2((double) normalizedCounts[symbol]));
+      }
+    }
+
+    if (isFirst || numBits < bestNumBits) {
+      bestTableLog = tableLog;
+      bestNumBits = numBits;
+      isFirst = false;
+    }
+  }
+
+  return bestTableLog;
+}
+
+// Encode each block in reverse so that the decoder reads the block
+// forward from its bit offset.
+
+void
+HuffmanTANS::encodeBlocks(
+                          const uint8_t *inBytes,
+                          int inNumBytes,
+                          int blockDim,
+                          vector<uint8_t> & outFileHeader,
+                          vector<uint8_t> & outTableHeader,
+                          vector<uint8_t> & outCodes,
+                          vector<uint32_t> & outBlockBitOffsets)
+{
+  HUFF_TRACE_SPAN("encode tans");
+  
+  const int debugOut = 0;
+
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numBlocks = inNumBytes / blockNumSymbols;
+
+  assert((inNumBytes % blockNumSymbols) == 0);
+
+  uint32_t frequencies[256];
+  memset(frequencies, 0, sizeof(frequencies));
+
+  for ( int i = 0; i < inNumBytes; i++ ) {
+    frequencies[inBytes[i]] += 1;
+  }
+
+  if (inNumBytes == 0) {
+    frequencies[0] = 1;
+  }
+
+  const int tableLog = selectTableLog(frequencies, numBlocks);
+  const int tableSize = 1 << tableLog;
+
+  uint16_t normalizedCounts[256];
+  normalizeCounts(frequencies, tableLog, normalizedCounts);
+
+  if (debugOut) {
+    printf("tableLog %d\n", tableLog);
+  }
+
+  // Encode tables, the states of each symbol are sorted by table
+  // position and the transform maps a state to the next state.
+
+  vector<uint8_t> tableSymbols(tableSize);
+  spreadSymbols(normalizedCounts, tableLog, tableSymbols.data());
+
+  vector<uint16_t> stateTable(tableSize);
+  HuffTansSymbolTransform symbolTransforms[256];
+
+  {
+    uint32_t cumulative[256];
+    uint32_t total = 0;
+
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      cumulative[symbol] = total;
+      total += normalizedCounts[symbol];
+    }
+
+    for ( int u = 0; u < tableSize; u++ ) {
+      const uint8_t symbol = tableSymbols[u];
+      stateTable[cumulative[symbol]++] = (uint16_t) (tableSize + u);
+    }
+
+    total = 0;
+
+    for ( int symbol = 0; symbol < 256; symbol++ ) {
+      const int count = normalizedCounts[symbol];
+      HuffTansSymbolTransform & transform = symbolTransforms[symbol];
+
+      if (count == 0) {
+        transform.deltaNumBits = 0;
+        transform.deltaFindState = 0;
+      } else if (count == 1) {
+        transform.deltaNumBits = (uint32_t) ((tableLog << 16) - tableSize);
+        transform.deltaFindState = (int32_t) total - 1;
+      } else {
+        const int maxBitsOut = tableLog - highBitIndex(count - 1);
+        const uint32_t minStatePlus = (uint32_t) count << maxBitsOut;
+        transform.deltaNumBits = (uint32_t) (maxBitsOut << 16) - minStatePlus;
+        transform.deltaFindState = (int32_t) total - count;
+      }
+
+      total += count;
+    }
+  }
+
+  // The state bits for each symbol are generated in reverse order, so
+  // they are saved and then written in decode order. The last symbol of
+  // a block sets the state without writing any bits.
+
+  vector<uint16_t> stateBits(inNumBytes);
+  vector<uint8_t> stateNumBits(inNumBytes);
+  vector<uint16_t> initialStates(numBlocks);
+
+  outBlockBitOffsets.resize(numBlocks);
+
+  uint64_t numBits = 0;
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+    uint16_t *blockStateBits = stateBits.data() + (blocki * blockNumSymbols);
+    uint8_t *blockStateNumBits = stateNumBits.data() + (blocki * blockNumSymbols);
+
+    outBlockBitOffsets[blocki] = (uint32_t) numBits;
+    numBits += tableLog;
+
+    const HuffTansSymbolTransform & lastTransform = symbolTransforms[blockPtr[blockNumSymbols - 1]];
+    const uint32_t lastNumBits = (lastTransform.deltaNumBits + (1 << 15)) >> 16;
+    const uint32_t lastValue = (lastNumBits << 16) - lastTransform.deltaNumBits;
+    uint32_t state = stateTable[(lastValue >> lastNumBits) + lastTransform.deltaFindState];
+
+    for ( int i = blockNumSymbols - 2; i >= 0; i-- ) {
+      const HuffTansSymbolTransform & transform = symbolTransforms[blockPtr[i]];
+      const uint32_t numBitsOut = (state + transform.deltaNumBits) >> 16;
+      blockStateBits[i] = (uint16_t) (state & ((1 << numBitsOut) - 1));
+      blockStateNumBits[i] = (uint8_t) numBitsOut;
+      numBits += numBitsOut;
+      state = stateTable[(state >> numBitsOut) + transform.deltaFindState];
+    }
+
+    initialStates[blocki] = (uint16_t) (state - tableSize);
+  }
+
+  assert(numBits <= UINT32_MAX);
+
+  // Whole bytes plus the +2 bytes of decoder read ahead padding
+
+  outCodes.assign(((numBits + 7) / 8) + 2, 0);
+
+  uint8_t *outCodesPtr = outCodes.data();
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint16_t *blockStateBits = stateBits.data() + (blocki * blockNumSymbols);
+    const uint8_t *blockStateNumBits = stateNumBits.data() + (blocki * blockNumSymbols);
+    uint32_t bitOffset = outBlockBitOffsets[blocki];
+
+    huff_write_code_bits(outCodesPtr, bitOffset, (uint16_t) (initialStates[blocki] << (16 - tableLog)), tableLog);
+    bitOffset += tableLog;
+
+    for ( int i = 0; i < (blockNumSymbols - 1); i++ ) {
+      const int numBitsOut = blockStateNumBits[i];
+      if (numBitsOut > 0) {
+        huff_write_code_bits(outCodesPtr, bitOffset, (uint16_t) (blockStateBits[i] << (16 - numBitsOut)), numBitsOut);
+        bitOffset += numBitsOut;
+      }
+    }
+  }
+
+  outTableHeader.resize(HUFF_TANS_TABLE_HEADER_NUM_BYTES);
+  outTableHeader[0] = (uint8_t) tableLog;
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    outTableHeader[1 + (symbol * 2)] = normalizedCounts[symbol] & 0xFF;
+    outTableHeader[1 + (symbol * 2) + 1] = (normalizedCounts[symbol] >> 8) & 0xFF;
+  }
+
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, inNumBytes);
+  header.blockDim = blockDim;
+  header.entropyCoder = HUFF_ENTROPY_TANS;
+  HuffmanUtil::generateFileHeader(header, outFileHeader);
+
+  return;
+}
+
+// Generate the decode table, each state holds its symbol and the base
+// of the range of next states selected by the state bits.
+
+HuffDecodeStatus
+HuffmanTANS::generateDecodeTable(
+                                 const uint8_t *tableHeader,
+                                 int tableHeaderN,
+                                 vector<HuffTansDecodeEntry> & outTable,
+                                 int & outTableLog)
+{
+  if (tableHeader == nullptr || tableHeaderN != HUFF_TANS_TABLE_HEADER_NUM_BYTES) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  const int tableLog = tableHeader[0];
+
+  if (tableLog < HUFF_TANS_MIN_TABLE_LOG || tableLog > HUFF_TANS_MAX_TABLE_LOG) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  const int tableSize = 1 << tableLog;
+
+  uint16_t normalizedCounts[256];
+  int sum = 0;
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    normalizedCounts[symbol] = tableHeader[1 + (symbol * 2)] | (tableHeader[1 + (symbol * 2) + 1] << 8);
+    sum += normalizedCounts[symbol];
+  }
+
+  if (sum != tableSize) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+
+  vector<uint8_t> tableSymbols(tableSize);
+  spreadSymbols(normalizedCounts, tableLog, tableSymbols.data());
+
+  uint32_t symbolNext[256];
+
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    symbolNext[symbol] = normalizedCounts[symbol];
+  }
+
+  outTable.resize(tableSize);
+
+  for ( int u = 0; u < tableSize; u++ ) {
+    const uint8_t symbol = tableSymbols[u];
+    const uint32_t nextState = symbolNext[symbol]++;
+    const int numBits = tableLog - highBitIndex(nextState);
+
+    HuffTansDecodeEntry & entry = outTable[u];
+    entry.symbol = symbol;
+    entry.numBits = (uint8_t) numBits;
+    entry.newStateBase = (uint16_t) ((nextState << numBits) - tableSize);
+  }
+
+  outTableLog = tableLog;
+
+  return HUFF_DECODE_OK;
+}
+
+// Decode the symbols of one block from its bit offset, the initial state
+// is read first and then the bits for each state transition. Returns the
+// bit offset after the last state transition.
+
+static inline
+uint32_t
+decodeBlockSymbols(
+                   const HuffTansDecodeEntry *table,
+                   int tableLog,
+                   const uint8_t *codes,
+                   uint32_t bitOffset,
+                   uint8_t *blockOutPtr,
+                   int blockNumSymbols)
+{
+  unsigned int numBitsRead = bitOffset;
+
+  uint32_t state = huff_read_code_bits(codes, numBitsRead) >> (16 - tableLog);
+  numBitsRead += tableLog;
+
+  for ( int i = 0; i < (blockNumSymbols - 1); i++ ) {
+    const HuffTansDecodeEntry entry = table[state];
+    blockOutPtr[i] = entry.symbol;
+    state = entry.newStateBase + (huff_read_code_bits(codes, numBitsRead) >> (16 - entry.numBits));
+    numBitsRead += entry.numBits;
+  }
+
+  blockOutPtr[blockNumSymbols - 1] = table[state].symbol;
+
+  return numBitsRead;
+}
+
+void
+HuffmanTANS::decodeBlocks(
+                          const HuffTansDecodeEntry *table,
+                          int tableLog,
+                          int numBlocks,
+                          int blockDim,
+                          const uint8_t *codes,
+                          const uint32_t *blockBitOffsets,
+                          uint8_t *outBuffer)
+{
+  HUFF_TRACE_SPAN("decode");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    decodeBlockSymbols(table, tableLog, codes, blockBitOffsets[blocki], outBuffer + (blocki * blockNumSymbols), blockNumSymbols);
+  }
+
+  return;
+}
+
+// Decode from untrusted input, a state transition reads at most tableLog
+// bits so a block fits in the 16 bits per symbol of the checked range
+// decode.
+
+HuffDecodeStatus
+HuffmanTANS::decodeBlocksChecked(
+                                 const uint8_t *tableHeader,
+                                 int tableHeaderN,
+                                 int numBlocks,
+                                 int blockDim,
+                                 const uint8_t *codes,
+                                 int codesN,
+                                 const uint32_t *blockBitOffsets,
+                                 uint8_t *outBuffer,
+                                 int outBufferN)
+{
+  HUFF_TRACE_SPAN("decode");
+
+  if (numBlocks < 0 || !HuffmanUtil::isSupportedBlockDim(blockDim)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  const int blockNumSymbols = blockDim * blockDim;
+
+  if (((int64_t) numBlocks * blockNumSymbols) > outBufferN) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  if (numBlocks == 0) {
+    return HUFF_DECODE_OK;
+  }
+
+  if (codes == nullptr || blockBitOffsets == nullptr || outBuffer == nullptr) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+
+  // The buffer must end with +2 bytes of read ahead padding
+
+  if (codesN < 2) {
+    return HUFF_DECODE_ERROR_PADDING;
+  }
+
+  vector<HuffTansDecodeEntry> table;
+  int tableLog;
+
+  HuffDecodeStatus status = generateDecodeTable(tableHeader, tableHeaderN, table, tableLog);
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  status = HuffmanUtil::validateBlockBitOffsets(blockBitOffsets, nullptr, numBlocks, 1, blockDim, codesN);
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+
+  const HuffTansDecodeEntry *tablePtr = table.data();
+
+  auto blockDecoder = [tablePtr, tableLog](int tableId, const uint8_t *blockCodes, uint32_t bitOffset, uint8_t *symbols, int numSymbols) -> uint32_t {
+    return decodeBlockSymbols(tablePtr, tableLog, blockCodes, bitOffset, symbols, numSymbols);
+  };
+
+  return HuffmanUtil::decodeBlockRangeChecked(blockDecoder,
+                                              numBlocks,
+                                              blockDim,
+                                              codes,
+                                              codesN,
+                                              blockBitOffsets,
+                                              nullptr,
+                                              0,
+                                              numBlocks,
+                                              outBuffer);
+}
+
+// Print the ratio and decode speed for huffman codes with a single
+// table and for tANS on the same block ordered input.
+
+void
+HuffmanTANS::printBenchmark(
+                            const char *name,
+                            const uint8_t *inBytes,
+                            int inNumBytes,
+                            int blockDim,
+                            int numIterations)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numBlocks = inNumBytes / blockNumSymbols;
+
+  vector<uint8_t> decodedBytes(inNumBytes);
+
+  // Huffman
+
+  vector<uint8_t> fileHeader;
+  vector<vector<uint8_t> > canonHeaders;
+  vector<uint8_t> huffCodes;
+  vector<uint32_t> blockBitOffsets;
+  vector<uint8_t> blockTableIds;
+
+  HuffmanUtil::encodeHuffmanMultipleTables((uint8_t *) inBytes,
+                                           inNumBytes,
+                                           fileHeader,
+                                           canonHeaders,
+                                           huffCodes,
+                                           blockBitOffsets,
+                                           blockTableIds,
+                                           blockDim,
+                                           1,
+                                           false,
+                                           -1);
+
+  vector<HuffLookupSymbol> table1;
+  vector<HuffLookupSymbol> table2;
+  HuffmanUtil::generateCheckedLookupTables(canonHeaders[0].data(), table1, table2);
+  HuffLookupSymbol *table1Ptr = table1.data();
+  HuffLookupSymbol *table2Ptr = table2.data();
+
+  auto startTime = chrono::steady_clock::now();
+
+  for ( int i = 0; i < numIterations; i++ ) {
+    HuffmanUtil::decodeHuffmanBlocksFromMultipleTables(&table1Ptr,
+                                                       &table2Ptr,
+                                                       numBlocks,
+                                                       blockDim,
+                                                       huffCodes.data(),
+                                                       (int) huffCodes.size(),
+                                                       blockBitOffsets.data(),
+                                                       blockTableIds.data(),
+                                                       decodedBytes.data());
+  }
+
+  double huffSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count() / numIterations;
+  bool huffSame = (memcmp(decodedBytes.data(), inBytes, inNumBytes) == 0);
+  size_t huffNumBytes = 256 + huffCodes.size() + (blockBitOffsets.size() * sizeof(uint32_t));
+
+  // tANS
+
+  vector<uint8_t> tableHeader;
+  vector<uint8_t> tansCodes;
+  vector<HuffTansDecodeEntry> decodeTable;
+  int tableLog;
+
+  encodeBlocks(inBytes, inNumBytes, blockDim, fileHeader, tableHeader, tansCodes, blockBitOffsets);
+  generateDecodeTable(tableHeader.data(), (int) tableHeader.size(), decodeTable, tableLog);
+
+  memset(decodedBytes.data(), 0, inNumBytes);
+
+  startTime = chrono::steady_clock::now();
+
+  for ( int i = 0; i < numIterations; i++ ) {
+    decodeBlocks(decodeTable.data(),
+                 tableLog,
+                 numBlocks,
+                 blockDim,
+                 tansCodes.data(),
+                 blockBitOffsets.data(),
+                 decodedBytes.data());
+  }
+
+  double tansSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count() / numIterations;
+  bool tansSame = (memcmp(decodedBytes.data(), inBytes, inNumBytes) == 0);
+  size_t tansNumBytes = tableHeader.size() + tansCodes.size() + (blockBitOffsets.size() * sizeof(uint32_t));
+
+  const double inMB = inNumBytes / (1024.0 * 1024.0);
+
+  printf("%s : %d bytes : %dx%d blocks\n", name, inNumBytes, blockDim, blockDim);
+  printf("  huffman : %d bytes : ratio %.3f : decode %.1f MB/s%s\n",
+         (int) huffNumBytes, (double) inNumBytes / huffNumBytes, inMB / huffSeconds, huffSame ? "" : " : MISMATCH");
+  printf("  tANS %2d : %d bytes : ratio %.3f : decode %.1f MB/s%s\n",
+         tableLog, (int) tansNumBytes, (double) inNumBytes / tansNumBytes, inMB / tansSeconds, tansSame ? "" : " : MISMATCH");
+}
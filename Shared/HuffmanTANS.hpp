@@ -0,0 +1,140 @@
+//
+//  HuffmanTANS.hpp
+//
+//  MIT Licensed
+//
+// Table driven ANS (tANS) entropy coder for block ordered symbols, an
+// alternative to the huffman codes selected with the entropyCoder
+// setting of the file header. The symbol counts are normalized to a
+// power of 2 table size and the symbol states are spread over the table
+// in the same way as FSE. Codes are not limited to a whole number of
+// bits, so skewed delta histograms compress better than with huffman.
+//
+// Each block is coded on its own: the block begins with the initial
+// decoder state in tableLog bits, followed by the state bits for each
+// symbol in decode order. The block bit offsets index works the same
+// way as for huffman blocks. Bits are written MSB first and the code
+// buffer ends with the same +2 bytes of read ahead padding.
+
+#ifndef HuffmanTANS_hpp
+#define HuffmanTANS_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+// Table size limits, a smaller table costs fewer bits for the initial
+// state of each block and a larger table approximates the symbol
+// probabilities more closely.
+
+#define HUFF_TANS_MIN_TABLE_LOG 5
+#define HUFF_TANS_MAX_TABLE_LOG 12
+
+// Table header, the table log followed by 256 little endian 16 bit
+// normalized counts that sum to (1 << tableLog).
+
+#define HUFF_TANS_TABLE_HEADER_NUM_BYTES (1 + (256 * 2))
+
+// Decode table entry for one state. The symbol is emitted and the next
+// state is newStateBase plus the next numBits bits.
+
+typedef struct {
+  uint16_t newStateBase;
+  uint8_t symbol;
+  uint8_t numBits;
+} HuffTansDecodeEntry;
+
+class HuffmanTANS {
+
+public:
+
+  // Normalize symbol counts so that they sum to (1 << tableLog), every
+  // symbol with a non zero count keeps a count of at least 1. Returns
+  // false when the table is too small for the number of used symbols.
+
+  static bool
+  normalizeCounts(
+                  const uint32_t *frequencies,
+                  int tableLog,
+                  uint16_t *outNormalizedCounts);
+
+  // Select the table log that generates the smallest output for the
+  // symbol counts, including the initial state stored for each block.
+
+  static int
+  selectTableLog(
+                 const uint32_t *frequencies,
+                 int numBlocks);
+
+  // Encode block ordered input, a file header with the entropyCoder
+  // setting of HUFF_ENTROPY_TANS and a table header are generated.
+
+  static void
+  encodeBlocks(
+               const uint8_t *inBytes,
+               int inNumBytes,
+               int blockDim,
+               vector<uint8_t> & outFileHeader,
+               vector<uint8_t> & outTableHeader,
+               vector<uint8_t> & outCodes,
+               vector<uint32_t> & outBlockBitOffsets);
+
+  // Generate the decode table from a table header. Returns
+  // HUFF_DECODE_ERROR_TABLE when the table log is out of range or the
+  // counts do not sum to the table size.
+
+  static HuffDecodeStatus
+  generateDecodeTable(
+                      const uint8_t *tableHeader,
+                      int tableHeaderN,
+                      vector<HuffTansDecodeEntry> & outTable,
+                      int & outTableLog);
+
+  // Decode block ordered symbols with a decode table. Note that this
+  // logic assumes that codes contains +2 bytes at the end of the
+  // buffer to account for read ahead and that the block bit offsets
+  // are valid, use decodeBlocksChecked for untrusted input.
+
+  static void
+  decodeBlocks(
+               const HuffTansDecodeEntry *table,
+               int tableLog,
+               int numBlocks,
+               int blockDim,
+               const uint8_t *codes,
+               const uint32_t *blockBitOffsets,
+               uint8_t *outBuffer);
+
+  // Decode block ordered symbols from untrusted input. The table header
+  // and the block bit offsets are validated with the same rules as
+  // decodeHuffmanBlocksChecked before anything is decoded.
+
+  static HuffDecodeStatus
+  decodeBlocksChecked(
+                      const uint8_t *tableHeader,
+                      int tableHeaderN,
+                      int numBlocks,
+                      int blockDim,
+                      const uint8_t *codes,
+                      int codesN,
+                      const uint32_t *blockBitOffsets,
+                      uint8_t *outBuffer,
+                      int outBufferN);
+
+  // Encode and decode a buffer with huffman codes and with tANS and
+  // print the compression ratio and decode speed of each coder.
+
+  static void
+  printBenchmark(
+                 const char *name,
+                 const uint8_t *inBytes,
+                 int inNumBytes,
+                 int blockDim,
+                 int numIterations);
+
+};
+
+#endif // HuffmanTANS_hpp
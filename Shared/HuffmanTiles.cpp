@@ -0,0 +1,490 @@
+// C++ impl of tiled encoding and streaming viewport decoding
+//  MIT Licensed
+
+#include "HuffmanTiles.hpp"
+
+#include "HuffmanEncoderContext.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <assert.h>
+
+using namespace std;
+
+// Bytes in the tile header that follows the file header and in each
+// tile index entry.
+
+#define HUFF_TILE_HEADER_NUM_BYTES (sizeof(uint32_t) * 3)
+#define HUFF_TILE_INDEX_ENTRY_NUM_BYTES (sizeof(uint64_t) + sizeof(uint32_t))
+
+static inline
+void
+writeLittleEndian(uint8_t *outPtr, uint64_t value, int numBytes)
+{
+  for ( int i = 0; i < numBytes; i++ ) {
+    outPtr[i] = (value >> (i * 8)) & 0xFF;
+  }
+}
+
+static inline
+uint64_t
+readLittleEndian(const uint8_t *inPtr, int numBytes)
+{
+  uint64_t value = 0;
+  for ( int i = 0; i < numBytes; i++ ) {
+    value |= ((uint64_t) inPtr[i]) << (i * 8);
+  }
+  return value;
+}
+
+// Number of tiles or blocks needed to cover one dimension
+
+static inline
+int
+numUnitsForDim(int dim, int unitDim)
+{
+  return (dim + unitDim - 1) / unitDim;
+}
+
+// Dimensions of a tile, tiles along the right and bottom edges are cropped
+
+static inline
+void
+tileSize(int width, int height, int tileDim, int tileX, int tileY, int & outTileWidth, int & outTileHeight)
+{
+  outTileWidth = min(tileDim, width - (tileX * tileDim));
+  outTileHeight = min(tileDim, height - (tileY * tileDim));
+}
+
+// Encode each tile in raster order and write the tile index last
+
+bool
+HuffmanTiles::encodeTiledImage(
+                               const uint8_t *pixels,
+                               int width,
+                               int height,
+                               int tileDim,
+                               int blockDim,
+                               HuffPredictor predictor,
+                               FILE *outFile)
+{
+  if (pixels == nullptr || outFile == nullptr || width <= 0 || height <= 0 ||
+      !HuffmanUtil::isSupportedBlockDim(blockDim) ||
+      tileDim <= 0 || tileDim > HUFF_MAX_TILE_DIM || (tileDim % blockDim) != 0 ||
+      predictor >= HUFF_PREDICTOR_NUM) {
+    return false;
+  }
+  
+  const int numTilesX = numUnitsForDim(width, tileDim);
+  const int numTilesY = numUnitsForDim(height, tileDim);
+  const int numTiles = numTilesX * numTilesY;
+  
+  // The file header numBytes is 0, the image dimensions are in the tile header
+  
+  HuffFileHeader header;
+  HuffmanUtil::initFileHeader(header, 0);
+  header.blockDim = blockDim;
+  header.predictor = predictor;
+  
+  vector<uint8_t> headerBytes;
+  HuffmanUtil::generateFileHeader(header, headerBytes);
+  
+  const size_t fileHeaderNumBytes = headerBytes.size();
+  
+  headerBytes.resize(fileHeaderNumBytes + HUFF_TILE_HEADER_NUM_BYTES);
+  writeLittleEndian(headerBytes.data() + fileHeaderNumBytes, width, 4);
+  writeLittleEndian(headerBytes.data() + fileHeaderNumBytes + 4, height, 4);
+  writeLittleEndian(headerBytes.data() + fileHeaderNumBytes + 8, tileDim, 4);
+  
+  vector<uint8_t> indexBytes(numTiles * HUFF_TILE_INDEX_ENTRY_NUM_BYTES);
+  
+  const off_t startOffset = ftello(outFile);
+  
+  if (startOffset < 0 ||
+      fwrite(headerBytes.data(), 1, headerBytes.size(), outFile) != headerBytes.size() ||
+      fwrite(indexBytes.data(), 1, indexBytes.size(), outFile) != indexBytes.size()) {
+    return false;
+  }
+  
+  uint64_t payloadOffset = headerBytes.size() + indexBytes.size();
+  
+  // Buffers for one tile, reused for every tile
+  
+  const int maxTileNumBytes = tileDim * tileDim;
+  
+  vector<uint8_t> tileBuffer(maxTileNumBytes);
+  vector<uint8_t> blockBuffer(maxTileNumBytes);
+  vector<uint8_t> residualsBuffer(maxTileNumBytes);
+  vector<uint8_t> blockPredictors;
+  
+  HuffmanEncoderContext context;
+  
+  for ( int tileY = 0; tileY < numTilesY; tileY++ ) {
+    for ( int tileX = 0; tileX < numTilesX; tileX++ ) {
+      int tileWidth, tileHeight;
+      tileSize(width, height, tileDim, tileX, tileY, tileWidth, tileHeight);
+      
+      for ( int row = 0; row < tileHeight; row++ ) {
+        const size_t pixelOffset = ((size_t) (tileY * tileDim + row) * width) + (tileX * tileDim);
+        memcpy(tileBuffer.data() + (row * tileWidth), pixels + pixelOffset, tileWidth);
+      }
+      
+      const int numBlocks = numUnitsForDim(tileWidth, blockDim) * numUnitsForDim(tileHeight, blockDim);
+      const int numBlockBytes = numBlocks * blockDim * blockDim;
+      
+      HuffmanUtil::splitImageToBlocks(tileBuffer.data(), blockBuffer.data(), tileWidth, tileHeight, blockDim, HUFF_SCAN_RASTER, 0);
+      HuffmanUtil::encodePredictedBlocks(blockBuffer.data(), residualsBuffer.data(), numBlocks, blockDim, predictor, blockPredictors);
+      
+      context.reset();
+      const int outputi = context.encode(residualsBuffer.data(), numBlockBytes, blockDim);
+      
+      const uint32_t numOffsetBytes = numBlocks * sizeof(uint32_t);
+      const uint32_t numCodeBytes = context.numHuffCodeBytes(outputi);
+      
+      // Block offsets are written in host order, which is little
+      // endian on every platform this project runs on.
+      
+      if (fwrite(context.canonHeader(outputi), 1, 256, outFile) != 256 ||
+          fwrite(context.blockBitOffsets(outputi), 1, numOffsetBytes, outFile) != numOffsetBytes ||
+          fwrite(context.huffCodes(outputi), 1, numCodeBytes, outFile) != numCodeBytes) {
+        return false;
+      }
+      
+      const uint32_t payloadNumBytes = 256 + numOffsetBytes + numCodeBytes;
+      uint8_t *entryPtr = indexBytes.data() + ((tileY * numTilesX + tileX) * HUFF_TILE_INDEX_ENTRY_NUM_BYTES);
+      writeLittleEndian(entryPtr, payloadOffset, 8);
+      writeLittleEndian(entryPtr + 8, payloadNumBytes, 4);
+      
+      payloadOffset += payloadNumBytes;
+    }
+  }
+  
+  // Go back and fill in the tile index
+  
+  if (fseeko(outFile, startOffset + headerBytes.size(), SEEK_SET) != 0 ||
+      fwrite(indexBytes.data(), 1, indexBytes.size(), outFile) != indexBytes.size() ||
+      fseeko(outFile, 0, SEEK_END) != 0) {
+    return false;
+  }
+  
+  return true;
+}
+
+HuffmanTileReader::HuffmanTileReader()
+{
+  file = nullptr;
+  imageWidth = 0;
+  imageHeight = 0;
+  imageTileDim = 0;
+  numTilesX = 0;
+  numTilesY = 0;
+  maxNumCachedTiles = 0;
+  numDecoded = 0;
+}
+
+HuffmanTileReader::~HuffmanTileReader()
+{
+  close();
+}
+
+// Read and validate the header and the tile index
+
+bool
+HuffmanTileReader::open(const char *path, size_t memoryBudget)
+{
+  close();
+  
+  file = fopen(path, "rb");
+  
+  if (file == nullptr) {
+    return false;
+  }
+  
+  if (fseeko(file, 0, SEEK_END) != 0) {
+    close();
+    return false;
+  }
+  
+  const off_t fileNumBytes = ftello(file);
+  
+  // Read the file header and settings count first, then the settings
+  // and the tile header.
+  
+  uint8_t headerBytes[9 + 255 + HUFF_TILE_HEADER_NUM_BYTES];
+  
+  if (fileNumBytes < 9 || fseeko(file, 0, SEEK_SET) != 0 || fread(headerBytes, 1, 9, file) != 9) {
+    close();
+    return false;
+  }
+  
+  const int fileHeaderNumBytes = 9 + headerBytes[8];
+  
+  if (fread(headerBytes + 9, 1, fileHeaderNumBytes - 9 + HUFF_TILE_HEADER_NUM_BYTES, file) != (fileHeaderNumBytes - 9 + HUFF_TILE_HEADER_NUM_BYTES) ||
+      !HuffmanUtil::parseFileHeader(headerBytes, fileHeaderNumBytes, header) ||
+      header.numBytes != 0 || header.predictor >= HUFF_PREDICTOR_NUM) {
+    close();
+    return false;
+  }
+  
+  const uint64_t width = readLittleEndian(headerBytes + fileHeaderNumBytes, 4);
+  const uint64_t height = readLittleEndian(headerBytes + fileHeaderNumBytes + 4, 4);
+  const uint64_t tileDim = readLittleEndian(headerBytes + fileHeaderNumBytes + 8, 4);
+  
+  if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX ||
+      tileDim == 0 || tileDim > HUFF_MAX_TILE_DIM || (tileDim % header.blockDim) != 0) {
+    close();
+    return false;
+  }
+  
+  imageWidth = (int) width;
+  imageHeight = (int) height;
+  imageTileDim = (int) tileDim;
+  numTilesX = numUnitsForDim(imageWidth, imageTileDim);
+  numTilesY = numUnitsForDim(imageHeight, imageTileDim);
+  
+  const uint64_t numTiles = (uint64_t) numTilesX * numTilesY;
+  const uint64_t indexOffset = fileHeaderNumBytes + HUFF_TILE_HEADER_NUM_BYTES;
+  const uint64_t indexNumBytes = numTiles * HUFF_TILE_INDEX_ENTRY_NUM_BYTES;
+  
+  if ((indexOffset + indexNumBytes) > (uint64_t) fileNumBytes) {
+    close();
+    return false;
+  }
+  
+  vector<uint8_t> indexBytes(indexNumBytes);
+  
+  if (fread(indexBytes.data(), 1, indexNumBytes, file) != indexNumBytes) {
+    close();
+    return false;
+  }
+  
+  // Each payload must be inside the file and large enough to hold the
+  // canonical header, the block offsets and the read ahead padding.
+  
+  tileIndex.resize(numTiles);
+  
+  uint32_t maxPayloadNumBytes = 0;
+  
+  for ( int tileY = 0; tileY < numTilesY; tileY++ ) {
+    for ( int tileX = 0; tileX < numTilesX; tileX++ ) {
+      const int tilei = tileY * numTilesX + tileX;
+      const uint8_t *entryPtr = indexBytes.data() + (tilei * HUFF_TILE_INDEX_ENTRY_NUM_BYTES);
+      HuffTileIndexEntry & entry = tileIndex[tilei];
+      entry.offset = readLittleEndian(entryPtr, 8);
+      entry.numBytes = (uint32_t) readLittleEndian(entryPtr + 8, 4);
+      
+      int tileWidth, tileHeight;
+      tileSize(imageWidth, imageHeight, imageTileDim, tileX, tileY, tileWidth, tileHeight);
+      const uint64_t numBlocks = numUnitsForDim(tileWidth, header.blockDim) * numUnitsForDim(tileHeight, header.blockDim);
+      
+      if (entry.offset > (uint64_t) fileNumBytes ||
+          entry.numBytes > ((uint64_t) fileNumBytes - entry.offset) ||
+          entry.numBytes < (256 + (numBlocks * sizeof(uint32_t)) + 2)) {
+        close();
+        return false;
+      }
+      
+      maxPayloadNumBytes = max(maxPayloadNumBytes, entry.numBytes);
+    }
+  }
+  
+  // Decode buffers are sized for the largest tile, the rest of the
+  // memory budget holds decoded tiles.
+  
+  const size_t tileNumBytes = (size_t) imageTileDim * imageTileDim;
+  
+  payloadBuffer.resize(maxPayloadNumBytes);
+  residualsBuffer.resize(tileNumBytes);
+  valuesBuffer.resize(tileNumBytes);
+  blockPredictors.assign(tileNumBytes / (header.blockDim * header.blockDim), header.predictor);
+  canonHeaders.resize(1);
+  
+  const size_t buffersNumBytes = payloadBuffer.size() + residualsBuffer.size() + valuesBuffer.size();
+  
+  if (memoryBudget > buffersNumBytes) {
+    maxNumCachedTiles = (int) min((size_t) INT32_MAX, (memoryBudget - buffersNumBytes) / tileNumBytes);
+  }
+  
+  if (maxNumCachedTiles < 1) {
+    maxNumCachedTiles = 1;
+  }
+  
+  return true;
+}
+
+void
+HuffmanTileReader::close()
+{
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+  }
+  
+  tileIndex.clear();
+  cachedTiles.clear();
+  cachedTileLookup.clear();
+  maxNumCachedTiles = 0;
+  numDecoded = 0;
+}
+
+int
+HuffmanTileReader::width() const
+{
+  return imageWidth;
+}
+
+int
+HuffmanTileReader::height() const
+{
+  return imageHeight;
+}
+
+int
+HuffmanTileReader::tileDim() const
+{
+  return imageTileDim;
+}
+
+int
+HuffmanTileReader::numTilesDecoded() const
+{
+  return numDecoded;
+}
+
+// Read one tile payload and decode it to raster pixels that are
+// tileWidth bytes per row.
+
+bool
+HuffmanTileReader::decodeTile(int tilei, uint8_t *outTilePixels)
+{
+  const HuffTileIndexEntry & entry = tileIndex[tilei];
+  const int blockDim = header.blockDim;
+  
+  int tileWidth, tileHeight;
+  tileSize(imageWidth, imageHeight, imageTileDim, tilei % numTilesX, tilei / numTilesX, tileWidth, tileHeight);
+  
+  const int numBlocks = numUnitsForDim(tileWidth, blockDim) * numUnitsForDim(tileHeight, blockDim);
+  const int numBlockBytes = numBlocks * blockDim * blockDim;
+  
+  if (fseeko(file, (off_t) entry.offset, SEEK_SET) != 0 ||
+      fread(payloadBuffer.data(), 1, entry.numBytes, file) != entry.numBytes) {
+    return false;
+  }
+  
+  const uint8_t *payloadPtr = payloadBuffer.data();
+  const uint32_t *blockBitOffsets = (const uint32_t *) (payloadPtr + 256);
+  const uint8_t *huffCodes = payloadPtr + 256 + (numBlocks * sizeof(uint32_t));
+  const int huffCodesN = entry.numBytes - 256 - (numBlocks * sizeof(uint32_t));
+  
+  canonHeaders[0].assign(payloadPtr, payloadPtr + 256);
+  
+  HuffDecodeStatus status = HuffmanUtil::decodeHuffmanBlocksChecked(canonHeaders,
+                                                                    numBlocks,
+                                                                    blockDim,
+                                                                    huffCodes,
+                                                                    huffCodesN,
+                                                                    blockBitOffsets,
+                                                                    nullptr,
+                                                                    residualsBuffer.data(),
+                                                                    numBlockBytes);
+  
+  if (status != HUFF_DECODE_OK) {
+    return false;
+  }
+  
+  HuffmanUtil::decodePredictedBlocks(residualsBuffer.data(), valuesBuffer.data(), numBlocks, blockDim, blockPredictors.data());
+  HuffmanUtil::flattenBlocksToImage(valuesBuffer.data(), outTilePixels, tileWidth, tileHeight, blockDim, HUFF_SCAN_RASTER);
+  
+  numDecoded += 1;
+  
+  return true;
+}
+
+// Return the decoded pixels for a tile, decoding the tile when it is not
+// cached. The least recently used tile buffer is reused for the new tile.
+
+const uint8_t *
+HuffmanTileReader::tilePixels(int tilei)
+{
+  auto it = cachedTileLookup.find(tilei);
+  
+  if (it != cachedTileLookup.end()) {
+    cachedTiles.splice(cachedTiles.begin(), cachedTiles, it->second);
+    return cachedTiles.front().second.data();
+  }
+  
+  vector<uint8_t> pixels;
+  
+  if ((int) cachedTiles.size() >= maxNumCachedTiles) {
+    cachedTileLookup.erase(cachedTiles.back().first);
+    pixels = std::move(cachedTiles.back().second);
+    cachedTiles.pop_back();
+  }
+  
+  pixels.resize((size_t) imageTileDim * imageTileDim);
+  
+  if (!decodeTile(tilei, pixels.data())) {
+    return nullptr;
+  }
+  
+  cachedTiles.emplace_front(tilei, std::move(pixels));
+  cachedTileLookup[tilei] = cachedTiles.begin();
+  
+  return cachedTiles.front().second.data();
+}
+
+// Copy the part of each tile that overlaps the viewport
+
+bool
+HuffmanTileReader::decodeViewport(
+                                  int x,
+                                  int y,
+                                  int viewportWidth,
+                                  int viewportHeight,
+                                  uint8_t *outPixels)
+{
+  if (file == nullptr || x < 0 || y < 0 || viewportWidth <= 0 || viewportHeight <= 0 ||
+      viewportWidth > (imageWidth - x) || viewportHeight > (imageHeight - y)) {
+    return false;
+  }
+  
+  const int firstTileX = x / imageTileDim;
+  const int lastTileX = (x + viewportWidth - 1) / imageTileDim;
+  const int firstTileY = y / imageTileDim;
+  const int lastTileY = (y + viewportHeight - 1) / imageTileDim;
+  
+  for ( int tileY = firstTileY; tileY <= lastTileY; tileY++ ) {
+    for ( int tileX = firstTileX; tileX <= lastTileX; tileX++ ) {
+      const uint8_t *tilePtr = tilePixels(tileY * numTilesX + tileX);
+      
+      if (tilePtr == nullptr) {
+        return false;
+      }
+      
+      int tileWidth, tileHeight;
+      tileSize(imageWidth, imageHeight, imageTileDim, tileX, tileY, tileWidth, tileHeight);
+      
+      // Intersection of the tile and the viewport in image coordinates
+      
+      const int tileOriginX = tileX * imageTileDim;
+      const int tileOriginY = tileY * imageTileDim;
+      const int minX = max(x, tileOriginX);
+      const int maxX = min(x + viewportWidth, tileOriginX + tileWidth);
+      const int minY = max(y, tileOriginY);
+      const int maxY = min(y + viewportHeight, tileOriginY + tileHeight);
+      
+      for ( int row = minY; row < maxY; row++ ) {
+        memcpy(outPixels + ((size_t) (row - y) * viewportWidth) + (minX - x),
+               tilePtr + ((row - tileOriginY) * tileWidth) + (minX - tileOriginX),
+               maxX - minX);
+      }
+    }
+  }
+  
+  return true;
+}
@@ -0,0 +1,142 @@
+//
+//  HuffmanTiles.hpp
+//
+//  MIT Licensed
+//
+// Tiled encoding for images that are too large to encode or decode as
+// one buffer. The image is split into a grid of independent tiles and
+// each tile has its own canonical table and block bit offsets, so a
+// tile can be decoded without reading any other tile. A tile is at
+// most 4096 pixels wide so that a tile fits in one GPU texture.
+//
+// File layout, all values are little endian:
+//
+//   file header, numBytes is 0 and blockDim and predictor are set
+//   uint32 width, uint32 height, uint32 tileDim
+//   tile index, one uint64 file offset and uint32 length per tile
+//   tile payloads
+//
+// Each tile payload is the 256 byte canonical header, one uint32 bit
+// offset per block and then the huffman codes with +2 bytes of padding.
+
+#ifndef HuffmanTiles_hpp
+#define HuffmanTiles_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+#include "HuffmanUtil.hpp"
+
+using namespace std;
+
+#define HUFF_MAX_TILE_DIM 4096
+
+// Location of one tile payload in the file
+
+typedef struct {
+  uint64_t offset;
+  uint32_t numBytes;
+} HuffTileIndexEntry;
+
+class HuffmanTiles {
+
+public:
+
+  // Encode a width x height grayscale image as tiles of tileDim x tileDim
+  // pixels. tileDim must be a multiple of blockDim and at most
+  // HUFF_MAX_TILE_DIM. Tile payloads are written to outFile as each tile
+  // is encoded, so only one tile is held in memory. Returns false when
+  // the arguments are not valid or a write fails.
+  
+  static bool
+  encodeTiledImage(
+                   const uint8_t *pixels,
+                   int width,
+                   int height,
+                   int tileDim,
+                   int blockDim,
+                   HuffPredictor predictor,
+                   FILE *outFile);
+
+};
+
+// Streaming decoder that reads only the tiles that cover a viewport.
+// Decoded tiles are kept in a least recently used cache that is sized
+// so that the cache and the decode buffers fit in memoryBudget bytes.
+// At least one tile is always cached.
+
+class HuffmanTileReader {
+
+public:
+  
+  HuffmanTileReader();
+  
+  ~HuffmanTileReader();
+  
+  // Open a tiled file and read the header and tile index. Returns
+  // false when the file cannot be read or is not a valid tiled file.
+  
+  bool open(const char *path, size_t memoryBudget);
+  
+  void close();
+  
+  int width() const;
+  
+  int height() const;
+  
+  int tileDim() const;
+  
+  // Decode the (viewportWidth x viewportHeight) region at (x, y) into
+  // outPixels, a raster buffer of viewportWidth bytes per row. Returns
+  // false when the region is outside the image or a tile is corrupt.
+  
+  bool decodeViewport(
+                      int x,
+                      int y,
+                      int viewportWidth,
+                      int viewportHeight,
+                      uint8_t *outPixels);
+  
+  // Number of tiles decoded since open(), cache hits are not counted
+  
+  int numTilesDecoded() const;
+  
+private:
+  
+  FILE *file;
+  
+  HuffFileHeader header;
+  int imageWidth;
+  int imageHeight;
+  int imageTileDim;
+  int numTilesX;
+  int numTilesY;
+  
+  vector<HuffTileIndexEntry> tileIndex;
+  
+  // Buffers reused for every tile decode
+  
+  vector<uint8_t> payloadBuffer;
+  vector<uint8_t> residualsBuffer;
+  vector<uint8_t> valuesBuffer;
+  vector<uint8_t> blockPredictors;
+  vector<vector<uint8_t> > canonHeaders;
+  
+  // Cache of decoded tiles, most recently used first
+  
+  int maxNumCachedTiles;
+  list<pair<int, vector<uint8_t> > > cachedTiles;
+  unordered_map<int, list<pair<int, vector<uint8_t> > >::iterator> cachedTileLookup;
+  
+  int numDecoded;
+  
+  const uint8_t * tilePixels(int tilei);
+  
+  bool decodeTile(int tilei, uint8_t *outTilePixels);
+  
+};
+
+#endif // HuffmanTiles_hpp
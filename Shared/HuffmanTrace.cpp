@@ -0,0 +1,228 @@
+//
+//  HuffmanTrace.cpp
+//
+//  MIT Licensed
+//
+
+#include "HuffmanTrace.hpp"
+
+#include <stdio.h>
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+// Spans recorded by one thread. Only the owning thread writes events,
+// the count is published with a release store so that an export on
+// another thread reads whole events.
+
+typedef struct {
+  int threadIndex;
+  atomic<uint32_t> numEvents;
+  atomic<uint64_t> numDropped;
+  HuffTraceEvent events[HUFF_TRACE_MAX_EVENTS_PER_THREAD];
+} HuffTraceThreadBuffer;
+
+atomic<bool> HuffmanTrace::enabledFlag(false);
+
+// Buffers are kept after a thread exits so that its spans can still be
+// exported, the registry lock is only taken to add a buffer and export.
+
+static mutex traceRegistryLock;
+
+static vector<HuffTraceThreadBuffer*> traceThreadBuffers;
+
+static thread_local HuffTraceThreadBuffer *traceThreadBuffer = NULL;
+
+static
+HuffTraceThreadBuffer *
+registerThreadBuffer()
+{
+  HuffTraceThreadBuffer *buffer = new HuffTraceThreadBuffer();
+  buffer->numEvents.store(0);
+  buffer->numDropped.store(0);
+
+  lock_guard<mutex> guard(traceRegistryLock);
+  buffer->threadIndex = (int) traceThreadBuffers.size();
+  traceThreadBuffers.push_back(buffer);
+
+  return buffer;
+}
+
+void
+HuffmanTrace::setEnabled(bool enabled)
+{
+  // Start the clock so that timestamps begin near 0
+  nowNanos();
+  enabledFlag.store(enabled);
+}
+
+// Nanoseconds since the first use of the trace clock
+
+uint64_t
+HuffmanTrace::nowNanos()
+{
+  static const chrono::steady_clock::time_point baseTime = chrono::steady_clock::now();
+  return (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - baseTime).count();
+}
+
+// Record a span in the buffer of the calling thread
+
+void
+HuffmanTrace::recordSpan(const char *name, uint64_t startNanos, uint64_t endNanos)
+{
+  HuffTraceThreadBuffer *buffer = traceThreadBuffer;
+
+  if (buffer == NULL) {
+    buffer = registerThreadBuffer();
+    traceThreadBuffer = buffer;
+  }
+
+  const uint32_t eventi = buffer->numEvents.load(memory_order_relaxed);
+
+  if (eventi >= HUFF_TRACE_MAX_EVENTS_PER_THREAD) {
+    buffer->numDropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+
+  HuffTraceEvent & event = buffer->events[eventi];
+  event.name = name;
+  event.startNanos = startNanos;
+  event.durationNanos = endNanos - startNanos;
+
+  buffer->numEvents.store(eventi + 1, memory_order_release);
+}
+
+// Discard the recorded spans
+
+void
+HuffmanTrace::reset()
+{
+  lock_guard<mutex> guard(traceRegistryLock);
+
+  for ( HuffTraceThreadBuffer *buffer : traceThreadBuffers ) {
+    buffer->numEvents.store(0);
+    buffer->numDropped.store(0);
+  }
+}
+
+int
+HuffmanTrace::numEvents()
+{
+  lock_guard<mutex> guard(traceRegistryLock);
+
+  int numEvents = 0;
+
+  for ( HuffTraceThreadBuffer *buffer : traceThreadBuffers ) {
+    numEvents += (int) buffer->numEvents.load(memory_order_acquire);
+  }
+
+  return numEvents;
+}
+
+uint64_t
+HuffmanTrace::numDroppedEvents()
+{
+  lock_guard<mutex> guard(traceRegistryLock);
+
+  uint64_t numDropped = 0;
+
+  for ( HuffTraceThreadBuffer *buffer : traceThreadBuffers ) {
+    numDropped += buffer->numDropped.load(memory_order_relaxed);
+  }
+
+  return numDropped;
+}
+
+// Append a string with the JSON escapes needed for a span name
+
+static
+void
+appendJSONString(string & outJSON, const char *str)
+{
+  outJSON += '"';
+
+  for ( const char *ptr = str; *ptr != '\0'; ptr++ ) {
+    const char c = *ptr;
+
+    if (c == '"' || c == '\\') {
+      outJSON += '\\';
+      outJSON += c;
+    } else if ((unsigned char) c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int) c);
+      outJSON += escaped;
+    } else {
+      outJSON += c;
+    }
+  }
+
+  outJSON += '"';
+}
+
+// Export as Chrome trace JSON, each span is a complete ("X") event with
+// the timestamp and duration in microseconds.
+
+void
+HuffmanTrace::writeChromeTrace(string & outJSON)
+{
+  lock_guard<mutex> guard(traceRegistryLock);
+
+  outJSON = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+  bool isFirst = true;
+  char line[128];
+
+  for ( HuffTraceThreadBuffer *buffer : traceThreadBuffers ) {
+    const uint32_t numEvents = buffer->numEvents.load(memory_order_acquire);
+
+    if (numEvents == 0) {
+      continue;
+    }
+
+    if (!isFirst) {
+      outJSON += ",";
+    }
+    isFirst = false;
+
+    snprintf(line, sizeof(line),
+             "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"huffman %d\"}}",
+             buffer->threadIndex, buffer->threadIndex);
+    outJSON += line;
+
+    for ( uint32_t eventi = 0; eventi < numEvents; eventi++ ) {
+      const HuffTraceEvent & event = buffer->events[eventi];
+
+      outJSON += ",\n{\"name\":";
+      appendJSONString(outJSON, event.name);
+
+      snprintf(line, sizeof(line),
+               ",\"cat\":\"huffman\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+               event.startNanos / 1000.0, event.durationNanos / 1000.0, buffer->threadIndex);
+      outJSON += line;
+    }
+  }
+
+  outJSON += "\n]}\n";
+}
+
+bool
+HuffmanTrace::writeChromeTraceFile(const char *path)
+{
+  string json;
+  writeChromeTrace(json);
+
+  FILE *outFile = fopen(path, "wb");
+
+  if (outFile == NULL) {
+    return false;
+  }
+
+  bool worked = (fwrite(json.data(), 1, json.size(), outFile) == json.size());
+
+  if (fclose(outFile) != 0) {
+    worked = false;
+  }
+
+  return worked;
+}
@@ -0,0 +1,131 @@
+//
+//  HuffmanTrace.hpp
+//
+//  MIT Licensed
+//
+// Lightweight timing trace for the encode and decode stages. A scoped
+// span records the start time and duration of a stage, for example the
+// histogram, tree build or block decode, into a buffer owned by the
+// thread that ran the stage. Recording does not take a lock, the only
+// lock is taken the first time a thread records a span.
+//
+// Tracing is off until setEnabled(true) is called, a disabled span only
+// reads one flag. Define HUFF_DISABLE_TRACE to compile the spans out.
+// The recorded spans are exported in the Chrome trace event format, the
+// JSON can be loaded in chrome://tracing or Perfetto.
+
+#ifndef HuffmanTrace_hpp
+#define HuffmanTrace_hpp
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+using namespace std;
+
+// Spans recorded by one thread, spans are dropped once the buffer is full
+
+#define HUFF_TRACE_MAX_EVENTS_PER_THREAD 16384
+
+typedef struct {
+  const char *name;
+  uint64_t startNanos;
+  uint64_t durationNanos;
+} HuffTraceEvent;
+
+class HuffmanTrace {
+
+public:
+
+  static void
+  setEnabled(bool enabled);
+
+  static inline
+  bool
+  isEnabled()
+  {
+    return enabledFlag.load(memory_order_relaxed);
+  }
+
+  // Nanoseconds since the first use of the trace clock
+
+  static uint64_t
+  nowNanos();
+
+  // Record a span in the buffer of the calling thread. The name must be
+  // a string constant, only the pointer is stored.
+
+  static void
+  recordSpan(const char *name, uint64_t startNanos, uint64_t endNanos);
+
+  // Discard the recorded spans, this must not be called while another
+  // thread is inside a span.
+
+  static void
+  reset();
+
+  // Number of recorded spans and number of spans dropped because a
+  // thread buffer was full.
+
+  static int
+  numEvents();
+
+  static uint64_t
+  numDroppedEvents();
+
+  // Export the recorded spans as Chrome trace event JSON, each thread
+  // that recorded a span is a separate track.
+
+  static void
+  writeChromeTrace(string & outJSON);
+
+  static bool
+  writeChromeTraceFile(const char *path);
+
+private:
+
+  static atomic<bool> enabledFlag;
+
+};
+
+// Scoped span, the span is recorded when the object goes out of scope
+
+class HuffTraceSpan {
+
+public:
+
+  HuffTraceSpan(const char *spanName)
+  {
+    if (HuffmanTrace::isEnabled()) {
+      name = spanName;
+      startNanos = HuffmanTrace::nowNanos();
+    } else {
+      name = NULL;
+      startNanos = 0;
+    }
+  }
+
+  ~HuffTraceSpan()
+  {
+    if (name != NULL) {
+      HuffmanTrace::recordSpan(name, startNanos, HuffmanTrace::nowNanos());
+    }
+  }
+
+private:
+
+  const char *name;
+  uint64_t startNanos;
+
+};
+
+#define HUFF_TRACE_CONCAT2(a, b) a ## b
+#define HUFF_TRACE_CONCAT(a, b) HUFF_TRACE_CONCAT2(a, b)
+
+#if defined(HUFF_DISABLE_TRACE)
+#define HUFF_TRACE_SPAN(name)
+#else
+#define HUFF_TRACE_SPAN(name) HuffTraceSpan HUFF_TRACE_CONCAT(huffTraceSpan, __LINE__)(name)
+#endif // HUFF_DISABLE_TRACE
+
+#endif // HuffmanTrace_hpp
@@ -10,6 +10,9 @@
 
 #include "HuffmanEncoder.hpp"
 #include "huff_util.hpp"
+#include "HuffmanBlockKernels.hpp"
+#include "HuffmanTANS.hpp"
+#include "HuffmanTrace.hpp"
 
 #include <assert.h>
 
@@ -46,44 +49,6 @@ encodeDelta(const vector<T> & orderVec)
   return std::move(deltas);
 }
 
-template <typename T>
-vector<T>
-decodePlusDelta(const vector<T> &deltas, const bool minusOne = false)
-{
-  T prev;
-  vector<T> values;
-  values.reserve(deltas.size());
-  
-  // The first value is always a delta from zero, so handle it before
-  // the loop logic.
-  
-  {
-    T val = deltas[0];
-    values.push_back(val);
-    prev = val;
-  }
-  
-  int maxi = (int) deltas.size();
-  for (int i = 1; i < maxi; i++) {
-    T delta = deltas[i];
-    if (minusOne) {
-      delta += 1;
-    }
-    T val = prev + delta;
-    values.push_back(val);
-    prev = val;
-  }
-  
-  return std::move(values);
-}
-
-template <typename T>
-vector<T>
-decodeDelta(const vector<T> &deltas)
-{
-  return decodePlusDelta(deltas, false);
-}
-
 static
 int
 originalSymbolBufferSize = 0;
@@ -270,6 +235,8 @@ generateLookupTableRange(HuffLookupSymbol * lookupTablePtr,
 void
 HuffmanUtil::parseCanonicalHeader(uint8_t *canonData)
 {
+  const int debugOut = 0;
+  
   const int maxNumSymbols = 256;
   
   if (canonicalSymbolTable.size() != maxNumSymbols) {
@@ -296,8 +263,8 @@ HuffmanUtil::parseCanonicalHeader(uint8_t *canonData)
       canonicalSymbolTable[symbol] = canonicalCode;
       bitWidthTable[symbol] = bitWidth;
       
-      if ((1)) {
-      printf("canonicalSymbolTable[%3d] = %s (bit width %2d)\n", symbol, get_code_bits_as_string(canonicalCode, 16).c_str(), bitWidth);
+      if (debugOut) {
+        printf("canonicalSymbolTable[%3d] = %s (bit width %2d)\n", symbol, get_code_bits_as_string(canonicalCode, 16).c_str(), bitWidth);
       }
     }
   }
@@ -342,6 +309,8 @@ HuffmanUtil::generateSplitLookupTables(
                                        vector<HuffLookupSymbol> & table1,
                                        vector<HuffLookupSymbol> & table2)
 {
+  HUFF_TRACE_SPAN("table generation");
+  
 #if defined(DEBUG)
   assert((table1NumBits + table2NumBits) == 16);
 #endif
@@ -679,6 +648,8 @@ HuffmanUtil::decodeHuffmanBits(
                                uint8_t *outBuffer,
                                uint32_t *bitOffsetTable)
 {
+  HUFF_TRACE_SPAN("decode");
+  
   uint16_t inputBitPattern = 0;
   unsigned int numBitsRead = 0;
   
@@ -844,6 +815,8 @@ HuffmanUtil::decodeHuffmanBitsFromTables(
 #endif // DecodeHuffmanBitsFromTablesCompareToOriginal
 )
 {
+  HUFF_TRACE_SPAN("decode");
+  
   uint16_t inputBitPattern = 0;
   int numBitsRead = 0;
   
@@ -1046,7 +1019,8 @@ HuffmanUtil::decodeHuffmanBitsFromTables(
 }
 
 // Given an input buffer, huffman encode the input values and generate
-// output that corresponds to
+// output that corresponds to. The output vectors are sized with
+// queryEncodeBufferSizes() and then encoded into in place.
 
 void
 HuffmanUtil::encodeHuffman(
@@ -1060,87 +1034,1759 @@ HuffmanUtil::encodeHuffman(
                            int height,
                            int blockDim)
 {
-  HuffmanEncoder enc;
+  HuffEncodeBufferSizes sizes;
   
-  vector<uint8_t> bytes;
-  bytes.reserve(inNumBytes);
+  outCanonHeader.resize(256);
   
-  for (int i = 0; i < inNumBytes; i++) {
-    int c = inBytes[i];
-    bytes.push_back(c);
-  }
+  queryEncodeBufferSizes(inBytes, inNumBytes, blockDim, outCanonHeader.data(), sizes);
   
-  vector<uint8_t> headerBytes;
-  vector<uint8_t> canonicalTableBytes;
-  vector<uint8_t> huffmanCodeBytes;
+  outHuffCodes.resize(sizes.numCodeBytes);
+  outBlockBitOffsets.resize(sizes.numBlocks);
   
-  bool worked = enc.encode(bytes,
-                           headerBytes,
-                           canonicalTableBytes,
-                           huffmanCodeBytes);
+  bool worked = encodeHuffmanToBuffers(inBytes,
+                                       inNumBytes,
+                                       blockDim,
+                                       outCanonHeader.data(),
+                                       outHuffCodes.data(),
+                                       (int) outHuffCodes.size(),
+                                       outBlockBitOffsets.data(),
+                                       (int) outBlockBitOffsets.size(),
+                                       outFileHeader);
   assert(worked);
   
-  // Copy canon table of 256 bytes back to caller
-  
-  assert(canonicalTableBytes.size() == 256);
-  outCanonHeader = canonicalTableBytes;
+  return;
+}
+
+vector<int8_t>
+HuffmanUtil::encodeSignedByteDeltas(
+                           const vector<int8_t> & bytes)
+{
+  return encodeDelta(bytes);
+}
+
+vector<int8_t>
+HuffmanUtil::decodeSignedByteDeltas(
+                                    const vector<int8_t> & deltas)
+{
+  vector<int8_t> values = deltas;
   
-  // Copy generated huffman codes back to caller
+  if (!values.empty()) {
+    HuffmanBlockKernels::decodeDeltas((uint8_t *) values.data(), (int) values.size());
+  }
   
-  //[outHuffCodes setLength:huffmanCodeBytes.size()];
-  //uint8_t *outHuffCodesPtr = (uint8_t *) outHuffCodes.mutableBytes;
+  return values;
+}
 
-//  uint8_t *codesPtr = (uint8_t *) huffmanCodeBytes.data();
-//  int codesN = (int) huffmanCodeBytes.size();
-//
-//  for ( int i = 0 ; i < codesN; i++) {
-//    uint8_t code = codesPtr[i];
-//    outHuffCodesPtr[i] = code;
-//  }
+// Lookup a symbol given a left justified 16 bit pattern, table1 is
+// checked first and table2 is only read when the code is too long
+// to be resolved with table1.
 
-  outHuffCodes = std::move(huffmanCodeBytes);
+static inline
+HuffLookupSymbol
+lookupSymbolFromTables(
+                       const HuffLookupSymbol *huffSymbolTable1,
+                       const HuffLookupSymbol *huffSymbolTable2,
+                       const uint16_t inputBitPattern)
+{
+  const int table1BitNum = HUFF_TABLE1_NUM_BITS;
+  const int table2BitNum = HUFF_TABLE2_NUM_BITS;
   
-  // Process the input data in terms of NxN blocks, so that a given width x height
-  // combination is split into blocks. Then determine the positions of each block
-  // starting point and pass these indexes into the encode module so that the bit
-  // offset at each position can be determined.
+  uint16_t table1Pattern = inputBitPattern >> (16 - table1BitNum);
   
-  vector<uint32_t> bufferOffsetsToQuery;
+  HuffLookupSymbol hls = huffSymbolTable1[table1Pattern];
+  
+  if (hls.bitWidth == 0) {
+    uint16_t table2Pattern = inputBitPattern & (0xFFFF >> (16 - table2BitNum));
+    int offset = ((int)hls.symbol) * (int)HUFF_TABLE2_SIZE;
+    hls = huffSymbolTable2[offset + table2Pattern];
+  }
   
-  int numBlocks = (int)bytes.size() / (blockDim * blockDim);
+#if defined(DEBUG)
+  assert(hls.bitWidth != 0);
+#endif // DEBUG
   
-  for ( int i = 0; i < numBlocks; i += 1) {
-    int offset = i * (blockDim * blockDim);
-    bufferOffsetsToQuery.push_back(offset);
+  return hls;
+}
+
+// Decode numSymbols symbols starting at the bit offset numBitsRead
+// and return the bit offset just past the last decoded symbol.
+
+static inline
+unsigned int
+decodeSymbolsFromTables(
+                        const HuffLookupSymbol *huffSymbolTable1,
+                        const HuffLookupSymbol *huffSymbolTable2,
+                        const uint8_t *huffBuff,
+                        unsigned int numBitsRead,
+                        uint8_t *outBuffer,
+                        const int numSymbols)
+{
+  for ( int i = 0; i < numSymbols; i++ ) {
+    uint16_t inputBitPattern = huff_read_code_bits(huffBuff, numBitsRead);
+    HuffLookupSymbol hls = lookupSymbolFromTables(huffSymbolTable1, huffSymbolTable2, inputBitPattern);
+    numBitsRead += hls.bitWidth;
+    outBuffer[i] = hls.symbol;
   }
   
-  vector<uint32_t> blockBitOffsetBytes = enc.lookupBufferBitOffsets(bufferOffsetsToQuery);
+  return numBitsRead;
+}
+
+// Generate a canonical table for a symbol histogram. When the tree
+// for this histogram would need a code longer than 16 bits then the
+// frequencies are scaled down (keeping every used symbol) and the
+// tree is generated again.
+
+static
+vector<uint8_t>
+generateCanonicalTableForFrequencies(const vector<uint32_t> & frequencies)
+{
+  vector<uint8_t> canonicalTableBytes(256);
+  huff_build_limited_code_widths(frequencies.data(), canonicalTableBytes.data());
+  return canonicalTableBytes;
+}
+
+// Number of bits needed to encode one block with a canonical table,
+// returns UINT32_MAX when a symbol in the block has no code.
+
+static inline
+uint32_t
+numBitsForBlock(const uint8_t *blockPtr,
+                const int blockNumSymbols,
+                const vector<uint8_t> & canonicalTable)
+{
+  uint32_t numBits = 0;
+  
+  for ( int i = 0; i < blockNumSymbols; i++ ) {
+    int bitWidth = canonicalTable[blockPtr[i]];
+    if (bitWidth == 0) {
+      return UINT32_MAX;
+    }
+    numBits += bitWidth;
+  }
   
-//  [outBlockBitOffsets setLength:bufferOffsetsToQuery.size()*sizeof(uint32_t)];
-//
-//  uint32_t *outBlockBitOffsetsPtr = (uint32_t *) outBlockBitOffsets.bytes;
-//  int outBlockBitOffsetsi = 0;
-//
-//  for ( uint32_t offset : blockBitOffsetBytes ) {
-//    outBlockBitOffsetsPtr[outBlockBitOffsetsi++] = offset;
-//  }
+  return numBits;
+}
+
+// Returns true when every symbol after the first one in a block is zero.
+// With any of the predictors this means all the block values are equal
+// to the first symbol.
+
+static inline
+bool
+isFlatBlock(const uint8_t *blockPtr,
+            const int blockNumSymbols)
+{
+  for ( int i = 1; i < blockNumSymbols; i++ ) {
+    if (blockPtr[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Encode block ordered input with multiple huffman tables. Blocks
+// are clustered into at most maxNumTables groups by the similarity
+// of their symbol statistics and one canonical table is generated
+// for each group. When emitFlatBlocks is true, flat blocks emit no
+// code bits and are marked with HUFF_FLAT_BLOCK_TABLE_ID. Blocks that
+// do not shrink by more than rawBlockThresholdBits are stored as bytes
+// and marked with HUFF_RAW_BLOCK_TABLE_ID.
 
-  outBlockBitOffsets = blockBitOffsetBytes;
+void
+HuffmanUtil::encodeHuffmanMultipleTables(
+                                         uint8_t* inBytes,
+                                         int inNumBytes,
+                                         vector<uint8_t> & outFileHeader,
+                                         vector<vector<uint8_t> > & outCanonHeaders,
+                                         vector<uint8_t> & outHuffCodes,
+                                         vector<uint32_t> & outBlockBitOffsets,
+                                         vector<uint8_t> & outBlockTableIds,
+                                         int blockDim,
+                                         int maxNumTables,
+                                         bool emitFlatBlocks,
+                                         int rawBlockThresholdBits)
+{
+  HUFF_TRACE_SPAN("encode multiple tables");
+  
+  const int debugOut = 0;
+  
+  // Max number of refinement passes over the block assignments
+  const int maxNumIterations = 8;
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numBlocks = inNumBytes / blockNumSymbols;
+  
+  assert((inNumBytes % blockNumSymbols) == 0);
+  assert(maxNumTables >= 1 && maxNumTables <= 256);
+  
+  const bool emitRawBlocks = (rawBlockThresholdBits >= 0);
+  
+  if (emitFlatBlocks && maxNumTables > HUFF_FLAT_BLOCK_TABLE_ID) {
+    maxNumTables = HUFF_FLAT_BLOCK_TABLE_ID;
+  }
+  
+  if (emitRawBlocks && maxNumTables > HUFF_RAW_BLOCK_TABLE_ID) {
+    maxNumTables = HUFF_RAW_BLOCK_TABLE_ID;
+  }
+  
+  // Blocks that are not flat are coded with a table, only these
+  // blocks contribute to the symbol statistics.
+  
+  vector<uint32_t> codedBlocks;
+  codedBlocks.reserve(numBlocks);
+  
+  vector<uint8_t> blockTableIds(numBlocks);
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    if (emitFlatBlocks && isFlatBlock(inBytes + (blocki * blockNumSymbols), blockNumSymbols)) {
+      blockTableIds[blocki] = HUFF_FLAT_BLOCK_TABLE_ID;
+    } else {
+      codedBlocks.push_back(blocki);
+    }
+  }
+  
+  const int numCodedBlocks = (int) codedBlocks.size();
+  
+  // A single table generated from the whole input is the starting
+  // point and also the fallback when clustering does not help.
+  
+  vector<uint32_t> frequencies(256);
+  
+  for ( uint32_t blocki : codedBlocks ) {
+    uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      frequencies[blockPtr[i]] += 1;
+    }
+  }
+  
+  if (numCodedBlocks == 0) {
+    // Every block is flat, emit a minimal table so that there is
+    // always at least 1 table.
+    frequencies[0] = 1;
+  }
+  
+  vector<uint8_t> globalTable = generateCanonicalTableForFrequencies(frequencies);
+  
+  vector<uint32_t> globalBlockNumBits(numBlocks);
+  uint64_t globalNumBits = 0;
+  
+  for ( uint32_t blocki : codedBlocks ) {
+    uint32_t numBits = numBitsForBlock(inBytes + (blocki * blockNumSymbols), blockNumSymbols, globalTable);
+    globalBlockNumBits[blocki] = numBits;
+    globalNumBits += numBits;
+  }
+  
+  int numTables = maxNumTables;
+  if (numTables > numCodedBlocks) {
+    numTables = numCodedBlocks;
+  }
+  
+  vector<vector<uint8_t> > tables;
+  
+  if (numTables > 1) {
+    // Seed clusters by sorting blocks on the number of bits each block
+    // needs with the global table, then split into equal size groups.
+    // This separates flat regions from noisy regions.
+    
+    vector<uint32_t> sortedBlocks = codedBlocks;
+    
+    stable_sort(begin(sortedBlocks), end(sortedBlocks),
+                [&globalBlockNumBits](uint32_t b1, uint32_t b2) -> bool {
+                  return globalBlockNumBits[b1] < globalBlockNumBits[b2];
+                });
+    
+    for ( int i = 0; i < numCodedBlocks; i++ ) {
+      blockTableIds[sortedBlocks[i]] = (uint8_t) (((int64_t)i * numTables) / numCodedBlocks);
+    }
+    
+    for ( int iteration = 0; iteration < maxNumIterations; iteration++ ) {
+      // Generate a table for each cluster, empty clusters are dropped
+      // and the remaining table ids are compacted.
+      
+      vector<vector<uint32_t> > clusterFrequencies(numTables, vector<uint32_t>(256));
+      
+      for ( uint32_t blocki : codedBlocks ) {
+        vector<uint32_t> & freq = clusterFrequencies[blockTableIds[blocki]];
+        uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+        for ( int i = 0; i < blockNumSymbols; i++ ) {
+          freq[blockPtr[i]] += 1;
+        }
+      }
+      
+      vector<int> tableIdRemap(numTables, -1);
+      tables.clear();
+      
+      for ( int tablei = 0; tablei < numTables; tablei++ ) {
+        vector<uint32_t> & freq = clusterFrequencies[tablei];
+        bool isEmpty = true;
+        for ( uint32_t count : freq ) {
+          if (count > 0) {
+            isEmpty = false;
+            break;
+          }
+        }
+        if (!isEmpty) {
+          tableIdRemap[tablei] = (int) tables.size();
+          tables.push_back(generateCanonicalTableForFrequencies(freq));
+        }
+      }
+      
+      numTables = (int) tables.size();
+      
+      for ( uint32_t blocki : codedBlocks ) {
+        blockTableIds[blocki] = tableIdRemap[blockTableIds[blocki]];
+      }
+      
+      if (iteration == (maxNumIterations - 1)) {
+        break;
+      }
+      
+      // Reassign each block to the table that encodes it with the
+      // fewest bits. The current table always contains a code for
+      // every symbol in the block.
+      
+      int numChanged = 0;
+      
+      for ( uint32_t blocki : codedBlocks ) {
+        uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+        int bestTableId = blockTableIds[blocki];
+        uint32_t bestNumBits = numBitsForBlock(blockPtr, blockNumSymbols, tables[bestTableId]);
+        
+        for ( int tablei = 0; tablei < numTables; tablei++ ) {
+          uint32_t numBits = numBitsForBlock(blockPtr, blockNumSymbols, tables[tablei]);
+          if (numBits < bestNumBits) {
+            bestNumBits = numBits;
+            bestTableId = tablei;
+          }
+        }
+        
+        if (bestTableId != blockTableIds[blocki]) {
+          blockTableIds[blocki] = bestTableId;
+          numChanged += 1;
+        }
+      }
+      
+      if (debugOut) {
+        printf("iteration %d : %d tables : %d blocks changed table\n", iteration, numTables, numChanged);
+      }
+      
+      if (numChanged == 0) {
+        break;
+      }
+    }
+    
+    // Tables were regenerated after the final reassignment, so each
+    // table contains a code for every symbol in its blocks. Compare
+    // to the single table size including the 256 byte table headers.
+    
+    uint64_t clusteredNumBits = 0;
+    
+    for ( uint32_t blocki : codedBlocks ) {
+      clusteredNumBits += numBitsForBlock(inBytes + (blocki * blockNumSymbols), blockNumSymbols, tables[blockTableIds[blocki]]);
+    }
+    
+    if (debugOut) {
+      printf("single table %d bits : %d tables %d bits\n", (int)globalNumBits, numTables, (int)clusteredNumBits);
+    }
+    
+    if ((clusteredNumBits + (numTables * 256 * 8)) >= (globalNumBits + (256 * 8))) {
+      numTables = 1;
+    }
+  }
+  
+  if (numTables <= 1) {
+    tables.clear();
+    tables.push_back(globalTable);
+    for ( uint32_t blocki : codedBlocks ) {
+      blockTableIds[blocki] = 0;
+    }
+  }
+  
+  // Estimate the coded size of each block from its table, blocks that
+  // would not shrink enough are stored raw. The tables are generated
+  // again without the raw blocks so that noisy blocks do not dilute the
+  // tables for the rest of the blocks, then the remaining blocks are
+  // checked once more against the new tables.
+  
+  if (emitRawBlocks) {
+    const uint32_t rawBlockNumBits = blockNumSymbols * 8;
+    
+    auto markRawBlocks = [&]() -> int {
+      int numMarked = 0;
+      for ( uint32_t blocki : codedBlocks ) {
+        if (blockTableIds[blocki] == HUFF_RAW_BLOCK_TABLE_ID) {
+          continue;
+        }
+        uint32_t numBits = numBitsForBlock(inBytes + (blocki * blockNumSymbols), blockNumSymbols, tables[blockTableIds[blocki]]);
+        if (((uint64_t) numBits + rawBlockThresholdBits) >= rawBlockNumBits) {
+          blockTableIds[blocki] = HUFF_RAW_BLOCK_TABLE_ID;
+          numMarked += 1;
+        }
+      }
+      return numMarked;
+    };
+    
+    int numRawBlocks = markRawBlocks();
+    
+    if (numRawBlocks > 0) {
+      vector<vector<uint32_t> > tableFrequencies(tables.size(), vector<uint32_t>(256));
+      
+      for ( uint32_t blocki : codedBlocks ) {
+        if (blockTableIds[blocki] == HUFF_RAW_BLOCK_TABLE_ID) {
+          continue;
+        }
+        vector<uint32_t> & freq = tableFrequencies[blockTableIds[blocki]];
+        uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+        for ( int i = 0; i < blockNumSymbols; i++ ) {
+          freq[blockPtr[i]] += 1;
+        }
+      }
+      
+      vector<int> tableIdRemap(tables.size(), -1);
+      tables.clear();
+      
+      for ( int tablei = 0; tablei < (int) tableFrequencies.size(); tablei++ ) {
+        vector<uint32_t> & freq = tableFrequencies[tablei];
+        if (any_of(begin(freq), end(freq), [](uint32_t count) { return count > 0; })) {
+          tableIdRemap[tablei] = (int) tables.size();
+          tables.push_back(generateCanonicalTableForFrequencies(freq));
+        }
+      }
+      
+      for ( uint32_t blocki : codedBlocks ) {
+        if (blockTableIds[blocki] != HUFF_RAW_BLOCK_TABLE_ID) {
+          blockTableIds[blocki] = tableIdRemap[blockTableIds[blocki]];
+        }
+      }
+      
+      if (tables.empty()) {
+        // Every block is flat or raw, emit a minimal table so that
+        // there is always at least 1 table.
+        vector<uint32_t> freq(256);
+        freq[0] = 1;
+        tables.push_back(generateCanonicalTableForFrequencies(freq));
+      }
+      
+      numRawBlocks += markRawBlocks();
+    }
+    
+    if (debugOut) {
+      printf("%d raw blocks of %d blocks\n", numRawBlocks, numBlocks);
+    }
+  }
+  
+  // Determine the bit offset where each block begins, then write
+  // the codes for each block with the table selected for the block.
+  // A flat block has no code bits, so the bit offset entry for a
+  // flat block holds the value of the first symbol instead. A raw
+  // block begins at the next byte boundary.
+  
+  vector<vector<uint16_t> > tableCodes;
+  for ( vector<uint8_t> & table : tables ) {
+    tableCodes.push_back(huff_generate_canonical_codes(table));
+  }
+  
+  outBlockBitOffsets.resize(numBlocks);
+  
+  uint32_t numBits = 0;
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    if (blockTableIds[blocki] == HUFF_FLAT_BLOCK_TABLE_ID) {
+      outBlockBitOffsets[blocki] = inBytes[blocki * blockNumSymbols];
+      continue;
+    }
+    if (blockTableIds[blocki] == HUFF_RAW_BLOCK_TABLE_ID) {
+      numBits = (numBits + 7) & ~0x7;
+      outBlockBitOffsets[blocki] = numBits;
+      numBits += blockNumSymbols * 8;
+      continue;
+    }
+    outBlockBitOffsets[blocki] = numBits;
+    numBits += numBitsForBlock(inBytes + (blocki * blockNumSymbols), blockNumSymbols, tables[blockTableIds[blocki]]);
+  }
+  
+  // Whole bytes plus the +2 bytes of decoder read ahead padding
+  
+  int numCodeBytes = (numBits + 7) / 8;
+  
+  outHuffCodes.resize(numCodeBytes + 2);
+  memset(outHuffCodes.data(), 0, outHuffCodes.size());
+  
+  uint8_t *outHuffCodesPtr = outHuffCodes.data();
+  
+  for ( uint32_t blocki : codedBlocks ) {
+    uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+    
+    if (blockTableIds[blocki] == HUFF_RAW_BLOCK_TABLE_ID) {
+      memcpy(outHuffCodesPtr + (outBlockBitOffsets[blocki] / 8), blockPtr, blockNumSymbols);
+      continue;
+    }
+    
+    const vector<uint8_t> & table = tables[blockTableIds[blocki]];
+    const vector<uint16_t> & codes = tableCodes[blockTableIds[blocki]];
+    uint32_t bitOffset = outBlockBitOffsets[blocki];
+    
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      uint8_t symbol = blockPtr[i];
+      int bitWidth = table[symbol];
+      huff_write_code_bits(outHuffCodesPtr, bitOffset, codes[symbol], bitWidth);
+      bitOffset += bitWidth;
+    }
+  }
+  
+  HuffFileHeader header;
+  initFileHeader(header, inNumBytes);
+  header.blockDim = blockDim;
+  header.numTables = (uint8_t) tables.size();
+  generateFileHeader(header, outFileHeader);
+  
+  outCanonHeaders = std::move(tables);
+  outBlockTableIds = std::move(blockTableIds);
   
   return;
 }
 
-vector<int8_t>
-HuffmanUtil::encodeSignedByteDeltas(
-                           const vector<int8_t> & bytes)
+// Round a buffer size up to HUFF_BUFFER_ALIGNMENT
+
+static inline
+uint32_t
+alignedBufferSize(uint32_t numBytes)
 {
-  return encodeDelta(bytes);
+  return ((numBytes + HUFF_BUFFER_ALIGNMENT - 1) / HUFF_BUFFER_ALIGNMENT) * HUFF_BUFFER_ALIGNMENT;
 }
 
-vector<int8_t>
-HuffmanUtil::decodeSignedByteDeltas(
-                                    const vector<int8_t> & deltas)
+// Generate the canonical table for a span and query the encoded sizes
+
+void
+HuffmanUtil::queryEncodeBufferSizes(
+                                    const uint8_t *inBytes,
+                                    int inNumBytes,
+                                    int blockDim,
+                                    uint8_t *outCanonHeader,
+                                    HuffEncodeBufferSizes & outSizes)
 {
-  return decodeDelta(deltas);
+#if defined(DEBUG)
+  assert(inNumBytes > 0);
+#endif // DEBUG
+  
+  vector<uint32_t> frequencies(256);
+  
+  {
+    HUFF_TRACE_SPAN("histogram");
+    
+    for ( int i = 0; i < inNumBytes; i++ ) {
+      frequencies[inBytes[i]] += 1;
+    }
+  }
+  
+  vector<uint8_t> table;
+  
+  {
+    HUFF_TRACE_SPAN("tree build");
+    table = generateCanonicalTableForFrequencies(frequencies);
+  }
+  
+  uint64_t numCodeBits = 0;
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    numCodeBits += (uint64_t) frequencies[symbol] * table[symbol];
+  }
+  
+  memcpy(outCanonHeader, table.data(), 256);
+  
+  outSizes.numCodeBits = (uint32_t) numCodeBits;
+  outSizes.numCodeBytes = (uint32_t) ((numCodeBits + 7) / 8) + 2;
+  outSizes.numBlocks = inNumBytes / (blockDim * blockDim);
+  outSizes.alignedNumCodeBytes = alignedBufferSize(outSizes.numCodeBytes);
+  outSizes.alignedNumBlockBitOffsetBytes = alignedBufferSize(outSizes.numBlocks * sizeof(uint32_t));
 }
 
+// Encode a span into caller owned buffers. The bit offset of each block
+// is recorded as the codes are written, so the input is read only once.
+
+bool
+HuffmanUtil::encodeHuffmanToBuffers(
+                                    const uint8_t *inBytes,
+                                    int inNumBytes,
+                                    int blockDim,
+                                    const uint8_t *canonHeader,
+                                    uint8_t *outHuffCodes,
+                                    int outHuffCodesN,
+                                    uint32_t *outBlockBitOffsets,
+                                    int outBlockBitOffsetsN,
+                                    vector<uint8_t> & outFileHeader)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numBlocks = inNumBytes / blockNumSymbols;
+  
+  if (outBlockBitOffsetsN < numBlocks || outHuffCodesN < 2) {
+    return false;
+  }
+  
+  vector<uint8_t> table(canonHeader, canonHeader + 256);
+  vector<uint16_t> codes;
+  
+  {
+    HUFF_TRACE_SPAN("canonical codes");
+    codes = huff_generate_canonical_codes(table);
+  }
+  
+  HUFF_TRACE_SPAN("bit writing");
+  
+  // The codes are OR'ed into the output, so the buffer must begin zeroed
+  
+  memset(outHuffCodes, 0, outHuffCodesN);
+  
+  uint32_t bitOffset = 0;
+  
+  for ( int offset = 0; offset < inNumBytes; offset += blockNumSymbols ) {
+    const uint8_t *blockPtr = inBytes + offset;
+    const int numSymbols = min(blockNumSymbols, inNumBytes - offset);
+    
+    if (numSymbols == blockNumSymbols) {
+      outBlockBitOffsets[offset / blockNumSymbols] = bitOffset;
+    }
+    
+    // A code is at most 16 bits wide, so only a block that could
+    // write past the end of the codes needs an exact size check.
+    
+    if ((((uint64_t) bitOffset + (numSymbols * 16) + 7) / 8) + 2 > (uint64_t) outHuffCodesN) {
+      uint32_t numBits = numBitsForBlock(blockPtr, numSymbols, table);
+      if (numBits == UINT32_MAX || (((uint64_t) bitOffset + numBits + 7) / 8) + 2 > (uint64_t) outHuffCodesN) {
+        return false;
+      }
+    }
+    
+    for ( int i = 0; i < numSymbols; i++ ) {
+      const uint8_t symbol = blockPtr[i];
+      const int bitWidth = table[symbol];
+      huff_write_code_bits(outHuffCodes, bitOffset, codes[symbol], bitWidth);
+      bitOffset += bitWidth;
+    }
+  }
+  
+  HuffFileHeader header;
+  initFileHeader(header, inNumBytes);
+  header.blockDim = blockDim;
+  generateFileHeader(header, outFileHeader);
+  
+  return true;
+}
+
+// Decode block ordered symbols where each block selects a
+// table1 and table2 pair by table id. A flat block is filled
+// without reading any code bits and a raw block is copied.
+
+void
+HuffmanUtil::decodeHuffmanBlocksFromMultipleTables(
+                                                   HuffLookupSymbol **huffSymbolTable1s,
+                                                   HuffLookupSymbol **huffSymbolTable2s,
+                                                   int numBlocks,
+                                                   int blockDim,
+                                                   uint8_t *huffBuff,
+                                                   int huffBuffN,
+                                                   uint32_t *blockBitOffsets,
+                                                   uint8_t *blockTableIds,
+                                                   uint8_t *outBuffer)
+{
+  HUFF_TRACE_SPAN("decode");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const int tableId = blockTableIds[blocki];
+    uint8_t *blockOutPtr = outBuffer + (blocki * blockNumSymbols);
+    
+    if (tableId == HUFF_FLAT_BLOCK_TABLE_ID) {
+      memset(blockOutPtr, 0, blockNumSymbols);
+      blockOutPtr[0] = (uint8_t) blockBitOffsets[blocki];
+      continue;
+    }
+    
+    if (tableId == HUFF_RAW_BLOCK_TABLE_ID) {
+#if defined(DEBUG)
+      assert(((blockBitOffsets[blocki] / 8) + blockNumSymbols) <= huffBuffN);
+#endif // DEBUG
+      memcpy(blockOutPtr, huffBuff + (blockBitOffsets[blocki] / 8), blockNumSymbols);
+      continue;
+    }
+    
+#if defined(DEBUG)
+    assert(((blockBitOffsets[blocki] / 8) + 2) < huffBuffN);
+#endif // DEBUG
+    
+    decodeSymbolsFromTables(huffSymbolTable1s[tableId],
+                            huffSymbolTable2s[tableId],
+                            huffBuff,
+                            blockBitOffsets[blocki],
+                            blockOutPtr,
+                            blockNumSymbols);
+  }
+  
+  return;
+}
+
+// Decode numSymbols symbols that begin at bitOffset
+
+uint32_t
+HuffmanUtil::decodeHuffmanSymbolsAtBitOffset(
+                                             const HuffLookupSymbol *huffSymbolTable1,
+                                             const HuffLookupSymbol *huffSymbolTable2,
+                                             const uint8_t *huffBuff,
+                                             uint32_t bitOffset,
+                                             uint8_t *outBuffer,
+                                             int numSymbols)
+{
+  return decodeSymbolsFromTables(huffSymbolTable1,
+                                 huffSymbolTable2,
+                                 huffBuff,
+                                 bitOffset,
+                                 outBuffer,
+                                 numSymbols);
+}
+
+// Generate intra block checkpoints
+
+void
+HuffmanUtil::generateBlockCheckpoints(
+                                      const uint8_t *inBytes,
+                                      int numBlocks,
+                                      int blockDim,
+                                      const vector<vector<uint8_t> > & canonHeaders,
+                                      const uint8_t *blockTableIds,
+                                      int checkpointInterval,
+                                      vector<uint8_t> & outCheckpoints)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numSubStreams = blockNumSymbols / checkpointInterval;
+  const int numCheckpoints = numSubStreams - 1;
+  
+  assert((blockNumSymbols % checkpointInterval) == 0);
+  
+  outCheckpoints.assign(numBlocks * numCheckpoints, 0);
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const int tableId = (blockTableIds != nullptr) ? blockTableIds[blocki] : 0;
+    
+    if (tableId == HUFF_FLAT_BLOCK_TABLE_ID || tableId == HUFF_RAW_BLOCK_TABLE_ID) {
+      continue;
+    }
+    
+    const uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+    const vector<uint8_t> & table = canonHeaders[tableId];
+    uint8_t *blockCheckpointsPtr = outCheckpoints.data() + (blocki * numCheckpoints);
+    
+    for ( int checkpointi = 0; checkpointi < numCheckpoints; checkpointi++ ) {
+      const uint8_t *subStreamPtr = blockPtr + (checkpointi * checkpointInterval);
+      int numBits = 0;
+      
+      for ( int i = 0; i < checkpointInterval; i++ ) {
+        numBits += table[subStreamPtr[i]];
+      }
+      
+      if (numBits > 0xFF) {
+        // Too long for a byte, this block will be decoded serially
+        memset(blockCheckpointsPtr, 0, numCheckpoints);
+        break;
+      }
+      
+      blockCheckpointsPtr[checkpointi] = numBits;
+    }
+  }
+  
+  return;
+}
+
+// Decode blocks with checkpoints, the sub streams are decoded in an
+// interleaved loop.
+
+void
+HuffmanUtil::decodeHuffmanBlocksWithCheckpoints(
+                                                HuffLookupSymbol **huffSymbolTable1s,
+                                                HuffLookupSymbol **huffSymbolTable2s,
+                                                int numBlocks,
+                                                int blockDim,
+                                                uint8_t *huffBuff,
+                                                int huffBuffN,
+                                                uint32_t *blockBitOffsets,
+                                                uint8_t *blockTableIds,
+                                                const uint8_t *checkpoints,
+                                                int checkpointInterval,
+                                                uint8_t *outBuffer)
+{
+  HUFF_TRACE_SPAN("decode");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  const int numSubStreams = blockNumSymbols / checkpointInterval;
+  const int numCheckpoints = numSubStreams - 1;
+  
+  vector<uint32_t> subStreamBitOffsets(numSubStreams);
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const int tableId = (blockTableIds != nullptr) ? blockTableIds[blocki] : 0;
+    uint8_t *blockOutPtr = outBuffer + (blocki * blockNumSymbols);
+    
+    if (tableId == HUFF_FLAT_BLOCK_TABLE_ID) {
+      memset(blockOutPtr, 0, blockNumSymbols);
+      blockOutPtr[0] = (uint8_t) blockBitOffsets[blocki];
+      continue;
+    }
+    
+    if (tableId == HUFF_RAW_BLOCK_TABLE_ID) {
+      memcpy(blockOutPtr, huffBuff + (blockBitOffsets[blocki] / 8), blockNumSymbols);
+      continue;
+    }
+    
+    const HuffLookupSymbol *huffSymbolTable1 = huffSymbolTable1s[tableId];
+    const HuffLookupSymbol *huffSymbolTable2 = huffSymbolTable2s[tableId];
+    const uint8_t *blockCheckpointsPtr = checkpoints + (blocki * numCheckpoints);
+    
+#if defined(DEBUG)
+    assert(((blockBitOffsets[blocki] / 8) + 2) < huffBuffN);
+#endif // DEBUG
+    
+    if (numCheckpoints > 0 && blockCheckpointsPtr[0] == 0) {
+      // No checkpoints for this block
+      decodeSymbolsFromTables(huffSymbolTable1,
+                              huffSymbolTable2,
+                              huffBuff,
+                              blockBitOffsets[blocki],
+                              blockOutPtr,
+                              blockNumSymbols);
+      continue;
+    }
+    
+    uint32_t bitOffset = blockBitOffsets[blocki];
+    
+    for ( int streami = 0; streami < numSubStreams; streami++ ) {
+      subStreamBitOffsets[streami] = bitOffset;
+      if (streami < numCheckpoints) {
+        bitOffset += blockCheckpointsPtr[streami];
+      }
+    }
+    
+    // Symbol i of every sub stream is decoded before symbol i+1
+    
+    for ( int i = 0; i < checkpointInterval; i++ ) {
+      for ( int streami = 0; streami < numSubStreams; streami++ ) {
+        uint16_t inputBitPattern = huff_read_code_bits(huffBuff, subStreamBitOffsets[streami]);
+        HuffLookupSymbol hls = lookupSymbolFromTables(huffSymbolTable1, huffSymbolTable2, inputBitPattern);
+        subStreamBitOffsets[streami] += hls.bitWidth;
+        blockOutPtr[(streami * checkpointInterval) + i] = hls.symbol;
+      }
+    }
+  }
+  
+  return;
+}
+
+// Generate lookup tables from a canonical table, the table is validated
+// first and unused bit patterns map to a symbol with a 16 bit width.
+
+HuffDecodeStatus
+HuffmanUtil::generateCheckedLookupTables(
+                                         const uint8_t *canonTable,
+                                         vector<HuffLookupSymbol> & outTable1,
+                                         vector<HuffLookupSymbol> & outTable2)
+{
+  HUFF_TRACE_SPAN("table generation");
+  
+  const int table1NumBits = HUFF_TABLE1_NUM_BITS;
+  const int table2NumBits = HUFF_TABLE2_NUM_BITS;
+  
+  // Kraft sum in units of 2^-16, a valid prefix code sums to at most 1.0
+  
+  uint32_t kraftSum = 0;
+  int numTable2Prefixes = 0;
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    const int bitWidth = canonTable[symbol];
+    if (bitWidth == 0) {
+      continue;
+    }
+    if (bitWidth > 16) {
+      return HUFF_DECODE_ERROR_TABLE;
+    }
+    kraftSum += (1 << (16 - bitWidth));
+  }
+  
+  if (kraftSum == 0 || kraftSum > (1 << 16)) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+  
+  vector<uint8_t> table(canonTable, canonTable + 256);
+  vector<uint16_t> codes = huff_generate_canonical_codes(table);
+  
+  const HuffLookupSymbol invalidSymbol = { 0, 16 };
+  
+  outTable1.assign(HUFF_TABLE1_SIZE, invalidSymbol);
+  outTable2.clear();
+  
+  // Codes are left justified, so a code that is longer than table1NumBits
+  // is resolved with the table2 block selected by its first table1NumBits.
+  
+  vector<int> table2Index(HUFF_TABLE1_SIZE, -1);
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    const int bitWidth = canonTable[symbol];
+    if (bitWidth == 0) {
+      continue;
+    }
+    
+    const uint16_t code = codes[symbol];
+    HuffLookupSymbol hls;
+    hls.symbol = (uint8_t) symbol;
+    hls.bitWidth = (uint8_t) bitWidth;
+    
+    if (bitWidth <= table1NumBits) {
+      const int first = code >> (16 - table1NumBits);
+      const int count = 1 << (table1NumBits - bitWidth);
+      for ( int i = 0; i < count; i++ ) {
+        outTable1[first + i] = hls;
+      }
+    } else {
+      const int prefix = code >> (16 - table1NumBits);
+      if (table2Index[prefix] == -1) {
+        table2Index[prefix] = numTable2Prefixes++;
+        outTable1[prefix].symbol = (uint8_t) table2Index[prefix];
+        outTable1[prefix].bitWidth = 0;
+        outTable2.resize(numTable2Prefixes * HUFF_TABLE2_SIZE, invalidSymbol);
+      }
+      HuffLookupSymbol *table2Ptr = outTable2.data() + (table2Index[prefix] * HUFF_TABLE2_SIZE);
+      const int first = code & (0xFFFF >> (16 - table2NumBits));
+      const int count = 1 << (16 - bitWidth);
+      for ( int i = 0; i < count; i++ ) {
+        table2Ptr[first + i] = hls;
+      }
+    }
+  }
+  
+  return HUFF_DECODE_OK;
+}
+
+// Decode blocks from untrusted input, everything that the inner loop
+// depends on is validated before the first block is decoded.
+
+HuffDecodeStatus
+HuffmanUtil::decodeHuffmanBlocksChecked(
+                                        const vector<vector<uint8_t> > & canonHeaders,
+                                        int numBlocks,
+                                        int blockDim,
+                                        const uint8_t *huffBuff,
+                                        int huffBuffN,
+                                        const uint32_t *blockBitOffsets,
+                                        const uint8_t *blockTableIds,
+                                        uint8_t *outBuffer,
+                                        int outBufferN)
+{
+  HUFF_TRACE_SPAN("decode");
+  
+  const int numTables = (int) canonHeaders.size();
+  
+  if (numBlocks < 0 || !isSupportedBlockDim(blockDim) || numTables == 0 || numTables > HUFF_RAW_BLOCK_TABLE_ID) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  if (((int64_t) numBlocks * blockNumSymbols) > outBufferN) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  if (numBlocks == 0) {
+    return HUFF_DECODE_OK;
+  }
+  
+  if (huffBuff == nullptr || blockBitOffsets == nullptr || outBuffer == nullptr) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  // The buffer must end with +2 bytes of read ahead padding
+  
+  if (huffBuffN < 2) {
+    return HUFF_DECODE_ERROR_PADDING;
+  }
+  
+  vector<vector<HuffLookupSymbol> > table1s(numTables);
+  vector<vector<HuffLookupSymbol> > table2s(numTables);
+  
+  for ( int tablei = 0; tablei < numTables; tablei++ ) {
+    if (canonHeaders[tablei].size() != 256) {
+      return HUFF_DECODE_ERROR_TABLE;
+    }
+    HuffDecodeStatus status = generateCheckedLookupTables(canonHeaders[tablei].data(), table1s[tablei], table2s[tablei]);
+    if (status != HUFF_DECODE_OK) {
+      return status;
+    }
+  }
+  
+  HuffDecodeStatus status = validateBlockBitOffsets(blockBitOffsets, blockTableIds, numBlocks, numTables, blockDim, huffBuffN);
+  if (status != HUFF_DECODE_OK) {
+    return status;
+  }
+  
+  auto blockDecoder = [&table1s, &table2s](int tableId, const uint8_t *codes, uint32_t bitOffset, uint8_t *symbols, int numSymbols) -> uint32_t {
+    return decodeSymbolsFromTables(table1s[tableId].data(), table2s[tableId].data(), codes, bitOffset, symbols, numSymbols);
+  };
+  
+  return decodeBlockRangeChecked(blockDecoder,
+                                 numBlocks,
+                                 blockDim,
+                                 huffBuff,
+                                 huffBuffN,
+                                 blockBitOffsets,
+                                 blockTableIds,
+                                 0,
+                                 numBlocks,
+                                 outBuffer);
+}
+
+// Parse the file header and dispatch to the decoder for its entropy coder
+
+HuffDecodeStatus
+HuffmanUtil::decodeBlocksForFileHeader(
+                                       const uint8_t *fileHeader,
+                                       int fileHeaderN,
+                                       const uint8_t *tableHeader,
+                                       int tableHeaderN,
+                                       const uint8_t *codes,
+                                       int codesN,
+                                       const uint32_t *blockBitOffsets,
+                                       int blockBitOffsetsN,
+                                       uint8_t *outBuffer,
+                                       int outBufferN)
+{
+  HuffFileHeader header;
+  
+  if (fileHeader == nullptr || !parseFileHeader(fileHeader, fileHeaderN, header)) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  if (header.numTables != 1 || header.numChannels != 1 || header.bitsPerSample != 8 || header.blockInitPlane != 0) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  const int blockDim = header.blockDim;
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  if ((header.numBytes % blockNumSymbols) != 0 || header.numBytes > (uint32_t) outBufferN) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  const int numBlocks = header.numBytes / blockNumSymbols;
+  
+  if (blockBitOffsetsN != numBlocks) {
+    return HUFF_DECODE_ERROR_ARGUMENTS;
+  }
+  
+  if (header.entropyCoder == HUFF_ENTROPY_TANS) {
+    return HuffmanTANS::decodeBlocksChecked(tableHeader,
+                                            tableHeaderN,
+                                            numBlocks,
+                                            blockDim,
+                                            codes,
+                                            codesN,
+                                            blockBitOffsets,
+                                            outBuffer,
+                                            outBufferN);
+  }
+  
+  if (tableHeader == nullptr || tableHeaderN != 256) {
+    return HUFF_DECODE_ERROR_TABLE;
+  }
+  
+  vector<vector<uint8_t> > canonHeaders;
+  canonHeaders.push_back(vector<uint8_t>(tableHeader, tableHeader + 256));
+  
+  return decodeHuffmanBlocksChecked(canonHeaders,
+                                    numBlocks,
+                                    blockDim,
+                                    codes,
+                                    codesN,
+                                    blockBitOffsets,
+                                    nullptr,
+                                    outBuffer,
+                                    outBufferN);
+}
+
+// Validate block bit offsets, see decodeBlockRangeChecked for how the
+// decode depends on each rule.
+
+HuffDecodeStatus
+HuffmanUtil::validateBlockBitOffsets(
+                                     const uint32_t *blockBitOffsets,
+                                     const uint8_t *blockTableIds,
+                                     int numBlocks,
+                                     int numTables,
+                                     int blockDim,
+                                     int huffBuffN)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const uint64_t numCodeBits = (uint64_t) (huffBuffN - 2) * 8;
+  
+  // Coded blocks begin at bit 0 and the offsets must be in increasing
+  // order inside the code bits. The offset of a flat block is a symbol
+  // and a raw block is byte aligned and must end inside the code bits.
+  
+  uint64_t prevBitOffset = 0;
+  bool isFirstCodedBlock = true;
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const int tableId = (blockTableIds != nullptr) ? blockTableIds[blocki] : 0;
+    const uint32_t bitOffset = blockBitOffsets[blocki];
+    
+    if (tableId == HUFF_FLAT_BLOCK_TABLE_ID) {
+      if (bitOffset > 0xFF) {
+        return HUFF_DECODE_ERROR_BLOCK_OFFSET;
+      }
+      continue;
+    }
+    
+    if (tableId == HUFF_RAW_BLOCK_TABLE_ID) {
+      if ((bitOffset % 8) != 0) {
+        return HUFF_DECODE_ERROR_BLOCK_OFFSET;
+      }
+      if (((uint64_t) bitOffset + (blockNumSymbols * 8)) > numCodeBits) {
+        return HUFF_DECODE_ERROR_PADDING;
+      }
+    } else if (tableId >= numTables) {
+      return HUFF_DECODE_ERROR_TABLE_ID;
+    }
+    
+    if (isFirstCodedBlock && bitOffset != 0) {
+      return HUFF_DECODE_ERROR_BLOCK_OFFSET;
+    }
+    
+    if (bitOffset < prevBitOffset || bitOffset >= numCodeBits) {
+      return (bitOffset >= numCodeBits) ? HUFF_DECODE_ERROR_PADDING : HUFF_DECODE_ERROR_BLOCK_OFFSET;
+    }
+    
+    prevBitOffset = bitOffset;
+    isFirstCodedBlock = false;
+  }
+  
+  return HUFF_DECODE_OK;
+}
+
+// Predict the value at (col, row) in a block from already known values.
+// The first row always predicts from the left and the first column
+// predicts from above. The first value predicts from zero so that
+// a block can be decoded without knowledge of other blocks.
+
+static inline
+int
+predictBlockValue(const uint8_t *blockPtr,
+                  const int blockDim,
+                  const int col,
+                  const int row,
+                  const HuffPredictor predictor)
+{
+  const int offset = (row * blockDim) + col;
+  
+  if (offset == 0) {
+    return 0;
+  }
+  
+  if (predictor == HUFF_PREDICTOR_DELTA) {
+    return blockPtr[offset - 1];
+  }
+  
+  if (row == 0) {
+    return blockPtr[offset - 1];
+  } else if (col == 0) {
+    return blockPtr[offset - blockDim];
+  }
+  
+  const int a = blockPtr[offset - 1];
+  const int b = blockPtr[offset - blockDim];
+  const int c = blockPtr[offset - blockDim - 1];
+  
+  if (predictor == HUFF_PREDICTOR_MED) {
+    return HuffmanUtil::predictMED(a, b, c);
+  } else {
+#if defined(DEBUG)
+    assert(predictor == HUFF_PREDICTOR_PAETH);
+#endif // DEBUG
+    return HuffmanUtil::predictPaeth(a, b, c);
+  }
+}
+
+// Write residuals for one block and return the sum of the absolute
+// value of each signed residual, this is a cheap estimate of how
+// well the predictor works for this block.
+
+static inline
+uint32_t
+encodePredictedBlock(const uint8_t *blockPtr,
+                     uint8_t *residualsPtr,
+                     const int blockDim,
+                     const HuffPredictor predictor)
+{
+  uint32_t sumAbs = 0;
+  
+  for ( int row = 0; row < blockDim; row++ ) {
+    for ( int col = 0; col < blockDim; col++ ) {
+      const int offset = (row * blockDim) + col;
+      int pred = predictBlockValue(blockPtr, blockDim, col, row, predictor);
+      uint8_t residual = (uint8_t) (blockPtr[offset] - pred);
+      residualsPtr[offset] = residual;
+      sumAbs += abs((int)(int8_t)residual);
+    }
+  }
+  
+  return sumAbs;
+}
+
+void
+HuffmanUtil::encodePredictedBlocks(
+                                   const uint8_t *inBytes,
+                                   uint8_t *outResiduals,
+                                   int numBlocks,
+                                   int blockDim,
+                                   HuffPredictor predictor,
+                                   vector<uint8_t> & outBlockPredictors)
+{
+  HUFF_TRACE_SPAN("predict");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  outBlockPredictors.resize(numBlocks);
+  
+  vector<uint8_t> tmpResiduals(blockNumSymbols);
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint8_t *blockPtr = inBytes + (blocki * blockNumSymbols);
+    uint8_t *residualsPtr = outResiduals + (blocki * blockNumSymbols);
+    
+    if (predictor != HUFF_PREDICTOR_ADAPTIVE) {
+      encodePredictedBlock(blockPtr, residualsPtr, blockDim, predictor);
+      outBlockPredictors[blocki] = predictor;
+      continue;
+    }
+    
+    // Try each predictor and keep the residuals with the smallest sum
+    
+    uint32_t bestSumAbs = encodePredictedBlock(blockPtr, residualsPtr, blockDim, HUFF_PREDICTOR_DELTA);
+    HuffPredictor bestPredictor = HUFF_PREDICTOR_DELTA;
+    
+    for ( int pi = HUFF_PREDICTOR_DELTA + 1; pi < HUFF_PREDICTOR_NUM; pi++ ) {
+      uint32_t sumAbs = encodePredictedBlock(blockPtr, tmpResiduals.data(), blockDim, (HuffPredictor) pi);
+      if (sumAbs < bestSumAbs) {
+        bestSumAbs = sumAbs;
+        bestPredictor = (HuffPredictor) pi;
+        memcpy(residualsPtr, tmpResiduals.data(), blockNumSymbols);
+      }
+    }
+    
+    outBlockPredictors[blocki] = bestPredictor;
+  }
+  
+  return;
+}
+
+void
+HuffmanUtil::decodePredictedBlocks(
+                                   const uint8_t *inResiduals,
+                                   uint8_t *outBytes,
+                                   int numBlocks,
+                                   int blockDim,
+                                   const uint8_t *blockPredictors)
+{
+  HUFF_TRACE_SPAN("delta decode");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint8_t *residualsPtr = inResiduals + (blocki * blockNumSymbols);
+    uint8_t *blockPtr = outBytes + (blocki * blockNumSymbols);
+    const HuffPredictor predictor = (HuffPredictor) blockPredictors[blocki];
+    
+#if defined(DEBUG)
+    assert(predictor < HUFF_PREDICTOR_NUM);
+#endif // DEBUG
+    
+    if (predictor == HUFF_PREDICTOR_DELTA) {
+      memmove(blockPtr, residualsPtr, blockNumSymbols);
+      HuffmanBlockKernels::decodeDeltas(blockPtr, blockNumSymbols);
+      continue;
+    }
+    
+    // Values are reconstructed in order, so the left, above and above
+    // left values needed by the predictor have already been written.
+    
+    for ( int row = 0; row < blockDim; row++ ) {
+      for ( int col = 0; col < blockDim; col++ ) {
+        const int offset = (row * blockDim) + col;
+        int pred = predictBlockValue(blockPtr, blockDim, col, row, predictor);
+        blockPtr[offset] = (uint8_t) (residualsPtr[offset] + pred);
+      }
+    }
+  }
+  
+  return;
+}
+
+// Init header settings to the defaults that correspond to a plain 8 byte header
+
+void
+HuffmanUtil::initFileHeader(HuffFileHeader & header, uint32_t numBytes)
+{
+  header.numBytes = numBytes;
+  header.blockDim = HUFF_BLOCK_DIM;
+  header.scanOrder = HUFF_SCAN_RASTER;
+  header.predictor = HUFF_PREDICTOR_DELTA;
+  header.numTables = 1;
+  header.numChannels = 1;
+  header.bitsPerSample = 8;
+  header.entropyCoder = HUFF_ENTROPY_HUFFMAN;
+  header.blockInitPlane = 0;
+}
+
+// Write header settings as bytes, the first 8 bytes are the same
+// as the header emitted by HuffmanEncoder.
+
+void
+HuffmanUtil::generateFileHeader(const HuffFileHeader & header,
+                                vector<uint8_t> & outFileHeader)
+{
+  const uint8_t settings[] = {
+    header.blockDim,
+    header.scanOrder,
+    header.predictor,
+    header.numTables,
+    header.numChannels,
+    header.bitsPerSample,
+    header.entropyCoder,
+    header.blockInitPlane,
+  };
+  const int numSettings = sizeof(settings) / sizeof(uint8_t);
+  
+  outFileHeader.resize((sizeof(uint32_t) * 2) + 1 + numSettings);
+  
+  uint32_t bitPattern = 0xFFEEEEDD;
+  
+  outFileHeader[0] = (bitPattern >> 0) & 0xFF;
+  outFileHeader[1] = (bitPattern >> 8) & 0xFF;
+  outFileHeader[2] = (bitPattern >> 16) & 0xFF;
+  outFileHeader[3] = (bitPattern >> 24) & 0xFF;
+  
+  uint32_t numBytes = header.numBytes;
+  
+  outFileHeader[4] = (numBytes >> 0) & 0xFF;
+  outFileHeader[5] = (numBytes >> 8) & 0xFF;
+  outFileHeader[6] = (numBytes >> 16) & 0xFF;
+  outFileHeader[7] = (numBytes >> 24) & 0xFF;
+  
+  outFileHeader[8] = numSettings;
+  
+  for ( int i = 0; i < numSettings; i++ ) {
+    outFileHeader[9 + i] = settings[i];
+  }
+}
+
+// Parse header bytes, settings that are not present in the
+// header keep the default value.
+
+bool
+HuffmanUtil::parseFileHeader(const uint8_t *headerBytes,
+                             int headerNumBytes,
+                             HuffFileHeader & header)
+{
+  if (headerNumBytes < 8) {
+    return false;
+  }
+  
+  uint32_t bitPattern = (headerBytes[0] << 0) | (headerBytes[1] << 8) | (headerBytes[2] << 16) | ((uint32_t)headerBytes[3] << 24);
+  
+  if (bitPattern != 0xFFEEEEDD) {
+    return false;
+  }
+  
+  uint32_t numBytes = (headerBytes[4] << 0) | (headerBytes[5] << 8) | (headerBytes[6] << 16) | ((uint32_t)headerBytes[7] << 24);
+  
+  initFileHeader(header, numBytes);
+  
+  if (headerNumBytes == 8) {
+    return true;
+  }
+  
+  const int numSettings = headerBytes[8];
+  
+  if (headerNumBytes < (9 + numSettings)) {
+    return false;
+  }
+  
+  uint8_t *settings[] = {
+    &header.blockDim,
+    &header.scanOrder,
+    &header.predictor,
+    &header.numTables,
+    &header.numChannels,
+    &header.bitsPerSample,
+    &header.entropyCoder,
+    &header.blockInitPlane,
+  };
+  const int numKnownSettings = sizeof(settings) / sizeof(uint8_t*);
+  
+  // Settings added after this version of the parser are skipped
+  
+  for ( int i = 0; i < numSettings && i < numKnownSettings; i++ ) {
+    *settings[i] = headerBytes[9 + i];
+  }
+  
+  if (!isSupportedBlockDim(header.blockDim) || header.scanOrder >= HUFF_SCAN_NUM || (header.predictor >= HUFF_PREDICTOR_NUM && header.predictor != HUFF_PREDICTOR_ADAPTIVE) || header.numTables == 0 || header.numChannels == 0 || header.bitsPerSample < 8 || header.bitsPerSample > 16 || header.entropyCoder >= HUFF_ENTROPY_NUM || header.blockInitPlane > 1) {
+    return false;
+  }
+  
+  return true;
+}
+
+// Rotate and flip a quadrant while walking a Hilbert curve
+
+static inline
+void
+hilbertRotate(int n, int & x, int & y, int rx, int ry)
+{
+  if (ry == 0) {
+    if (rx == 1) {
+      x = n - 1 - x;
+      y = n - 1 - y;
+    }
+    int t = x;
+    x = y;
+    y = t;
+  }
+}
+
+// Generate the block offset of each value in scan order
+
+void
+HuffmanUtil::generateBlockScanOrder(int blockDim,
+                                    HuffScanOrder scanOrder,
+                                    vector<uint16_t> & outScan)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  outScan.resize(blockNumSymbols);
+  
+  if (scanOrder == HUFF_SCAN_MORTON || scanOrder == HUFF_SCAN_HILBERT) {
+    // Curve orders are defined only for a power of 2 block dimension
+    assert((blockDim & (blockDim - 1)) == 0);
+  }
+  
+  for ( int i = 0; i < blockNumSymbols; i++ ) {
+    int col = 0;
+    int row = 0;
+    
+    switch (scanOrder) {
+      case HUFF_SCAN_RASTER: {
+        col = i % blockDim;
+        row = i / blockDim;
+        break;
+      }
+      case HUFF_SCAN_SERPENTINE: {
+        row = i / blockDim;
+        col = i % blockDim;
+        if ((row % 2) == 1) {
+          col = blockDim - 1 - col;
+        }
+        break;
+      }
+      case HUFF_SCAN_MORTON: {
+        // Even bits of i are the column and odd bits are the row
+        for ( int bit = 0; (1 << (bit * 2)) < blockNumSymbols; bit++ ) {
+          col |= ((i >> (bit * 2)) & 0x1) << bit;
+          row |= ((i >> (bit * 2 + 1)) & 0x1) << bit;
+        }
+        break;
+      }
+      case HUFF_SCAN_HILBERT: {
+        int t = i;
+        for ( int s = 1; s < blockDim; s *= 2 ) {
+          int rx = 1 & (t / 2);
+          int ry = 1 & (t ^ rx);
+          hilbertRotate(s, col, row, rx, ry);
+          col += s * rx;
+          row += s * ry;
+          t /= 4;
+        }
+        break;
+      }
+      default: {
+        assert(0);
+      }
+    }
+    
+    outScan[i] = (row * blockDim) + col;
+  }
+  
+#if defined(DEBUG)
+  // Each offset in the block must be visited exactly once
+  vector<uint8_t> visited(blockNumSymbols);
+  for ( uint16_t offset : outScan ) {
+    assert(offset < blockNumSymbols);
+    assert(visited[offset] == 0);
+    visited[offset] = 1;
+  }
+#endif // DEBUG
+}
+
+void
+HuffmanUtil::reorderBlocksToScanOrder(
+                                      const uint8_t *inBytes,
+                                      uint8_t *outBytes,
+                                      int numBlocks,
+                                      int blockDim,
+                                      HuffScanOrder scanOrder)
+{
+  HUFF_TRACE_SPAN("reorder");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  if (scanOrder == HUFF_SCAN_RASTER) {
+    memcpy(outBytes, inBytes, numBlocks * blockNumSymbols);
+    return;
+  }
+  
+  vector<uint16_t> scan;
+  generateBlockScanOrder(blockDim, scanOrder, scan);
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint8_t *blockInPtr = inBytes + (blocki * blockNumSymbols);
+    uint8_t *blockOutPtr = outBytes + (blocki * blockNumSymbols);
+    
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      blockOutPtr[i] = blockInPtr[scan[i]];
+    }
+  }
+}
+
+void
+HuffmanUtil::reorderBlocksFromScanOrder(
+                                        const uint8_t *inBytes,
+                                        uint8_t *outBytes,
+                                        int numBlocks,
+                                        int blockDim,
+                                        HuffScanOrder scanOrder)
+{
+  HUFF_TRACE_SPAN("reorder");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  if (scanOrder == HUFF_SCAN_RASTER) {
+    memcpy(outBytes, inBytes, numBlocks * blockNumSymbols);
+    return;
+  }
+  
+  vector<uint16_t> scan;
+  generateBlockScanOrder(blockDim, scanOrder, scan);
+  
+  for ( int blocki = 0; blocki < numBlocks; blocki++ ) {
+    const uint8_t *blockInPtr = inBytes + (blocki * blockNumSymbols);
+    uint8_t *blockOutPtr = outBytes + (blocki * blockNumSymbols);
+    
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      blockOutPtr[scan[i]] = blockInPtr[i];
+    }
+  }
+}
+
+// Write block ordered values to a width x height image in raster order
+
+void
+HuffmanUtil::flattenBlocksToImage(
+                                  const uint8_t *inBlockBytes,
+                                  uint8_t *outBytes,
+                                  int width,
+                                  int height,
+                                  int blockDim,
+                                  HuffScanOrder scanOrder)
+{
+  if (scanOrder == HUFF_SCAN_RASTER) {
+    HuffmanBlockKernels::flattenBlocksToImage(inBlockBytes, outBytes, width, height, blockDim);
+    return;
+  }
+  
+  HUFF_TRACE_SPAN("reorder");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  int blockWidth = width / blockDim;
+  if ((width % blockDim) != 0) {
+    blockWidth += 1;
+  }
+  
+  int blockHeight = height / blockDim;
+  if ((height % blockDim) != 0) {
+    blockHeight += 1;
+  }
+  
+  vector<uint16_t> scan;
+  generateBlockScanOrder(blockDim, scanOrder, scan);
+  
+  for ( int blocki = 0; blocki < (blockWidth * blockHeight); blocki++ ) {
+    const uint8_t *blockInPtr = inBlockBytes + (blocki * blockNumSymbols);
+    
+    const int blockX = (blocki % blockWidth) * blockDim;
+    const int blockY = (blocki / blockWidth) * blockDim;
+    
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      const int offset = scan[i];
+      const int x = blockX + (offset % blockDim);
+      const int y = blockY + (offset / blockDim);
+      
+      if (x < width && y < height) {
+        outBytes[(y * width) + x] = blockInPtr[i];
+      }
+    }
+  }
+}
+
+// Returns true when blockDim is one of the supported block dimensions
+
+bool
+HuffmanUtil::isSupportedBlockDim(int blockDim)
+{
+  return (blockDim == 4 || blockDim == 8 || blockDim == 16 || blockDim == 32);
+}
+
+// Number of blocks needed to cover one dimension
+
+int
+HuffmanUtil::numBlocksForDim(int dim, int blockDim)
+{
+  int numBlocks = dim / blockDim;
+  if ((dim % blockDim) != 0) {
+    numBlocks += 1;
+  }
+  return numBlocks;
+}
+
+// Split a width x height image into block ordered values
+
+void
+HuffmanUtil::splitImageToBlocks(
+                                const uint8_t *inBytes,
+                                uint8_t *outBlockBytes,
+                                int width,
+                                int height,
+                                int blockDim,
+                                HuffScanOrder scanOrder,
+                                uint8_t zeroValue)
+{
+  if (scanOrder == HUFF_SCAN_RASTER) {
+    HuffmanBlockKernels::splitImageToBlocks(inBytes, outBlockBytes, width, height, blockDim, zeroValue);
+    return;
+  }
+  
+  HUFF_TRACE_SPAN("block split");
+  
+  const int blockNumSymbols = blockDim * blockDim;
+  
+  int blockWidth = width / blockDim;
+  if ((width % blockDim) != 0) {
+    blockWidth += 1;
+  }
+  
+  int blockHeight = height / blockDim;
+  if ((height % blockDim) != 0) {
+    blockHeight += 1;
+  }
+  
+  vector<uint16_t> scan;
+  generateBlockScanOrder(blockDim, scanOrder, scan);
+  
+  for ( int blocki = 0; blocki < (blockWidth * blockHeight); blocki++ ) {
+    uint8_t *blockOutPtr = outBlockBytes + (blocki * blockNumSymbols);
+    
+    const int blockX = (blocki % blockWidth) * blockDim;
+    const int blockY = (blocki / blockWidth) * blockDim;
+    
+    for ( int i = 0; i < blockNumSymbols; i++ ) {
+      const int offset = scan[i];
+      const int x = blockX + (offset % blockDim);
+      const int y = blockY + (offset / blockDim);
+      
+      if (x < width && y < height) {
+        blockOutPtr[i] = inBytes[(y * width) + x];
+      } else {
+        blockOutPtr[i] = zeroValue;
+      }
+    }
+  }
+}
+
+// Select the supported block dimension that generates the smallest
+// estimated size for the codes plus the block offsets.
+
+int
+HuffmanUtil::selectBlockDim(
+                            const uint8_t *inBytes,
+                            int width,
+                            int height,
+                            int minNumBlocks,
+                            HuffPredictor predictor)
+{
+  const int debugOut = 0;
+  
+  const int blockDims[] = { 4, 8, 16, 32 };
+  const int numBlockDims = sizeof(blockDims) / sizeof(int);
+  
+  int bestBlockDim = blockDims[0];
+  uint64_t bestNumBytes = UINT64_MAX;
+  
+  vector<uint8_t> blockBytes;
+  vector<uint8_t> residuals;
+  vector<uint8_t> blockPredictors;
+  
+  for ( int dimi = 0; dimi < numBlockDims; dimi++ ) {
+    const int blockDim = blockDims[dimi];
+    const int blockNumSymbols = blockDim * blockDim;
+    
+    const int blockWidth = (width + blockDim - 1) / blockDim;
+    const int blockHeight = (height + blockDim - 1) / blockDim;
+    const int numBlocks = blockWidth * blockHeight;
+    
+    if (dimi > 0 && numBlocks < minNumBlocks) {
+      // Larger block dimensions generate even fewer blocks
+      break;
+    }
+    
+    blockBytes.resize(numBlocks * blockNumSymbols);
+    residuals.resize(blockBytes.size());
+    
+    splitImageToBlocks(inBytes, blockBytes.data(), width, height, blockDim, HUFF_SCAN_RASTER, 0);
+    encodePredictedBlocks(blockBytes.data(), residuals.data(), numBlocks, blockDim, predictor, blockPredictors);
+    
+    vector<uint32_t> frequencies(256);
+    
+    for ( uint8_t symbol : residuals ) {
+      frequencies[symbol] += 1;
+    }
+    
+    vector<uint8_t> table = generateCanonicalTableForFrequencies(frequencies);
+    
+    uint64_t numBits = 0;
+    
+    for ( int i = 0; i < 256; i++ ) {
+      numBits += (uint64_t) frequencies[i] * table[i];
+    }
+    
+    uint64_t numBytes = ((numBits + 7) / 8) + (numBlocks * sizeof(uint32_t));
+    
+    if (predictor == HUFF_PREDICTOR_ADAPTIVE) {
+      numBytes += numBlocks;
+    }
+    
+    if (debugOut) {
+      printf("blockDim %2d : %d blocks : %d code bytes + %d offset bytes\n", blockDim, numBlocks, (int)((numBits + 7) / 8), (int)(numBlocks * sizeof(uint32_t)));
+    }
+    
+    if (numBytes < bestNumBytes) {
+      bestNumBytes = numBytes;
+      bestBlockDim = blockDim;
+    }
+  }
+  
+  return bestBlockDim;
+}
@@ -12,6 +12,8 @@
 #define HuffmanUtil_hpp
 
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 
 // This header is pure C and can be included in either Objc or C++
@@ -19,6 +21,106 @@
 
 using namespace std;
 
+// Predictor used to generate residuals for the values in one block.
+// HUFF_PREDICTOR_DELTA is the 1D delta in block order that the
+// shaders decode. MED (the JPEG-LS median edge detector) and Paeth
+// make use of the left, above and above left values in the block.
+// HUFF_PREDICTOR_ADAPTIVE selects the best predictor for each block.
+
+typedef enum {
+  HUFF_PREDICTOR_DELTA = 0,
+  HUFF_PREDICTOR_MED,
+  HUFF_PREDICTOR_PAETH,
+  HUFF_PREDICTOR_NUM,
+  HUFF_PREDICTOR_ADAPTIVE = 0xFF,
+} HuffPredictor;
+
+// Order in which the values inside one block are visited when the
+// block is laid out as symbols. Raster order walks each row left to
+// right, serpentine reverses every other row so that consecutive
+// values are always neighbors. Morton and Hilbert orders require a
+// power of 2 block dimension.
+
+typedef enum {
+  HUFF_SCAN_RASTER = 0,
+  HUFF_SCAN_SERPENTINE,
+  HUFF_SCAN_MORTON,
+  HUFF_SCAN_HILBERT,
+  HUFF_SCAN_NUM,
+} HuffScanOrder;
+
+// Entropy coder used for the block symbols. The block layout, the
+// predictors and the block bit offsets do not depend on the coder.
+// HUFF_ENTROPY_TANS is the table driven ANS coder in HuffmanTANS,
+// decodeBlocksForFileHeader selects the decoder from this setting.
+
+typedef enum {
+  HUFF_ENTROPY_HUFFMAN = 0,
+  HUFF_ENTROPY_TANS,
+  HUFF_ENTROPY_NUM,
+} HuffEntropyCoder;
+
+// Table id that marks a flat block, all the residuals after the first
+// one are zero so the block is filled without reading code bits.
+
+#define HUFF_FLAT_BLOCK_TABLE_ID 0xFF
+
+// Table id that marks a raw block, the block symbols are stored as
+// bytes that begin at a byte aligned bit offset in the code buffer
+// and are copied without decoding.
+
+#define HUFF_RAW_BLOCK_TABLE_ID 0xFE
+
+// File header settings. The header always begins with a known 32 bit
+// pattern and the 32 bit number of encoded bytes. The settings that
+// follow are written as a count byte and then one byte per setting,
+// so a plain 8 byte header parses with the default values.
+// bitsPerSample is 8 for byte samples and up to 16 for the samples
+// encoded with Huffman16. blockInitPlane is 1 when the first value of
+// each block is stored in its own section, see HuffmanPreview.
+// predictor is HUFF_PREDICTOR_ADAPTIVE when each block records the
+// predictor it was encoded with.
+
+typedef struct {
+  uint32_t numBytes;
+  uint8_t blockDim;
+  uint8_t scanOrder;
+  uint8_t predictor;
+  uint8_t numTables;
+  uint8_t numChannels;
+  uint8_t bitsPerSample;
+  uint8_t entropyCoder;
+  uint8_t blockInitPlane;
+} HuffFileHeader;
+
+// Buffer sizes needed to encode one input span with encodeHuffmanToBuffers().
+// The aligned sizes are rounded up to HUFF_BUFFER_ALIGNMENT so that page
+// aligned buffers can be wrapped by a Metal buffer without a copy.
+
+#define HUFF_BUFFER_ALIGNMENT 16384
+
+typedef struct {
+  uint32_t numCodeBits;
+  uint32_t numCodeBytes;
+  uint32_t numBlocks;
+  uint32_t alignedNumCodeBytes;
+  uint32_t alignedNumBlockBitOffsetBytes;
+} HuffEncodeBufferSizes;
+
+// Result of a checked decode. A decode that returns an error has
+// not read outside of the inputs, but the output buffer contents
+// are undefined.
+
+typedef enum {
+  HUFF_DECODE_OK = 0,
+  HUFF_DECODE_ERROR_ARGUMENTS,
+  HUFF_DECODE_ERROR_TABLE,
+  HUFF_DECODE_ERROR_TABLE_ID,
+  HUFF_DECODE_ERROR_BLOCK_OFFSET,
+  HUFF_DECODE_ERROR_PADDING,
+  HUFF_DECODE_ERROR_CORRUPT_BLOCK,
+} HuffDecodeStatus;
+
 class HuffmanUtil {
 
 public:
@@ -91,12 +193,474 @@ public:
                 int height,
                 int blockDim);
   
+  // Generate the canonical table for inBytes and query the buffer sizes
+  // needed to encode it. outCanonHeader must hold 256 bytes. numCodeBytes
+  // includes the +2 bytes of read ahead padding and numBlocks is the number
+  // of complete (blockDim x blockDim) blocks in the input.
+  
+  static void
+  queryEncodeBufferSizes(
+                         const uint8_t *inBytes,
+                         int inNumBytes,
+                         int blockDim,
+                         uint8_t *outCanonHeader,
+                         HuffEncodeBufferSizes & outSizes);
+  
+  // Encode inBytes with a canonical table generated by queryEncodeBufferSizes()
+  // directly into caller owned buffers. The codes and padding are written to
+  // outHuffCodes and one bit offset for each block to outBlockBitOffsets, the
+  // input is not copied. Returns false when a buffer is too small.
+  
+  static bool
+  encodeHuffmanToBuffers(
+                         const uint8_t *inBytes,
+                         int inNumBytes,
+                         int blockDim,
+                         const uint8_t *canonHeader,
+                         uint8_t *outHuffCodes,
+                         int outHuffCodesN,
+                         uint32_t *outBlockBitOffsets,
+                         int outBlockBitOffsetsN,
+                         vector<uint8_t> & outFileHeader);
+  
+  // Encode block ordered input with multiple huffman tables. Blocks
+  // are clustered into at most maxNumTables groups by the similarity
+  // of their symbol statistics and one canonical table is generated
+  // for each group. The table used by each block is returned in
+  // outBlockTableIds, one byte for each block bit offset. When
+  // emitFlatBlocks is true a block where every residual after the
+  // first is zero is marked with HUFF_FLAT_BLOCK_TABLE_ID, it emits
+  // no code bits and its bit offset entry holds the first residual.
+  // When rawBlockThresholdBits is not negative, a block that coding
+  // would shrink by no more than rawBlockThresholdBits bits is marked
+  // with HUFF_RAW_BLOCK_TABLE_ID and its symbols are stored as bytes.
+  
+  static void
+  encodeHuffmanMultipleTables(
+                              uint8_t* inBytes,
+                              int inNumBytes,
+                              vector<uint8_t> & outFileHeader,
+                              vector<vector<uint8_t> > & outCanonHeaders,
+                              vector<uint8_t> & outHuffCodes,
+                              vector<uint32_t> & outBlockBitOffsets,
+                              vector<uint8_t> & outBlockTableIds,
+                              int blockDim,
+                              int maxNumTables,
+                              bool emitFlatBlocks,
+                              int rawBlockThresholdBits);
+  
+  // Decode block ordered symbols where each block selects a
+  // table1 and table2 pair by table id. Flat and raw blocks
+  // are filled without a table lookup. Note that this logic
+  // assumes that huffBuff contains +2 bytes at the end
+  // of the buffer to account for read ahead.
+  
+  static void
+  decodeHuffmanBlocksFromMultipleTables(
+                                        HuffLookupSymbol **huffSymbolTable1s,
+                                        HuffLookupSymbol **huffSymbolTable2s,
+                                        int numBlocks,
+                                        int blockDim,
+                                        uint8_t *huffBuff,
+                                        int huffBuffN,
+                                        uint32_t *blockBitOffsets,
+                                        uint8_t *blockTableIds,
+                                        uint8_t *outBuffer);
+  
+  // Generate intra block checkpoints so that the symbols in a block can
+  // be decoded as independent sub streams of checkpointInterval symbols.
+  // Each block stores (blockNumSymbols / checkpointInterval) - 1 bytes,
+  // each byte is the number of bits in the preceding sub stream. A sub
+  // stream always contains at least checkpointInterval bits, so when a
+  // sub stream is too long for a byte all the checkpoints for the block
+  // are written as zero and the block is decoded serially. When
+  // blockTableIds is NULL every block uses canonHeaders[0].
+  
+  static void
+  generateBlockCheckpoints(
+                           const uint8_t *inBytes,
+                           int numBlocks,
+                           int blockDim,
+                           const vector<vector<uint8_t> > & canonHeaders,
+                           const uint8_t *blockTableIds,
+                           int checkpointInterval,
+                           vector<uint8_t> & outCheckpoints);
+  
+  // Decode blocks with checkpoints, the sub streams in each block are
+  // decoded in an interleaved loop so that the table lookups for the
+  // sub streams do not depend on each other. When blockTableIds is
+  // NULL every block uses table id 0.
+  
+  static void
+  decodeHuffmanBlocksWithCheckpoints(
+                                     HuffLookupSymbol **huffSymbolTable1s,
+                                     HuffLookupSymbol **huffSymbolTable2s,
+                                     int numBlocks,
+                                     int blockDim,
+                                     uint8_t *huffBuff,
+                                     int huffBuffN,
+                                     uint32_t *blockBitOffsets,
+                                     uint8_t *blockTableIds,
+                                     const uint8_t *checkpoints,
+                                     int checkpointInterval,
+                                     uint8_t *outBuffer);
+  
+  // Decode numSymbols symbols that begin at bitOffset with a table1 and
+  // table2 pair. Returns the bit offset just past the last symbol. Note
+  // that this logic assumes that huffBuff contains +2 bytes at the end
+  // of the buffer to account for read ahead.
+  
+  static uint32_t
+  decodeHuffmanSymbolsAtBitOffset(
+                                  const HuffLookupSymbol *huffSymbolTable1,
+                                  const HuffLookupSymbol *huffSymbolTable2,
+                                  const uint8_t *huffBuff,
+                                  uint32_t bitOffset,
+                                  uint8_t *outBuffer,
+                                  int numSymbols);
+  
+  // Generate table1 and table2 for a canonical table of 256 bit widths
+  // without going through the module state used by parseCanonicalHeader.
+  // Returns HUFF_DECODE_ERROR_TABLE when a bit width is larger than 16,
+  // when no symbol has a code or when the codes are oversubscribed. Bit
+  // patterns that do not begin with a valid code resolve to an entry
+  // with a 16 bit width so that a decode loop always advances.
+  
+  static HuffDecodeStatus
+  generateCheckedLookupTables(
+                              const uint8_t *canonTable,
+                              vector<HuffLookupSymbol> & outTable1,
+                              vector<HuffLookupSymbol> & outTable2);
+  
+  // Decode block ordered symbols from untrusted input. The tables, the
+  // table ids and the block bit offsets are validated before anything
+  // is decoded. The coded blocks must be contiguous in huffBuff, as
+  // generated by encodeHuffman and encodeHuffmanMultipleTables, with
+  // each raw block at the first byte boundary after the previous block.
+  // The last code bit must be followed by the +2 bytes of read ahead
+  // padding. Blocks that cannot read past the end of huffBuff are
+  // decoded without any per symbol checks. When blockTableIds is NULL
+  // every block uses canonHeaders[0]. outBufferN must hold numBlocks
+  // blocks of symbols.
+  
+  static HuffDecodeStatus
+  decodeHuffmanBlocksChecked(
+                             const vector<vector<uint8_t> > & canonHeaders,
+                             int numBlocks,
+                             int blockDim,
+                             const uint8_t *huffBuff,
+                             int huffBuffN,
+                             const uint32_t *blockBitOffsets,
+                             const uint8_t *blockTableIds,
+                             uint8_t *outBuffer,
+                             int outBufferN);
+  
+  // Decode the block ordered symbols of a single table encoding with the
+  // entropy coder selected by the file header. tableHeader is the 256
+  // byte canonical header for HUFF_ENTROPY_HUFFMAN or the HuffmanTANS
+  // table header for HUFF_ENTROPY_TANS. The number of blocks and the
+  // block dimension come from the header, the output is the symbols
+  // before any predictor or scan order is undone.
+  
+  static HuffDecodeStatus
+  decodeBlocksForFileHeader(
+                            const uint8_t *fileHeader,
+                            int fileHeaderN,
+                            const uint8_t *tableHeader,
+                            int tableHeaderN,
+                            const uint8_t *codes,
+                            int codesN,
+                            const uint32_t *blockBitOffsets,
+                            int blockBitOffsetsN,
+                            uint8_t *outBuffer,
+                            int outBufferN);
+  
+  // Validate the block bit offsets of untrusted input before a checked
+  // decode. Coded blocks begin at bit 0 and the offsets increase inside
+  // the code bits, huffBuffN includes the +2 bytes of padding. The offset
+  // of a flat block is a symbol and a raw block is byte aligned and must
+  // end inside the code bits. When blockTableIds is NULL every block
+  // uses table 0.
+  
+  static HuffDecodeStatus
+  validateBlockBitOffsets(
+                          const uint32_t *blockBitOffsets,
+                          const uint8_t *blockTableIds,
+                          int numBlocks,
+                          int numTables,
+                          int blockDim,
+                          int huffBuffN);
+  
+  // Decode blocks [firstBlock, endBlock) of input that passed
+  // validateBlockBitOffsets. The blockDecoder is called as
+  // blockDecoder(tableId, huffBuff, bitOffset, outBuffer, numSymbols)
+  // to decode the symbols of one block and returns the bit offset after
+  // the last symbol. A code can be at most 16 bits wide. Each block must
+  // end where the next coded block begins, so the ranges of one input
+  // can be decoded independently.
+  
+  template <typename BlockDecoder>
+  static HuffDecodeStatus
+  decodeBlockRangeChecked(
+                          const BlockDecoder & blockDecoder,
+                          int numBlocks,
+                          int blockDim,
+                          const uint8_t *huffBuff,
+                          int huffBuffN,
+                          const uint32_t *blockBitOffsets,
+                          const uint8_t *blockTableIds,
+                          int firstBlock,
+                          int endBlock,
+                          uint8_t *outBuffer);
+  
+  // Init header settings to the defaults that correspond to a plain 8 byte header
+  
+  static void
+  initFileHeader(HuffFileHeader & header, uint32_t numBytes);
+  
+  // Write header settings as bytes
+  
+  static void
+  generateFileHeader(const HuffFileHeader & header,
+                     vector<uint8_t> & outFileHeader);
+  
+  // Parse header bytes, returns false if the header is not valid
+  
+  static bool
+  parseFileHeader(const uint8_t *headerBytes,
+                  int headerNumBytes,
+                  HuffFileHeader & header);
+  
+  // Generate the block offset of each value in scan order, so that
+  // scan[i] is the (row * blockDim + col) offset of the i-th value.
+  
+  static void
+  generateBlockScanOrder(int blockDim,
+                         HuffScanOrder scanOrder,
+                         vector<uint16_t> & outScan);
+  
+  // Reorder the values inside each block from raster order to scan order
+  
+  static void
+  reorderBlocksToScanOrder(
+                           const uint8_t *inBytes,
+                           uint8_t *outBytes,
+                           int numBlocks,
+                           int blockDim,
+                           HuffScanOrder scanOrder);
+  
+  // Reorder the values inside each block from scan order back to raster order
+  
+  static void
+  reorderBlocksFromScanOrder(
+                             const uint8_t *inBytes,
+                             uint8_t *outBytes,
+                             int numBlocks,
+                             int blockDim,
+                             HuffScanOrder scanOrder);
+  
+  // Returns true when blockDim is one of the supported block dimensions 4, 8, 16 or 32
+  
+  static bool
+  isSupportedBlockDim(int blockDim);
+  
+  // Number of blocks needed to cover one dimension, a partial block
+  // along the right or bottom edge counts as a whole block
+  
+  static int
+  numBlocksForDim(int dim, int blockDim);
+  
+  // JPEG-LS median edge detector, a is left, b is above and c is above
+  // left. This is defined here so that it inlines into the per value
+  // loops of each predictor.
+  
+  static int
+  predictMED(const int a, const int b, const int c)
+  {
+    const int minAB = (a < b) ? a : b;
+    const int maxAB = (a < b) ? b : a;
+    
+    if (c >= maxAB) {
+      return minAB;
+    } else if (c <= minAB) {
+      return maxAB;
+    } else {
+      return a + b - c;
+    }
+  }
+  
+  // Paeth predictor from PNG, a is left, b is above and c is above left
+  
+  static int
+  predictPaeth(const int a, const int b, const int c)
+  {
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    
+    if (pa <= pb && pa <= pc) {
+      return a;
+    } else if (pb <= pc) {
+      return b;
+    } else {
+      return c;
+    }
+  }
+  
+  // Split a width x height image into block ordered values. The values in
+  // each block are written in scan order and blocks along the right and
+  // bottom edges are padded with zeroValue.
+  
+  static void
+  splitImageToBlocks(
+                     const uint8_t *inBytes,
+                     uint8_t *outBlockBytes,
+                     int width,
+                     int height,
+                     int blockDim,
+                     HuffScanOrder scanOrder,
+                     uint8_t zeroValue);
+  
+  // Select the supported block dimension that generates the smallest
+  // estimated size, counting both the huffman codes and the 32 bit block
+  // offsets. Block dimensions that generate fewer than minNumBlocks
+  // blocks are skipped so that decoding can make use of at least
+  // minNumBlocks parallel units. When no block dimension generates
+  // enough blocks, the smallest block dimension is returned.
+  
+  static int
+  selectBlockDim(
+                 const uint8_t *inBytes,
+                 int width,
+                 int height,
+                 int minNumBlocks,
+                 HuffPredictor predictor);
+  
+  // Write block ordered values to a width x height image in raster order,
+  // the values in each block are read in scan order and the zero padding
+  // in the blocks along the right and bottom edges is cropped.
+  
+  static void
+  flattenBlocksToImage(
+                       const uint8_t *inBlockBytes,
+                       uint8_t *outBytes,
+                       int width,
+                       int height,
+                       int blockDim,
+                       HuffScanOrder scanOrder);
+  
   static vector<int8_t>
   encodeSignedByteDeltas(const vector<int8_t> & bytes);
   
+  // Generate prediction residuals for block ordered input. The predictor
+  // used for each block is written to outBlockPredictors, when predictor
+  // is HUFF_PREDICTOR_ADAPTIVE the predictor that generates the smallest
+  // residuals is selected for each block.
+  
+  static void
+  encodePredictedBlocks(
+                        const uint8_t *inBytes,
+                        uint8_t *outResiduals,
+                        int numBlocks,
+                        int blockDim,
+                        HuffPredictor predictor,
+                        vector<uint8_t> & outBlockPredictors);
+  
+  // Reconstruct block ordered values from residuals, this is the
+  // inverse of encodePredictedBlocks.
+  
+  static void
+  decodePredictedBlocks(
+                        const uint8_t *inResiduals,
+                        uint8_t *outBytes,
+                        int numBlocks,
+                        int blockDim,
+                        const uint8_t *blockPredictors);
+  
   static vector<int8_t>
   decodeSignedByteDeltas(const vector<int8_t> & deltas);
 
 };
+
+// A symbol is at most 16 bits wide, so a block that begins at least
+// (blockNumSymbols * 16) bits before the end of the code bits can be
+// decoded in place. A block near the end is decoded from a copy of the
+// remaining bytes followed by zeros, so that no read goes past the end
+// of huffBuff. Symbols that read the zeros end past the code bits and
+// fail the end of block check.
+
+template <typename BlockDecoder>
+HuffDecodeStatus
+HuffmanUtil::decodeBlockRangeChecked(
+                                     const BlockDecoder & blockDecoder,
+                                     int numBlocks,
+                                     int blockDim,
+                                     const uint8_t *huffBuff,
+                                     int huffBuffN,
+                                     const uint32_t *blockBitOffsets,
+                                     const uint8_t *blockTableIds,
+                                     int firstBlock,
+                                     int endBlock,
+                                     uint8_t *outBuffer)
+{
+  const int blockNumSymbols = blockDim * blockDim;
+  const uint64_t numCodeBits = (uint64_t) (huffBuffN - 2) * 8;
+  const uint64_t maxBlockNumBits = blockNumSymbols * 16;
+  
+  for ( int blocki = firstBlock; blocki < endBlock; blocki++ ) {
+    const int tableId = (blockTableIds != nullptr) ? blockTableIds[blocki] : 0;
+    const uint32_t bitOffset = blockBitOffsets[blocki];
+    uint8_t *blockOutPtr = outBuffer + (blocki * blockNumSymbols);
+    uint64_t endBitOffset;
+    
+    if (tableId == HUFF_FLAT_BLOCK_TABLE_ID) {
+      memset(blockOutPtr, 0, blockNumSymbols);
+      blockOutPtr[0] = (uint8_t) bitOffset;
+      continue;
+    }
+    
+    if (tableId == HUFF_RAW_BLOCK_TABLE_ID) {
+      memcpy(blockOutPtr, huffBuff + (bitOffset / 8), blockNumSymbols);
+      endBitOffset = bitOffset + (blockNumSymbols * 8);
+    } else if ((bitOffset + maxBlockNumBits) <= numCodeBits) {
+      endBitOffset = blockDecoder(tableId, huffBuff, bitOffset, blockOutPtr, blockNumSymbols);
+    } else {
+      // 2 bytes for each symbol of a 32x32 block plus the read ahead
+      uint8_t tailBuff[(32 * 32 * 2) + 3];
+      
+      const int tailByteOffset = bitOffset / 8;
+      const int tailNumBytes = huffBuffN - tailByteOffset;
+      const int tailBuffN = (int) (maxBlockNumBits / 8) + 3;
+      
+      memcpy(tailBuff, huffBuff + tailByteOffset, tailNumBytes);
+      memset(tailBuff + tailNumBytes, 0, tailBuffN - tailNumBytes);
+      
+      endBitOffset = (tailByteOffset * 8) + blockDecoder(tableId, tailBuff, bitOffset % 8, blockOutPtr, blockNumSymbols);
+    }
+    
+    // The next coded block begins where this block ends, a raw block
+    // begins at the next byte boundary.
+    
+    int nextBlocki = blocki + 1;
+    
+    while (nextBlocki < numBlocks && blockTableIds != nullptr && blockTableIds[nextBlocki] == HUFF_FLAT_BLOCK_TABLE_ID) {
+      nextBlocki += 1;
+    }
+    
+    if (nextBlocki < numBlocks) {
+      if (blockTableIds != nullptr && blockTableIds[nextBlocki] == HUFF_RAW_BLOCK_TABLE_ID) {
+        endBitOffset = (endBitOffset + 7) & ~0x7;
+      }
+      if (endBitOffset != blockBitOffsets[nextBlocki]) {
+        return HUFF_DECODE_ERROR_CORRUPT_BLOCK;
+      }
+    } else if (endBitOffset > numCodeBits) {
+      return HUFF_DECODE_ERROR_CORRUPT_BLOCK;
+    }
+  }
+  
+  return HUFF_DECODE_OK;
+}
   
 #endif // HuffmanUtil_hpp
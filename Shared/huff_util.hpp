@@ -11,6 +11,8 @@
 #include <vector>
 #include <unordered_map>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 
@@ -191,3 +193,216 @@ huff_generate_canonical_codes(
   
   return huffmanCodes;
 }
+
+// Build huffman code widths for 256 symbol frequencies with the two
+// queue method. Leaves are sorted once by weight and then symbol, and
+// internal nodes are created in order of increasing weight, so the two
+// smallest nodes are always at the front of the two queues. When a leaf
+// and an internal node have the same weight the leaf is taken first,
+// this builds the same tree as the sorted insertion in HuffmanEncoder.
+// The width of each symbol is the depth of its leaf, a single symbol
+// gets a 1 bit code. Returns the max width, which can be larger than 16.
+
+static inline
+int
+huff_build_code_widths(
+                       const uint32_t *frequencies,
+                       uint8_t *outBitWidths
+                       )
+{
+  uint64_t leafKeys[256];
+  uint64_t weights[2 * 256];
+  int parents[2 * 256];
+  int depths[2 * 256];
+  
+  int numLeaves = 0;
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    outBitWidths[symbol] = 0;
+    if (frequencies[symbol] > 0) {
+      leafKeys[numLeaves++] = (((uint64_t) frequencies[symbol]) << 8) | symbol;
+    }
+  }
+  
+  if (numLeaves == 0) {
+    return 0;
+  }
+  
+  if (numLeaves == 1) {
+    outBitWidths[leafKeys[0] & 0xFF] = 1;
+    return 1;
+  }
+  
+  sort(leafKeys, leafKeys + numLeaves);
+  
+  for ( int i = 0; i < numLeaves; i++ ) {
+    weights[i] = leafKeys[i] >> 8;
+  }
+  
+  // Leaves are nodes [0, numLeaves) and internal nodes follow
+  
+  int nextLeaf = 0;
+  int nextInternal = numLeaves;
+  int numNodes = numLeaves;
+  
+  for ( int k = 0; k < (numLeaves - 1); k++ ) {
+    int children[2];
+    
+    for ( int c = 0; c < 2; c++ ) {
+      if (nextLeaf < numLeaves &&
+          (nextInternal == numNodes || weights[nextLeaf] <= weights[nextInternal])) {
+        children[c] = nextLeaf++;
+      } else {
+        children[c] = nextInternal++;
+      }
+    }
+    
+    weights[numNodes] = weights[children[0]] + weights[children[1]];
+    parents[children[0]] = numNodes;
+    parents[children[1]] = numNodes;
+    numNodes++;
+  }
+  
+  // A parent is always created after its children, so the depths
+  // can be set in one pass from the root down.
+  
+  const int root = numNodes - 1;
+  depths[root] = 0;
+  
+  int maxBitWidth = 0;
+  
+  for ( int node = root - 1; node >= 0; node-- ) {
+    depths[node] = depths[parents[node]] + 1;
+  }
+  
+  for ( int i = 0; i < numLeaves; i++ ) {
+    const int bitWidth = depths[i];
+    outBitWidths[leafKeys[i] & 0xFF] = (uint8_t) ((bitWidth > 0xFF) ? 0xFF : bitWidth);
+    if (bitWidth > maxBitWidth) {
+      maxBitWidth = bitWidth;
+    }
+  }
+  
+  return maxBitWidth;
+}
+
+// Build code widths that are at most 16 bits wide. When the tree for
+// the frequencies is too deep the frequencies are scaled down, keeping
+// every used symbol, and the tree is built again.
+
+static inline
+void
+huff_build_limited_code_widths(
+                               const uint32_t *frequencies,
+                               uint8_t *outBitWidths
+                               )
+{
+  uint32_t scaledFrequencies[256];
+  memcpy(scaledFrequencies, frequencies, sizeof(scaledFrequencies));
+  
+  while (huff_build_code_widths(scaledFrequencies, outBitWidths) > 16) {
+    for ( uint32_t & freq : scaledFrequencies ) {
+      if (freq > 0) {
+        freq = (freq + 1) / 2;
+      }
+    }
+  }
+}
+
+// Generate the same left justified canonical codes as
+// huff_generate_canonical_codes() into a caller provided array of
+// 256 codes without allocating. Codes are assigned in order of bit
+// width and then symbol by counting the number of codes of each width.
+
+static inline
+void
+huff_generate_canonical_codes_in_place(
+                                       const uint8_t *inTable,
+                                       uint16_t *outCodes
+                                       )
+{
+  uint32_t numCodesOfWidth[17];
+  uint32_t nextCodeOfWidth[17];
+  
+  memset(numCodesOfWidth, 0, sizeof(numCodesOfWidth));
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+#if defined(DEBUG)
+    assert(inTable[symbol] <= 16);
+#endif // DEBUG
+    numCodesOfWidth[inTable[symbol]] += 1;
+  }
+  
+  numCodesOfWidth[0] = 0;
+  
+  uint32_t code = 0;
+  
+  for ( int bitWidth = 1; bitWidth <= 16; bitWidth++ ) {
+    code = (code + numCodesOfWidth[bitWidth-1]) << 1;
+    nextCodeOfWidth[bitWidth] = code;
+  }
+  
+  for ( int symbol = 0; symbol < 256; symbol++ ) {
+    const int bitWidth = inTable[symbol];
+    if (bitWidth == 0) {
+      outCodes[symbol] = 0;
+    } else {
+      outCodes[symbol] = (uint16_t) (nextCodeOfWidth[bitWidth] << (16 - bitWidth));
+      nextCodeOfWidth[bitWidth] += 1;
+    }
+  }
+}
+
+// Write a left justified code that is bitWidth bits wide into a zero
+// initialized buffer at the indicated bit offset. Bits are written
+// MSB first to match the layout emitted by HuffmanEncoder. Note that
+// a code can span 3 bytes, so the output buffer must contain the
+// same +2 bytes of padding that the decoder reads ahead into.
+
+static inline
+void
+huff_write_code_bits(
+                     uint8_t *outBuffer,
+                     const uint32_t bitOffset,
+                     const uint16_t code,
+                     const int bitWidth)
+{
+#if defined(DEBUG)
+  assert(bitWidth > 0 && bitWidth <= 16);
+  assert((code & (0xFFFF >> bitWidth)) == 0);
+#endif // DEBUG
+  
+  // Place the 16 bit code in the high bits of a 24 bit value
+  // and then shift right by the number of bits already used
+  // in the first byte.
+  
+  uint32_t bits = ((uint32_t) code) << 8;
+  bits >>= (bitOffset % 8);
+  
+  uint8_t *ptr = outBuffer + (bitOffset / 8);
+  ptr[0] |= (bits >> 16) & 0xFF;
+  ptr[1] |= (bits >> 8) & 0xFF;
+  ptr[2] |= bits & 0xFF;
+}
+
+// Read a left justified 16 bit pattern that begins at the bit offset
+// numBitsRead. This reads 3 bytes, so huffBuff must contain +2 bytes
+// of padding after the last byte that contains a code bit.
+
+static inline
+uint16_t
+huff_read_code_bits(
+                    const uint8_t *huffBuff,
+                    const unsigned int numBitsRead)
+{
+  const unsigned int numBytesRead = (numBitsRead / 8);
+  const unsigned int numBitsReadMod8 = (numBitsRead % 8);
+  
+  unsigned int b0 = huffBuff[numBytesRead];
+  unsigned int b1 = huffBuff[numBytesRead+1];
+  unsigned int b2 = huffBuff[numBytesRead+2];
+  
+  uint32_t bits = (b0 << 16) | (b1 << 8) | b2;
+  bits <<= numBitsReadMod8;
+  return (uint16_t) ((bits >> 8) & 0xFFFF);
+}